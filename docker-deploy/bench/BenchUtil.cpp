@@ -0,0 +1,211 @@
+#include "BenchUtil.hpp"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+double hashPoint(const std::string & text, uint64_t salt) {
+    // FNV-1a, finished with a 64-bit mix so nearby paths spread out
+    uint64_t h = 0xcbf29ce484222325ULL ^ (salt * 0x9e3779b97f4a7c15ULL);
+    for (size_t i = 0; i < text.size(); ++i) {
+        h ^= (unsigned char)text[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+std::vector<std::pair<std::string, double> > weightedList(const std::string & text, char sep) {
+    std::vector<std::pair<std::string, double> > items;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(sep, start);
+        end = end == std::string::npos ? text.size() : end;
+        std::string item = text.substr(start, end - start);
+        size_t colon = item.rfind(':');
+        char * weight_end = NULL;
+        double weight = colon == std::string::npos ? 0 : strtod(item.c_str() + colon + 1, &weight_end);
+        if (colon == std::string::npos || colon == 0 || *weight_end != '\0' || weight < 0) {
+            throw std::invalid_argument("invalid weighted item \"" + item + "\"");
+        }
+        items.push_back(std::make_pair(item.substr(0, colon), weight));
+        start = end + 1;
+    }
+    return items;
+}
+
+size_t parseSize(const std::string & text) {
+    char * end = NULL;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        throw std::invalid_argument("invalid size \"" + text + "\"");
+    }
+    switch (*end) {
+        case 'G':
+        case 'g':
+            value *= 1024;
+        // fall through
+        case 'M':
+        case 'm':
+            value *= 1024;
+        // fall through
+        case 'K':
+        case 'k':
+            value *= 1024;
+            ++end;
+            break;
+    }
+    if (*end != '\0') {
+        throw std::invalid_argument("invalid size \"" + text + "\"");
+    }
+    return value;
+}
+
+uint64_t nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool sendAll(int fd, const char * data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+int connectTo(const std::string & address, int timeout) {
+    size_t colon = address.rfind(':');
+    std::string host = address.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : address.substr(colon + 1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * result = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo * ai = result; ai != NULL && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd != -1) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        struct timeval tv = {timeout, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    return fd;
+}
+
+Endpoint resolve(const std::string & address) {
+    size_t colon = address.rfind(':');
+    std::string host = address.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : address.substr(colon + 1);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo * result = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || result == NULL) {
+        throw std::invalid_argument("cannot resolve " + address);
+    }
+    Endpoint endpoint;
+    memcpy(&endpoint.addr, result->ai_addr, result->ai_addrlen);
+    endpoint.len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return endpoint;
+}
+
+int connectNonBlocking(const Endpoint & endpoint) {
+    int fd = socket(endpoint.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    if (connect(fd, (const struct sockaddr *)&endpoint.addr, endpoint.len) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+long raiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        return -1;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return (long)limit.rlim_cur;
+}
+
+std::string fieldValue(const std::string & head, const char * name) {
+    size_t pos = 0;
+    size_t len = strlen(name);
+    while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if (strncasecmp(head.c_str() + pos, name, len) == 0 && head[pos + len] == ':') {
+            size_t start = head.find_first_not_of(" \t", pos + len + 1);
+            size_t end = head.find("\r\n", pos);
+            return start < end ? head.substr(start, end - start) : "";
+        }
+    }
+    return "";
+}
+
+long residentKb(int pid) {
+    std::string path = "/proc/" + std::to_string(pid) + "/status";
+    FILE * status = fopen(path.c_str(), "r");
+    if (status == NULL) {
+        return -1;
+    }
+    long kb = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            kb = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+}
+
+uint64_t percentile(const std::vector<uint64_t> & sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)(q * sorted.size());
+    return sorted[rank < sorted.size() ? rank : sorted.size() - 1];
+}
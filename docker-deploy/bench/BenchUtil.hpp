@@ -0,0 +1,56 @@
+#ifndef __BENCH_UTIL_HPP_
+#define __BENCH_UTIL_HPP_
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a point in [0, 1) derived from text and salt, the same on every run
+double hashPoint(const std::string & text, uint64_t salt);
+
+// "NAME:WEIGHT" items separated by sep, throws std::invalid_argument
+std::vector<std::pair<std::string, double> > weightedList(const std::string & text, char sep);
+
+// a byte count with an optional K/M/G suffix, throws std::invalid_argument
+size_t parseSize(const std::string & text);
+
+// monotonic clock in microseconds
+uint64_t nowMicros();
+
+// blocking send of all len bytes, false if the peer went away
+bool sendAll(int fd, const char * data, size_t len);
+
+// blocking TCP connection to "host:port", -1 on failure. Sends and receives
+//  give up after timeout seconds
+int connectTo(const std::string & address, int timeout);
+
+// an address resolved once and connected to many times
+struct Endpoint {
+    struct sockaddr_storage addr;
+    socklen_t len;
+};
+
+// the first address of "host:port", throws std::invalid_argument if it does
+//  not resolve
+Endpoint resolve(const std::string & address);
+
+// a non-blocking TCP socket connecting to endpoint, -1 on failure. The
+//  connection is made once the socket turns writable
+int connectNonBlocking(const Endpoint & endpoint);
+
+// raise the limit of open files to its hard limit, returns the new limit
+long raiseFileLimit();
+
+// value of the header field name (case-insensitive) in an HTTP head, empty
+//  if the field is absent
+std::string fieldValue(const std::string & head, const char * name);
+
+// resident set size of process pid in KiB, -1 if it cannot be read
+long residentKb(int pid);
+
+// the value at fraction q (0 to 1) of sorted values, 0 if there are none
+uint64_t percentile(const std::vector<uint64_t> & sorted, double q);
+
+#endif
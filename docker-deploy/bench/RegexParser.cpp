@@ -0,0 +1,177 @@
+#include "RegexParser.hpp"
+
+#include <cctype>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+#include "Logger.hpp"
+#include "Util.hpp"
+
+// the original's helpers, kept as they were, lowercasing included
+
+static const int UNSPECIFIED = -1;
+
+static std::pair<bool, size_t> findEmptyLine(const std::vector<char> & req) {
+    for (size_t i = 0; i < req.size() - 3; ++i) {
+        if (req[i] == '\r' && req[i + 1] == '\n' && req[i + 2] == '\r' && req[i + 3] == '\n') {
+            return std::pair<bool, size_t>(true, i);
+        }
+    }
+    return std::pair<bool, size_t>(false, req.size());
+}
+
+static std::string lstrip(const std::string & str) {
+    size_t start = str.find_first_not_of(" \0");
+    if (start == std::string::npos) {
+        return "";
+    }
+    return str.substr(start);
+}
+
+static std::string allToLowercase(const std::string & str) {
+    std::stringstream ss;
+    for (size_t i = 0; i < str.length(); ++i) {
+        ss << std::to_string(std::tolower(str[i]));
+    }
+    return ss.str();
+}
+
+static int assignValueOrUnspecified(const std::pair<bool, std::string> & data) {
+    int temp = std::stoi(data.second);
+    if (temp <= 0) {
+        throw std::invalid_argument("cache control attribute less than or equal to 0");
+    }
+    return data.first ? temp : UNSPECIFIED;
+}
+
+static RequestType getReqType(const std::string & header) {
+    std::string method;
+    std::regex req_method_rgx("^GET|POST|CONNECT");
+    std::smatch req_method_matches;
+    if (std::regex_search(header, req_method_matches, req_method_rgx)) {
+        if (req_method_matches.size() != 1) {
+            throw std::invalid_argument("Error: more than one http method specified");
+        }
+        method = req_method_matches[0].str();
+    } else {
+        throw std::invalid_argument("Error: none or not supported http method specified");
+    }
+    return repr_to_req_type(method);
+}
+
+static std::string getUrl(const std::string & header) {
+    std::string url;
+    std::regex url_rgx("(?:GET|CONNECT|POST)\\s(\\S*)\\s");
+    std::smatch url_matches;
+    if (std::regex_search(header, url_matches, url_rgx)) {
+        if (url_matches.size() != 2) {
+            throw std::invalid_argument("Error: invalid url path in request");
+        }
+        url = url_matches[1].str();
+    } else {
+        throw std::invalid_argument("Error: no url path in request");
+    }
+    return url;
+}
+
+static size_t getContentLength(const std::string & header, RequestType r_type) {
+    size_t content_len;
+    std::regex content_len_rgx("(?:Content-Length:) (\\d+)");
+    std::smatch content_len_matches;
+    if (std::regex_search(header, content_len_matches, content_len_rgx)) {
+        if (content_len_matches.size() != 2 && r_type == POST) {
+            throw std::invalid_argument("Error: invalid content length");
+        }
+        log_info("Content length is: " + content_len_matches[1].str());
+        content_len = std::stol(content_len_matches[1].str());
+        if (r_type != POST && content_len != 0) {
+            throw std::invalid_argument("Error: invalid content length");
+        }
+    } else {
+        if (r_type == POST) {
+            throw std::invalid_argument("Error: invalid content length");
+        }
+        content_len = 0;
+    }
+    return content_len;
+}
+
+static std::pair<std::string, uint16_t> getHostAndPort(const std::string & header) {
+    std::string host;
+    std::string port_str;
+    uint16_t port;
+    std::regex host_port_rgx("(?:Host: )([^:\\s]+)(?::*)(\\d*)");
+    std::smatch host_port_matches;
+    if (std::regex_search(header, host_port_matches, host_port_rgx)) {
+        if (host_port_matches.size() != 3) {
+            throw std::invalid_argument("Error: invalid host format");
+        }
+        host = host_port_matches[1].str();
+        port_str = host_port_matches[2].str();
+        if (port_str.length() == 0) {
+            port = 80;
+        } else {
+            port = std::stol(port_str);
+        }
+    } else {
+        throw std::invalid_argument("Error: Missing host information");
+    }
+    return std::pair<std::string, uint16_t>(host, port);
+}
+
+static std::pair<bool, std::string> helper(const std::string & toFind, const std::string & header) {
+    size_t f1 = header.find(toFind);
+    if (f1 == std::string::npos) {
+        return std::pair<bool, std::string>(false, "");
+    }
+    size_t f2 = header.find("\r\n", f1 + 1);
+    size_t len = toFind.size();
+    return std::pair<bool, std::string>(true, header.substr(f1 + len, f2 - f1 - len));
+}
+
+static std::pair<bool, std::string> getCacheControlAttribute(const std::string & src, const std::string & restrict) {
+    std::regex rgx(restrict);
+    std::smatch matches;
+    if (std::regex_search(src, matches, rgx)) {
+        if (matches.size() != 2) {
+            return std::pair<bool, std::string>(false, "");
+        }
+        return std::pair<bool, std::string>(true, matches[1].str());
+    }
+    return std::pair<bool, std::string>(false, "");
+}
+
+RegexRequest RegexParser::parseHeader(const std::vector<char> & req) {
+    std::pair<bool, size_t> ans = findEmptyLine(req);
+    size_t empty_line_idx = ans.first ? ans.second : req.size() - 1;
+
+    RegexRequest parsed;
+    std::stringstream req_ss;
+    for (size_t i = 0; i <= empty_line_idx; ++i) {
+        req_ss << req[i];
+    }
+    parsed.head = lstrip(req_ss.str());
+
+    parsed.type = getReqType(parsed.head);
+    parsed.url = getUrl(parsed.head);
+    parsed.content_length = getContentLength(parsed.head, parsed.type);
+    std::pair<std::string, uint16_t> host_port = getHostAndPort(parsed.head);
+    parsed.host = host_port.first;
+    parsed.port = parsed.type == CONNECT ? 443 : host_port.second;
+    parsed.first_line = parsed.head.substr(0, parsed.head.find("\r\n"));
+
+    parsed.max_age = parsed.max_stale = parsed.min_fresh = UNSPECIFIED;
+    parsed.no_cache = parsed.no_store = parsed.only_if_cached = false;
+    std::pair<bool, std::string> cache_ctrl_ans = helper("Cache-Control: ", parsed.head);
+    if (cache_ctrl_ans.first) {
+        const std::string & cache_ctrl_str = allToLowercase(cache_ctrl_ans.second);
+        parsed.max_age = assignValueOrUnspecified(getCacheControlAttribute(cache_ctrl_str, "(?:max-age=)(\\d+)"));
+        parsed.max_stale = assignValueOrUnspecified(getCacheControlAttribute(cache_ctrl_str, "(?:max-stale=)(\\d+)"));
+        parsed.min_fresh = assignValueOrUnspecified(getCacheControlAttribute(cache_ctrl_str, "(?:min-fresh=)(\\d+)"));
+        parsed.no_cache = getCacheControlAttribute(cache_ctrl_str, "(no-cache)").first;
+        parsed.no_store = getCacheControlAttribute(cache_ctrl_str, "(no-store)").first;
+        parsed.only_if_cached = getCacheControlAttribute(cache_ctrl_str, "(only-if-cached)").first;
+    }
+    return parsed;
+}
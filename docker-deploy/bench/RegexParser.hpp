@@ -0,0 +1,43 @@
+#ifndef __REGEX_PARSER_HPP_
+#define __REGEX_PARSER_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "RequestType.hpp"
+
+/**
+ * What the regex parser got out of a request header, the fields its
+ * RequestMeta was built from
+ */
+struct RegexRequest {
+    RequestType type;
+    std::string url;
+    size_t content_length;
+    std::string host;
+    uint16_t port;
+    std::string first_line;
+    int max_age;
+    int max_stale;
+    int min_fresh;
+    bool no_cache;
+    bool no_store;
+    bool only_if_cached;
+    std::string head;
+};
+
+/**
+ * A copy of HttpParser::parseHeader as it was before RequestParser replaced
+ * it: the header is copied into a string through a stringstream and every
+ * value is found by its own std::regex search. Only the microbenchmark uses
+ * it, to time the proxy's request parsing against what it replaced. Like the
+ * original it throws std::invalid_argument on what it cannot parse, which
+ * includes every request with a Cache-Control field.
+ */
+class RegexParser {
+public:
+    static RegexRequest parseHeader(const std::vector<char> & req);
+};
+
+#endif
@@ -0,0 +1,1330 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "BenchUtil.hpp"
+
+/**
+ * Open-loop load generator for the proxy. Requests go out when a fixed
+ * --rate schedule says so, however many earlier ones are still unanswered:
+ * every thread drives its share of the schedule from one epoll loop over
+ * non-blocking sockets, with as many exchanges in flight as the proxy is slow
+ * to answer. Latency counts from the time a request was due, so a stalled
+ * proxy shows up in the tail instead of slowing the load down. Each request
+ * gets its own client connection and reads the answer to the end.
+ * The request mix names what each request is meant to exercise, against the
+ * paths of origin_stub:
+ *   hit         GET of the hot set, warmed before measuring
+ *   miss        GET of a url never asked before
+ *   revalidate  GET of a no-cache object, the proxy asks the origin each time
+ *   post        POST with a --post-size body
+ *   connect     CONNECT tunnel to the origin, then a GET through it
+ * Results per kind (throughput, p50/p99/p999/max latency, time to the first
+ * answer byte, errors) and what reached the origin are written as json.
+ * With --object it fetches a single object never asked before instead, to
+ * time how the proxy streams a large body. With --connections it holds ever
+ * more idle keep-alive connections open and, at each step, measures hits sent
+ * over them at --rate, to see how the proxy's memory and latency grow with
+ * its client count. With --burst it sends that many requests for one cold
+ * object at once and checks that the origin was asked for it exactly once,
+ * or with --stall that every one is answered 504 by an origin that never
+ * answers.
+ * Given the proxy's pid, the proxy's resident memory is sampled all along.
+ */
+
+#define IO_TIMEOUT 30
+#define READ_SIZE 65536
+// events taken from epoll at once
+#define MAX_EVENTS 256
+// answer headers longer than this are not waited for
+#define MAX_HEAD 65536
+// the proxy's memory is sampled this often
+#define RSS_INTERVAL_MS 20
+// connections opening at once in --connections runs
+#define OPEN_BATCH 256
+// idle connections settle this long before the proxy's memory is read
+#define SETTLE_MS 1000
+
+enum Kind {
+    HIT,
+    MISS,
+    REVALIDATE,
+    POST,
+    CONNECT,
+    KINDS
+};
+
+static const char * kind_names[KINDS] = {"hit", "miss", "revalidate", "post", "connect"};
+
+struct LoadConfig {
+    std::string proxy;
+    // origin address as the proxy reaches it, urls name it
+    std::string origin;
+    int threads;
+    double rate;
+    int duration;
+    double mix[KINDS];
+    int hot_objects;
+    size_t post_size;
+    std::string json_path;
+    // sampled for memory if positive
+    int proxy_pid;
+    bool object;
+    // connections held open at each step, ascending
+    std::vector<int> connections;
+    // simultaneous requests for one cold object if positive
+    int burst;
+    // the burst asks for an object the origin never answers
+    bool stall;
+
+    LoadConfig() :
+        proxy("127.0.0.1:12345"), origin("127.0.0.1:8081"), threads(4), rate(500), duration(10),
+        hot_objects(100), post_size(1024), proxy_pid(0), object(false), burst(0), stall(false) {
+        double defaults[KINDS] = {70, 10, 10, 5, 5};
+        std::copy(defaults, defaults + KINDS, mix);
+    }
+};
+
+struct Sample {
+    std::vector<uint64_t> latencies;
+    // from due time to the first answer byte, answered requests only
+    std::vector<uint64_t> ttfbs;
+    uint64_t errors;
+    uint64_t bytes;
+
+    Sample() : errors(0), bytes(0) {}
+};
+
+// where an exchange is, its socket is watched for what it waits on
+enum Stage {
+    CONNECTING,
+    SENDING,
+    OPENING_TUNNEL,
+    READING
+};
+
+/**
+ * One request and its answer on its own connection
+ */
+struct Exchange {
+    int fd;
+    Kind kind;
+    Stage stage;
+    std::string out;
+    size_t out_off;
+    // sent once the proxy opened the tunnel, CONNECT only
+    std::string tunnel_request;
+    bool tunnel_open;
+    // when the schedule wanted the request sent
+    uint64_t due;
+    // when the first byte of the answer came, 0 before
+    uint64_t first_byte;
+    // answer header, complete once head_done
+    std::string head;
+    bool head_done;
+    int status;
+    uint64_t bytes;
+
+    Exchange() :
+        fd(-1), kind(HIT), stage(CONNECTING), out_off(0), tunnel_open(false), due(0), first_byte(0),
+        head_done(false), status(0), bytes(0) {}
+};
+
+struct Worker {
+    pthread_t thread;
+    int index;
+    Sample samples[KINDS];
+    // furthest a request went out behind its due time
+    uint64_t max_lag;
+    // most exchanges waiting for the proxy at once
+    size_t max_in_flight;
+    // complete answers by status code
+    std::map<int, uint64_t> statuses;
+
+    Worker() : index(0), max_lag(0), max_in_flight(0) {}
+};
+
+/**
+ * A client connection held open through the --connections steps. It sends a
+ * request when the schedule picks it and reads the answer by its framing
+ */
+struct Held {
+    int fd;
+    bool connected;
+    // the proxy answered on it once, so it took the connection
+    bool proven;
+    // a request was sent and its answer is not complete yet
+    bool busy;
+    uint64_t due;
+    std::string head;
+    bool head_done;
+    int status;
+    // body bytes still expected, -1 for a chunked body
+    long long remaining;
+    // last bytes of a chunked body, it ends with the last chunk
+    std::string tail;
+
+    Held() :
+        fd(-1), connected(false), proven(false), busy(false), due(0), head_done(false), status(0), remaining(0) {}
+};
+
+/**
+ * What one --connections step measured
+ */
+struct Step {
+    int connections;
+    int open_failed;
+    double open_s;
+    int dropped;
+    Sample sample;
+    long rss_idle_kb;
+    long rss_peak_kb;
+
+    Step() : connections(0), open_failed(0), open_s(0), dropped(0), rss_idle_kb(-1), rss_peak_kb(-1) {}
+};
+
+/**
+ * Resident memory of the proxy, sampled by its own thread while a run goes on
+ */
+struct RssSampler {
+    pthread_t thread;
+    std::atomic<long> start_kb;
+    std::atomic<long> peak_kb;
+    std::atomic<long> last_kb;
+    std::atomic<bool> stop;
+
+    RssSampler() : start_kb(-1), peak_kb(-1), last_kb(-1), stop(false) {}
+};
+
+static LoadConfig config;
+static RssSampler rss;
+static Endpoint proxy_endpoint;
+static uint64_t run_id;
+static std::atomic<uint64_t> miss_sequence(0);
+static std::string post_body;
+static uint64_t start_us;
+static uint64_t end_us;
+
+/* send request on a new proxy connection and read the answer until the proxy
+ * closes, returns the answer bytes or -1 on failure. status is the answer's
+ * status code. Blocking, for setting up and reading results only */
+static long exchange(const std::string & address, const std::string & request, int & status,
+                     std::string * body = NULL) {
+    int fd = connectTo(address, IO_TIMEOUT);
+    if (fd == -1) {
+        return -1;
+    }
+    long total = -1;
+    std::string resp;
+    if (sendAll(fd, request.data(), request.size())) {
+        char buffer[READ_SIZE];
+        total = 0;
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            if (resp.size() < 16 || body != NULL) {
+                resp.append(buffer, body != NULL ? n : std::min((size_t)n, (size_t)16));
+            }
+            total += n;
+        }
+        if (n == -1) {
+            total = -1;
+        }
+        status = resp.size() >= 12 ? atoi(resp.c_str() + 9) : 0;
+    }
+    close(fd);
+    if (body != NULL) {
+        size_t start = resp.find("\r\n\r\n");
+        *body = start == std::string::npos ? "" : resp.substr(start + 4);
+    }
+    return total;
+}
+
+static std::string getRequest(const std::string & path) {
+    return "GET http://" + config.origin + path + " HTTP/1.1\r\nHost: " + config.origin +
+           "\r\nConnection: close\r\n\r\n";
+}
+
+static std::string requestFor(Kind kind, uint64_t random) {
+    int hot = (int)(random % config.hot_objects);
+    switch (kind) {
+        case HIT:
+        case CONNECT:
+            return getRequest("/hit/" + std::to_string(hot));
+        case MISS:
+            return getRequest("/miss/" + std::to_string(run_id) + "-" + std::to_string(miss_sequence++));
+        case REVALIDATE:
+            return getRequest("/reval/" + std::to_string(hot));
+        case POST:
+            return "POST http://" + config.origin + "/post HTTP/1.1\r\nHost: " + config.origin +
+                   "\r\nConnection: close\r\nContent-Length: " + std::to_string(post_body.size()) + "\r\n\r\n" +
+                   post_body;
+        case KINDS:
+            break;
+    }
+    return "";
+}
+
+static void watch(int ep, Exchange & ex, uint32_t events, int op = EPOLL_CTL_MOD) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = &ex;
+    epoll_ctl(ep, op, ex.fd, &event);
+}
+
+/* a request of kind on a new proxy connection, watched by ep. NULL if no
+ * connection could be started */
+static Exchange * begin(Kind kind, uint64_t random, uint64_t due, int ep) {
+    int fd = connectNonBlocking(proxy_endpoint);
+    if (fd == -1) {
+        return NULL;
+    }
+    Exchange * ex = new Exchange();
+    ex->fd = fd;
+    ex->kind = kind;
+    ex->due = due;
+    if (kind == CONNECT) {
+        // the GET inside is origin-form and ends the tunnel
+        std::string path = "/hit/" + std::to_string(random % config.hot_objects);
+        ex->out = "CONNECT " + config.origin + " HTTP/1.1\r\nHost: " + config.origin + "\r\n\r\n";
+        ex->tunnel_request = "GET " + path + " HTTP/1.1\r\nHost: " + config.origin + "\r\nConnection: close\r\n\r\n";
+    } else {
+        ex->out = requestFor(kind, random);
+    }
+    watch(ep, *ex, EPOLLOUT, EPOLL_CTL_ADD);
+    return ex;
+}
+
+/* add answer bytes to the header until it is complete */
+static void takeHead(Exchange & ex, const char * data, size_t len) {
+    ex.head.append(data, std::min(len, (size_t)MAX_HEAD));
+    size_t end = ex.head.find("\r\n\r\n");
+    if (end != std::string::npos || ex.head.size() >= MAX_HEAD) {
+        ex.head_done = true;
+        ex.head.resize(std::min(end, ex.head.size()));
+        ex.status = ex.head.size() >= 12 ? atoi(ex.head.c_str() + 9) : 0;
+    }
+}
+
+/* move ex along after events on its socket, true once it ended. failed
+ * tells whether it ended without a complete answer */
+static bool advance(Exchange & ex, int ep, bool & failed) {
+    failed = true;
+    if (ex.stage == CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(ex.fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+            return true;
+        }
+        ex.stage = SENDING;
+    }
+    if (ex.stage == SENDING) {
+        while (ex.out_off < ex.out.size()) {
+            ssize_t n = send(ex.fd, ex.out.data() + ex.out_off, ex.out.size() - ex.out_off, MSG_NOSIGNAL);
+            if (n > 0) {
+                ex.out_off += n;
+            } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return false;
+            } else if (n != -1 || errno != EINTR) {
+                return true;
+            }
+        }
+        ex.stage = ex.kind == CONNECT && !ex.tunnel_open ? OPENING_TUNNEL : READING;
+        watch(ep, ex, EPOLLIN);
+    }
+
+    char buffer[READ_SIZE];
+    while (true) {
+        ssize_t n = recv(ex.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            if (ex.stage == READING && ex.first_byte == 0) {
+                ex.first_byte = nowMicros();
+            }
+            if (!ex.head_done) {
+                takeHead(ex, buffer, n);
+            }
+            ex.bytes += n;
+            if (ex.stage == OPENING_TUNNEL && ex.head_done) {
+                if (ex.status != 200) {
+                    return true;
+                }
+                // the proxy says nothing more until the GET is in the tunnel
+                ex.tunnel_open = true;
+                ex.head.clear();
+                ex.head_done = false;
+                ex.status = 0;
+                ex.bytes = 0;
+                ex.out = ex.tunnel_request;
+                ex.out_off = 0;
+                ex.stage = SENDING;
+                watch(ep, ex, EPOLLOUT);
+                return advance(ex, ep, failed);
+            }
+        } else if (n == 0) {
+            failed = ex.stage != READING || !ex.head_done;
+            return true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        } else if (errno != EINTR) {
+            return true;
+        }
+    }
+}
+
+static Kind pickKind(uint64_t random) {
+    double total = 0;
+    for (int i = 0; i < KINDS; ++i) {
+        total += config.mix[i];
+    }
+    double point = (random % 1000000) / 1000000.0 * total;
+    for (int i = 0; i < KINDS; ++i) {
+        if (point < config.mix[i]) {
+            return (Kind)i;
+        }
+        point -= config.mix[i];
+    }
+    return HIT;
+}
+
+static uint64_t nextRandom(uint64_t & state) {
+    // xorshift64*
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+static void record(Worker * worker, Kind kind, uint64_t latency, uint64_t ttfb, bool failed, uint64_t bytes) {
+    Sample & sample = worker->samples[kind];
+    sample.latencies.push_back(latency);
+    if (failed) {
+        sample.errors++;
+    } else {
+        sample.ttfbs.push_back(ttfb);
+        sample.bytes += bytes;
+    }
+}
+
+static void finish(Worker * worker, Exchange * ex, bool failed) {
+    if (!failed && ex->head_done) {
+        worker->statuses[ex->status]++;
+    }
+    failed = failed || ex->status != 200;
+    record(worker, ex->kind, nowMicros() - ex->due, failed ? 0 : ex->first_byte - ex->due, failed, ex->bytes);
+    close(ex->fd);
+    delete ex;
+}
+
+static void * work(void * arg) {
+    Worker * worker = (Worker *)arg;
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (worker->index + 1) ^ run_id;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    std::unordered_set<Exchange *> in_flight;
+    struct epoll_event events[MAX_EVENTS];
+    // requests of all threads interleave evenly over time
+    double interval = 1e6 * config.threads / config.rate;
+    double due = start_us + interval * worker->index / config.threads;
+    uint64_t last_sweep = nowMicros();
+    while (due < end_us || !in_flight.empty()) {
+        uint64_t now = nowMicros();
+        // whatever is due goes out now, answered or not
+        while (due < end_us && due <= now) {
+            uint64_t random = nextRandom(state);
+            Kind kind = pickKind(random);
+            Exchange * ex = begin(kind, random >> 20, (uint64_t)due, ep);
+            worker->max_lag = std::max(worker->max_lag, now - (uint64_t)due);
+            if (ex == NULL) {
+                record(worker, kind, 0, 0, true, 0);
+            } else {
+                in_flight.insert(ex);
+            }
+            due += interval;
+        }
+        worker->max_in_flight = std::max(worker->max_in_flight, in_flight.size());
+
+        int timeout = due < end_us ? (int)((due - now + 999) / 1000) : 100;
+        int n = epoll_wait(ep, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; ++i) {
+            Exchange * ex = (Exchange *)events[i].data.ptr;
+            bool failed;
+            if (advance(*ex, ep, failed)) {
+                in_flight.erase(ex);
+                finish(worker, ex, failed);
+            }
+        }
+
+        // the proxy gets IO_TIMEOUT seconds per exchange
+        now = nowMicros();
+        if (now - last_sweep >= 100000) {
+            last_sweep = now;
+            std::vector<Exchange *> expired;
+            for (std::unordered_set<Exchange *>::iterator it = in_flight.begin(); it != in_flight.end(); ++it) {
+                if (now - (*it)->due > (uint64_t)IO_TIMEOUT * 1000000) {
+                    expired.push_back(*it);
+                }
+            }
+            for (size_t i = 0; i < expired.size(); ++i) {
+                in_flight.erase(expired[i]);
+                finish(worker, expired[i], true);
+            }
+        }
+    }
+    close(ep);
+    return NULL;
+}
+
+/* one GET of every object that later requests expect to hit */
+static bool warm() {
+    int status = 0;
+    for (int i = 0; i < config.hot_objects; ++i) {
+        std::string index = std::to_string(i);
+        if (exchange(config.proxy, getRequest("/hit/" + index), status) < 0 || status != 200 ||
+            exchange(config.proxy, getRequest("/reval/" + index), status) < 0 || status != 200) {
+            std::cerr << "warming the cache failed at object " << i << " (status " << status << ")\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the origin's own counters, asked directly */
+static std::string originStats() {
+    int status = 0;
+    std::string body;
+    std::string request = "GET /stats HTTP/1.1\r\nHost: " + config.origin + "\r\nConnection: close\r\n\r\n";
+    if (exchange(config.origin, request, status, &body) < 0 || status != 200) {
+        return "null";
+    }
+    return body;
+}
+
+static void * sampleRss(void * arg) {
+    while (!rss.stop) {
+        long kb = residentKb(config.proxy_pid);
+        if (kb >= 0) {
+            rss.last_kb = kb;
+            rss.peak_kb = std::max(rss.peak_kb.load(), kb);
+        }
+        usleep(RSS_INTERVAL_MS * 1000);
+    }
+    return NULL;
+}
+
+/* sample the proxy's memory from now on if its pid was given */
+static bool startRss() {
+    if (config.proxy_pid <= 0) {
+        return true;
+    }
+    long kb = residentKb(config.proxy_pid);
+    if (kb < 0) {
+        std::cerr << "cannot read the memory of process " << config.proxy_pid << "\n";
+        return false;
+    }
+    rss.start_kb = rss.peak_kb = rss.last_kb = kb;
+    return pthread_create(&rss.thread, NULL, sampleRss, NULL) == 0;
+}
+
+static void stopRss() {
+    if (config.proxy_pid > 0) {
+        rss.stop = true;
+        pthread_join(rss.thread, NULL);
+    }
+}
+
+static std::string rssJson() {
+    if (config.proxy_pid <= 0) {
+        return "null";
+    }
+    std::ostringstream out;
+    out << "{\"start_kb\": " << rss.start_kb << ", \"peak_kb\": " << rss.peak_kb << ", \"end_kb\": " << rss.last_kb
+        << "}";
+    return out.str();
+}
+
+static void printRss() {
+    if (config.proxy_pid > 0) {
+        std::cerr << "proxy resident memory " << rss.start_kb / 1024.0 << " MiB at the start, peak "
+                  << rss.peak_kb / 1024.0 << " MiB, " << rss.last_kb / 1024.0 << " MiB at the end\n";
+    }
+}
+
+/* requests on the fixed schedule, results into json. false if the cache could
+ * not be warmed */
+static bool runSchedule(std::ostream & json) {
+    if (!warm()) {
+        return false;
+    }
+    std::string origin_before = originStats();
+
+    std::vector<Worker> workers(config.threads);
+    start_us = nowMicros() + 100000;
+    end_us = start_us + (uint64_t)config.duration * 1000000;
+    for (int i = 0; i < config.threads; ++i) {
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, work, &workers[i]) != 0) {
+            std::cerr << "cannot start thread " << i << "\n";
+            return false;
+        }
+    }
+    uint64_t max_lag = 0;
+    size_t max_in_flight = 0;
+    for (int i = 0; i < config.threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        max_lag = std::max(max_lag, workers[i].max_lag);
+        max_in_flight += workers[i].max_in_flight;
+    }
+    double elapsed = (nowMicros() - start_us) / 1e6;
+
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"config\": {\"proxy\": \"" << config.proxy << "\", \"origin\": \"" << config.origin
+         << "\", \"threads\": " << config.threads << ", \"rate\": " << config.rate
+         << ", \"duration\": " << config.duration << ", \"hot_objects\": " << config.hot_objects
+         << ", \"post_size\": " << config.post_size << "},\n";
+    json << "  \"elapsed_s\": " << elapsed << ",\n  \"max_send_lag_us\": " << max_lag
+         << ",\n  \"max_in_flight\": " << max_in_flight << ",\n  \"kinds\": {";
+    std::cerr << std::fixed << std::setprecision(3) << std::left;
+    std::cerr << std::setw(11) << "kind" << std::setw(9) << "count" << std::setw(8) << "errors"
+              << std::setw(10) << "req/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+              << std::setw(10) << "p999 ms" << std::setw(10) << "max ms" << std::setw(10) << "ttfb p50"
+              << "ttfb p99\n";
+    for (int k = 0; k < KINDS; ++k) {
+        Sample merged;
+        for (int i = 0; i < config.threads; ++i) {
+            const Sample & sample = workers[i].samples[k];
+            merged.latencies.insert(merged.latencies.end(), sample.latencies.begin(), sample.latencies.end());
+            merged.ttfbs.insert(merged.ttfbs.end(), sample.ttfbs.begin(), sample.ttfbs.end());
+            merged.errors += sample.errors;
+            merged.bytes += sample.bytes;
+        }
+        std::sort(merged.latencies.begin(), merged.latencies.end());
+        std::sort(merged.ttfbs.begin(), merged.ttfbs.end());
+        const std::vector<uint64_t> & l = merged.latencies;
+        const std::vector<uint64_t> & t = merged.ttfbs;
+        double throughput = l.size() / elapsed;
+        uint64_t max = l.empty() ? 0 : l.back();
+        json << (k > 0 ? "," : "") << "\n    \"" << kind_names[k] << "\": {\"count\": " << l.size()
+             << ", \"errors\": " << merged.errors << ", \"bytes\": " << merged.bytes
+             << ", \"throughput_rps\": " << throughput << ", \"p50_us\": " << percentile(l, 0.5)
+             << ", \"p99_us\": " << percentile(l, 0.99) << ", \"p999_us\": " << percentile(l, 0.999)
+             << ", \"max_us\": " << max << ", \"ttfb_p50_us\": " << percentile(t, 0.5)
+             << ", \"ttfb_p99_us\": " << percentile(t, 0.99) << "}";
+        std::cerr << std::setw(11) << kind_names[k] << std::setw(9) << l.size() << std::setw(8) << merged.errors
+                  << std::setw(10) << throughput << std::setw(10) << percentile(l, 0.5) / 1e3 << std::setw(10)
+                  << percentile(l, 0.99) / 1e3 << std::setw(10) << percentile(l, 0.999) / 1e3 << std::setw(10)
+                  << max / 1e3 << std::setw(10) << percentile(t, 0.5) / 1e3 << percentile(t, 0.99) / 1e3 << "\n";
+    }
+    json << "\n  },\n  \"proxy_rss_kb\": " << rssJson() << ",\n  \"origin_before\": " << origin_before
+         << ",\n  \"origin_after\": " << originStats() << "\n}\n";
+    std::cerr << "at most " << max_in_flight << " exchanges in flight\n";
+    if (max_lag > 10000) {
+        std::cerr << "requests went out up to " << max_lag / 1e3 << " ms late, raise --threads for this rate\n";
+    }
+    printRss();
+    return true;
+}
+
+/* one GET of an object never asked before, read as it streams in, results
+ * into json. false if it did not arrive whole */
+static bool runObject(std::ostream & json) {
+    std::string path = "/hit/object-" + std::to_string(run_id);
+    std::string origin_before = originStats();
+    std::string request = getRequest(path);
+    uint64_t sent = nowMicros();
+    int fd = connectTo(config.proxy, IO_TIMEOUT);
+    if (fd == -1 || !sendAll(fd, request.data(), request.size())) {
+        std::cerr << "cannot send the request to " << config.proxy << "\n";
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    std::string head;
+    size_t head_len = 0;
+    uint64_t first_byte = 0;
+    uint64_t total = 0;
+    char buffer[READ_SIZE];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (first_byte == 0) {
+            first_byte = nowMicros();
+        }
+        if (head_len == 0) {
+            head.append(buffer, n);
+            size_t end = head.find("\r\n\r\n");
+            head_len = end == std::string::npos ? 0 : end + 4;
+        }
+        total += n;
+    }
+    uint64_t done = nowMicros();
+    close(fd);
+
+    int status = head.size() >= 12 ? atoi(head.c_str() + 9) : 0;
+    uint64_t body = total - std::min((uint64_t)head_len, total);
+    std::string length = fieldValue(head.substr(0, head_len), "Content-Length");
+    // chunked bodies are counted with their framing
+    bool whole = n == 0 && head_len > 0 && status == 200 &&
+                 (length.empty() || strtoull(length.c_str(), NULL, 10) == body);
+    double seconds = (done - sent) / 1e6;
+
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"config\": {\"proxy\": \"" << config.proxy << "\", \"origin\": \"" << config.origin
+         << "\", \"object\": \"" << path << "\"},\n";
+    json << "  \"object\": {\"status\": " << status << ", \"complete\": " << (whole ? "true" : "false")
+         << ", \"body_bytes\": " << body << ", \"ttfb_us\": " << (first_byte == 0 ? 0 : first_byte - sent)
+         << ", \"total_us\": " << done - sent << ", \"mb_per_s\": " << body / 1e6 / seconds << "},\n";
+    json << "  \"proxy_rss_kb\": " << rssJson() << ",\n  \"origin_before\": " << origin_before
+         << ",\n  \"origin_after\": " << originStats() << "\n}\n";
+    std::cerr << std::fixed << std::setprecision(3) << path << ": status " << status << ", " << body / 1048576.0
+              << " MiB" << (whole ? "" : " (incomplete)") << ", first byte after "
+              << (first_byte == 0 ? 0 : first_byte - sent) / 1e3 << " ms, all after " << seconds << " s, "
+              << body / 1e6 / seconds << " MB/s\n";
+    printRss();
+    return whole;
+}
+
+static std::string keepAliveRequest(uint64_t random) {
+    return "GET http://" + config.origin + "/hit/" + std::to_string(random % config.hot_objects) +
+           " HTTP/1.1\r\nHost: " + config.origin + "\r\n\r\n";
+}
+
+/* send a hit on the idle connection h, false if it could not go out whole */
+static bool sendOn(Held & h, uint64_t due, uint64_t random) {
+    std::string request = keepAliveRequest(random);
+    h.busy = true;
+    h.due = due;
+    h.head.clear();
+    h.head_done = false;
+    h.status = 0;
+    h.tail.clear();
+    // a short request fits any socket buffer at once
+    return send(h.fd, request.data(), request.size(), MSG_NOSIGNAL) == (ssize_t)request.size();
+}
+
+/* account body bytes of the answer h reads, true once it is complete */
+static bool takeBody(Held & h, const char * data, size_t len) {
+    if (h.remaining >= 0) {
+        h.remaining -= std::min((long long)len, h.remaining);
+        return h.remaining == 0;
+    }
+    // pattern bodies hold no line breaks, only the last chunk ends like this
+    h.tail.append(data, len);
+    h.tail.erase(0, h.tail.size() > 7 ? h.tail.size() - 7 : 0);
+    return h.tail == "0\r\n\r\n" || (h.tail.size() == 7 && h.tail.compare(2, 5, "0\r\n\r\n") == 0);
+}
+
+/* read what arrived on h: -1 if the proxy closed it or sent what does not
+ * belong to any request, 1 once the answer is complete, 0 if it is not yet */
+static int readHeld(Held & h) {
+    char buffer[READ_SIZE];
+    while (true) {
+        ssize_t n = recv(h.fd, buffer, sizeof(buffer), 0);
+        if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return -1;
+        }
+        if (n == -1) {
+            return errno == EINTR ? readHeld(h) : 0;
+        }
+        if (!h.busy) {
+            return -1;
+        }
+        if (h.head_done) {
+            if (takeBody(h, buffer, n)) {
+                h.busy = false;
+                return 1;
+            }
+            continue;
+        }
+        h.head.append(buffer, n);
+        size_t end = h.head.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (h.head.size() > MAX_HEAD) {
+                return -1;
+            }
+            continue;
+        }
+        std::string body = h.head.substr(end + 4);
+        h.head.resize(end + 2);
+        h.head_done = true;
+        h.status = h.head.size() >= 12 ? atoi(h.head.c_str() + 9) : 0;
+        std::string length = fieldValue(h.head, "Content-Length");
+        if (h.status == 304 || h.status == 204) {
+            h.remaining = 0;
+        } else if (!length.empty()) {
+            h.remaining = strtoll(length.c_str(), NULL, 10);
+        } else if (strcasecmp(fieldValue(h.head, "Transfer-Encoding").c_str(), "chunked") == 0) {
+            h.remaining = -1;
+        } else {
+            // delimited by the close, no use on a kept connection
+            return -1;
+        }
+        if (h.remaining == 0 || takeBody(h, body.data(), body.size())) {
+            h.busy = false;
+            return 1;
+        }
+    }
+}
+
+/**
+ * The connections of a --connections run, watched by one epoll instance
+ */
+class HeldSet {
+    int ep;
+    std::vector<Held *> held;
+    // next connection the schedule tries
+    size_t next;
+    uint64_t state;
+
+    /* h is gone, its answer (if one was awaited) failed */
+    void drop(Held & h, Step & step) {
+        if (h.busy) {
+            step.sample.latencies.push_back(nowMicros() - h.due);
+            step.sample.errors++;
+        }
+        close(h.fd);
+        h.fd = -1;
+        h.busy = false;
+    }
+
+    /* one round of events, at most timeout_ms long. Connections finishing
+     * their first answer count in opening instead of in step */
+    void poll(int timeout_ms, Step & step, int & opening) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(ep, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < n; ++i) {
+            Held & h = *(Held *)events[i].data.ptr;
+            if (h.fd == -1) {
+                continue;
+            }
+            if (!h.connected) {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                if (!(events[i].events & EPOLLOUT)) {
+                    continue;
+                }
+                h.connected = getsockopt(h.fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+                if (!h.connected || !sendOn(h, nowMicros(), nextRandom(state))) {
+                    close(h.fd);
+                    h.fd = -1;
+                    step.open_failed++;
+                    opening--;
+                }
+                continue;
+            }
+            int result = readHeld(h);
+            if (!h.proven && result != 0) {
+                // the first answer is not measured
+                opening--;
+                h.proven = result == 1 && h.status == 200;
+                if (!h.proven) {
+                    close(h.fd);
+                    h.fd = -1;
+                    step.open_failed++;
+                }
+            } else if (result == 1) {
+                step.sample.latencies.push_back(nowMicros() - h.due);
+                if (h.status != 200) {
+                    step.sample.errors++;
+                }
+            } else if (result == -1) {
+                step.dropped++;
+                drop(h, step);
+            }
+        }
+    }
+
+public:
+    HeldSet() : ep(epoll_create1(EPOLL_CLOEXEC)), next(0), state(0x9e3779b97f4a7c15ULL ^ run_id) {}
+
+    ~HeldSet() {
+        for (size_t i = 0; i < held.size(); ++i) {
+            if (held[i]->fd != -1) {
+                close(held[i]->fd);
+            }
+            delete held[i];
+        }
+        close(ep);
+    }
+
+    int open() const {
+        int count = 0;
+        for (size_t i = 0; i < held.size(); ++i) {
+            count += held[i]->fd != -1;
+        }
+        return count;
+    }
+
+    /* open connections until target are held, each proven by one answer */
+    void grow(int target, Step & step) {
+        uint64_t start = nowMicros();
+        int missing = target - open();
+        int opening = 0;
+        int started = 0;
+        while ((started < missing || opening > 0) && nowMicros() - start < (uint64_t)IO_TIMEOUT * 1000000) {
+            while (started < missing && opening < OPEN_BATCH) {
+                started++;
+                Held * h = new Held();
+                h->fd = connectNonBlocking(proxy_endpoint);
+                if (h->fd == -1) {
+                    delete h;
+                    step.open_failed++;
+                    continue;
+                }
+                struct epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = h;
+                epoll_ctl(ep, EPOLL_CTL_ADD, h->fd, &event);
+                held.push_back(h);
+                opening++;
+            }
+            poll(100, step, opening);
+        }
+        for (size_t i = 0; i < held.size(); ++i) {
+            if (held[i]->fd != -1 && !held[i]->proven) {
+                close(held[i]->fd);
+                held[i]->fd = -1;
+                step.open_failed++;
+            }
+        }
+        step.open_s = (nowMicros() - start) / 1e6;
+    }
+
+    /* keep watching the idle connections for ms, the proxy may close some */
+    void idle(int ms, Step & step) {
+        int opening = 0;
+        uint64_t end = nowMicros() + (uint64_t)ms * 1000;
+        for (uint64_t now = nowMicros(); now < end; now = nowMicros()) {
+            poll((int)((end - now + 999) / 1000), step, opening);
+        }
+    }
+
+    /* --rate hits for --duration seconds over the idle connections, then
+     * wait for the answers still due */
+    void measure(Step & step) {
+        int opening = 0;
+        double interval = 1e6 / config.rate;
+        double due = nowMicros();
+        uint64_t end = (uint64_t)due + (uint64_t)config.duration * 1000000;
+        while (due < end) {
+            uint64_t now = nowMicros();
+            for (; due < end && due <= now; due += interval) {
+                Held * h = NULL;
+                for (size_t tried = 0; tried < held.size() && h == NULL; ++tried) {
+                    Held * candidate = held[next++ % held.size()];
+                    h = candidate->fd != -1 && !candidate->busy ? candidate : NULL;
+                }
+                if (h == NULL) {
+                    // every connection is busy or gone
+                    step.sample.errors++;
+                } else if (!sendOn(*h, (uint64_t)due, nextRandom(state))) {
+                    step.dropped++;
+                    drop(*h, step);
+                }
+            }
+            poll(due < end ? (int)((due - now + 999) / 1000) : 0, step, opening);
+        }
+        uint64_t deadline = nowMicros() + (uint64_t)IO_TIMEOUT * 1000000;
+        while (busy() > 0 && nowMicros() < deadline) {
+            poll(100, step, opening);
+        }
+        for (size_t i = 0; i < held.size(); ++i) {
+            if (held[i]->busy) {
+                drop(*held[i], step);
+            }
+        }
+    }
+
+    int busy() const {
+        int count = 0;
+        for (size_t i = 0; i < held.size(); ++i) {
+            count += held[i]->fd != -1 && held[i]->busy;
+        }
+        return count;
+    }
+};
+
+/* ever more idle keep-alive connections, hits sent over them at each step,
+ * results into json. false if the cache could not be warmed or a step ended
+ * with fewer connections than it asked for */
+static bool runConnections(std::ostream & json) {
+    if (!warm()) {
+        return false;
+    }
+    // the warmed cache is in here already, the held connections are not
+    long base_kb = config.proxy_pid > 0 ? residentKb(config.proxy_pid) : -1;
+    HeldSet set;
+    std::vector<Step> steps;
+    bool complete = true;
+    for (size_t i = 0; i < config.connections.size(); ++i) {
+        Step step;
+        set.grow(config.connections[i], step);
+        set.idle(SETTLE_MS, step);
+        step.connections = set.open();
+        step.rss_idle_kb = config.proxy_pid > 0 ? residentKb(config.proxy_pid) : -1;
+        rss.peak_kb = step.rss_idle_kb;
+        set.measure(step);
+        step.rss_peak_kb = config.proxy_pid > 0 ? rss.peak_kb.load() : -1;
+        std::sort(step.sample.latencies.begin(), step.sample.latencies.end());
+        complete = complete && step.connections == config.connections[i];
+        steps.push_back(step);
+    }
+
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"config\": {\"proxy\": \"" << config.proxy << "\", \"origin\": \"" << config.origin
+         << "\", \"rate\": " << config.rate << ", \"duration\": " << config.duration
+         << ", \"hot_objects\": " << config.hot_objects << "},\n  \"rss_base_kb\": " << base_kb
+         << ",\n  \"steps\": [";
+    std::cerr << std::fixed << std::setprecision(3) << std::left;
+    std::cerr << std::setw(9) << "conns" << std::setw(9) << "open s" << std::setw(8) << "failed" << std::setw(9)
+              << "dropped" << std::setw(9) << "count" << std::setw(8) << "errors" << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "p999 ms" << std::setw(10) << "idle MiB"
+              << std::setw(10) << "peak MiB" << "KiB/conn\n";
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const Step & step = steps[i];
+        const std::vector<uint64_t> & l = step.sample.latencies;
+        // what each held connection costs the proxy beyond its resting size
+        double per_connection = step.connections > 0 && step.rss_idle_kb >= 0
+                                    ? (double)(step.rss_idle_kb - base_kb) / step.connections
+                                    : 0;
+        json << (i > 0 ? "," : "") << "\n    {\"connections\": " << step.connections
+             << ", \"open_failed\": " << step.open_failed << ", \"open_s\": " << step.open_s
+             << ", \"dropped\": " << step.dropped << ", \"count\": " << l.size()
+             << ", \"errors\": " << step.sample.errors << ", \"p50_us\": " << percentile(l, 0.5)
+             << ", \"p99_us\": " << percentile(l, 0.99) << ", \"p999_us\": " << percentile(l, 0.999)
+             << ", \"max_us\": " << (l.empty() ? 0 : l.back()) << ", \"rss_idle_kb\": " << step.rss_idle_kb
+             << ", \"rss_peak_kb\": " << step.rss_peak_kb << ", \"rss_per_connection_kb\": " << per_connection
+             << "}";
+        std::cerr << std::setw(9) << step.connections << std::setw(9) << step.open_s << std::setw(8)
+                  << step.open_failed << std::setw(9) << step.dropped << std::setw(9) << l.size() << std::setw(8)
+                  << step.sample.errors << std::setw(10) << percentile(l, 0.5) / 1e3 << std::setw(10)
+                  << percentile(l, 0.99) / 1e3 << std::setw(10) << percentile(l, 0.999) / 1e3 << std::setw(10)
+                  << step.rss_idle_kb / 1024.0 << std::setw(10) << step.rss_peak_kb / 1024.0 << per_connection
+                  << "\n";
+    }
+    json << "\n  ],\n  \"proxy_rss_kb\": " << rssJson() << "\n}\n";
+    if (!complete) {
+        std::cerr << "some steps hold fewer connections than asked for\n";
+    }
+    return complete;
+}
+
+/* value of a counter in the origin's /stats json, -1 if it is missing */
+static long counter(const std::string & stats, const std::string & name) {
+    size_t pos = stats.find("\"" + name + "\":");
+    return pos == std::string::npos ? -1 : atol(stats.c_str() + pos + name.size() + 3);
+}
+
+/* --burst requests for one object never asked before, sent at once on
+ * connections opened beforehand, results into json. false unless every one
+ * was answered and the origin was asked for the object exactly once, or
+ * with --stall unless every one was answered 504 */
+static bool runBurst(std::ostream & json) {
+    std::string path = (config.stall ? "/stall/" : "/burst/") + std::to_string(run_id);
+    std::string origin_before = originStats();
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Exchange *> exchanges;
+    for (int i = 0; i < config.burst; ++i) {
+        Exchange * ex = new Exchange();
+        ex->fd = connectNonBlocking(proxy_endpoint);
+        ex->out = getRequest(path);
+        exchanges.push_back(ex);
+        if (ex->fd != -1) {
+            watch(ep, *ex, EPOLLOUT, EPOLL_CTL_ADD);
+        }
+    }
+
+    // every connection is made before the first request goes out
+    Worker worker;
+    std::unordered_set<Exchange *> pending;
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+        if (exchanges[i]->fd != -1) {
+            pending.insert(exchanges[i]);
+        }
+    }
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t deadline = nowMicros() + (uint64_t)IO_TIMEOUT * 1000000;
+    while (!pending.empty() && nowMicros() < deadline) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; ++i) {
+            Exchange * ex = (Exchange *)events[i].data.ptr;
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (pending.erase(ex) > 0 &&
+                (getsockopt(ex->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0)) {
+                close(ex->fd);
+                ex->fd = -1;
+            }
+        }
+    }
+    int connect_failed = 0;
+    std::unordered_set<Exchange *> in_flight;
+    uint64_t sent = nowMicros();
+    for (size_t i = 0; i < exchanges.size(); ++i) {
+        Exchange * ex = exchanges[i];
+        if (ex->fd == -1 || pending.count(ex) > 0) {
+            connect_failed++;
+            record(&worker, HIT, 0, 0, true, 0);
+            if (ex->fd != -1) {
+                close(ex->fd);
+            }
+            delete ex;
+            continue;
+        }
+        bool failed;
+        ex->due = sent;
+        ex->stage = SENDING;
+        if (advance(*ex, ep, failed)) {
+            finish(&worker, ex, failed);
+        } else {
+            in_flight.insert(ex);
+        }
+    }
+    while (!in_flight.empty() && nowMicros() - sent < (uint64_t)IO_TIMEOUT * 1000000) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; ++i) {
+            Exchange * ex = (Exchange *)events[i].data.ptr;
+            bool failed;
+            if (advance(*ex, ep, failed)) {
+                in_flight.erase(ex);
+                finish(&worker, ex, failed);
+            }
+        }
+    }
+    for (std::unordered_set<Exchange *>::iterator it = in_flight.begin(); it != in_flight.end(); ++it) {
+        finish(&worker, *it, true);
+    }
+    close(ep);
+
+    std::string origin_after = originStats();
+    const char * counted = config.stall ? "stall" : "burst";
+    long fetches = counter(origin_after, counted) - counter(origin_before, counted);
+    uint64_t timeouts = worker.statuses[504];
+    Sample & sample = worker.samples[HIT];
+    std::sort(sample.latencies.begin(), sample.latencies.end());
+    const std::vector<uint64_t> & l = sample.latencies;
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"config\": {\"proxy\": \"" << config.proxy << "\", \"origin\": \"" << config.origin
+         << "\", \"burst\": " << config.burst << ", \"object\": \"" << path << "\"},\n";
+    json << "  \"burst\": {\"requests\": " << l.size() << ", \"connect_failed\": " << connect_failed
+         << ", \"errors\": " << sample.errors << ", \"p50_us\": " << percentile(l, 0.5)
+         << ", \"p99_us\": " << percentile(l, 0.99) << ", \"max_us\": " << (l.empty() ? 0 : l.back())
+         << ", \"answered_504\": " << timeouts << ", \"origin_fetches\": " << fetches << "},\n";
+    json << "  \"proxy_rss_kb\": " << rssJson() << ",\n  \"origin_before\": " << origin_before
+         << ",\n  \"origin_after\": " << origin_after << "\n}\n";
+    std::cerr << std::fixed << std::setprecision(3) << config.burst << " requests for " << path << " at once: "
+              << sample.errors << " errors (" << connect_failed << " not connected), p50 "
+              << percentile(l, 0.5) / 1e3 << " ms, p99 " << percentile(l, 0.99) / 1e3 << " ms, max "
+              << (l.empty() ? 0 : l.back()) / 1e3 << " ms; " << fetches << " of them reached the origin\n";
+    printRss();
+    if (config.stall) {
+        // every client is let go, however many fetches that took
+        if (timeouts != (uint64_t)config.burst) {
+            std::cerr << "expected all " << config.burst << " requests answered 504, " << timeouts << " were\n";
+        }
+        return timeouts == (uint64_t)config.burst;
+    }
+    if (fetches != 1) {
+        std::cerr << "expected exactly one request for " << path << " to reach the origin\n";
+    }
+    return sample.errors == 0 && fetches == 1;
+}
+
+static void usage(const char * prog) {
+    std::cerr << "usage: " << prog << " [options]\n"
+              << "  -x, --proxy HOST:PORT    proxy under test (default 127.0.0.1:12345)\n"
+              << "  -o, --origin HOST:PORT   origin_stub as the proxy reaches it\n"
+              << "                           (default 127.0.0.1:8081)\n"
+              << "  -t, --threads N          sending threads, each one epoll loop (default 4)\n"
+              << "  -r, --rate R             requests per second over all threads\n"
+              << "                           (default 500)\n"
+              << "  -d, --duration S         seconds measured (default 10)\n"
+              << "  -m, --mix KIND:W[,...]   weights of hit, miss, revalidate, post and\n"
+              << "                           connect (default hit:70,miss:10,revalidate:10,\n"
+              << "                           post:5,connect:5)\n"
+              << "  -k, --hot-objects N      objects hit and revalidated (default 100)\n"
+              << "  -b, --post-size BYTES    POST body size (default 1K)\n"
+              << "  -O, --object             fetch one object never asked before instead of\n"
+              << "                           the schedule, to time a large body\n"
+              << "  -n, --connections N[,...]\n"
+              << "                           hold that many idle keep-alive connections in\n"
+              << "                           turn, measuring --rate hits over them for\n"
+              << "                           --duration at each step, instead of the schedule\n"
+              << "  -B, --burst N            send N requests for one object never asked before\n"
+              << "                           at once instead of the schedule, and check that\n"
+              << "                           the origin was asked for it once\n"
+              << "  -s, --stall              with --burst, ask for an object the origin never\n"
+              << "                           answers and check that all are answered 504\n"
+              << "  -P, --proxy-pid PID      sample the proxy's resident memory\n"
+              << "  -j, --json PATH          write the results there (default stdout)\n"
+              << "  -h, --help               show this help\n";
+}
+
+static void parseArgs(int argc, char ** argv) {
+    static const struct option long_options[] = {
+        {"proxy", required_argument, NULL, 'x'},
+        {"origin", required_argument, NULL, 'o'},
+        {"threads", required_argument, NULL, 't'},
+        {"rate", required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"mix", required_argument, NULL, 'm'},
+        {"hot-objects", required_argument, NULL, 'k'},
+        {"post-size", required_argument, NULL, 'b'},
+        {"object", no_argument, NULL, 'O'},
+        {"connections", required_argument, NULL, 'n'},
+        {"burst", required_argument, NULL, 'B'},
+        {"stall", no_argument, NULL, 's'},
+        {"proxy-pid", required_argument, NULL, 'P'},
+        {"json", required_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "x:o:t:r:d:m:k:b:On:B:sP:j:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'x':
+                config.proxy = optarg;
+                break;
+            case 'o':
+                config.origin = optarg;
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 'd':
+                config.duration = atoi(optarg);
+                break;
+            case 'm': {
+                std::fill(config.mix, config.mix + KINDS, 0.0);
+                std::vector<std::pair<std::string, double> > mix = weightedList(optarg, ',');
+                for (size_t i = 0; i < mix.size(); ++i) {
+                    const char * const * name = std::find(kind_names, kind_names + KINDS, mix[i].first);
+                    if (name == kind_names + KINDS) {
+                        throw std::invalid_argument("unknown request kind \"" + mix[i].first + "\"");
+                    }
+                    config.mix[name - kind_names] = mix[i].second;
+                }
+                break;
+            }
+            case 'k':
+                config.hot_objects = atoi(optarg);
+                break;
+            case 'b':
+                config.post_size = parseSize(optarg);
+                break;
+            case 'O':
+                config.object = true;
+                break;
+            case 'n': {
+                std::istringstream steps(optarg);
+                std::string step;
+                while (std::getline(steps, step, ',')) {
+                    config.connections.push_back(atoi(step.c_str()));
+                    if (config.connections.back() <= 0) {
+                        throw std::invalid_argument("invalid connection count \"" + step + "\"");
+                    }
+                }
+                std::sort(config.connections.begin(), config.connections.end());
+                break;
+            }
+            case 'B':
+                config.burst = atoi(optarg);
+                break;
+            case 's':
+                config.stall = true;
+                break;
+            case 'P':
+                config.proxy_pid = atoi(optarg);
+                break;
+            case 'j':
+                config.json_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (config.threads <= 0 || config.rate <= 0 || config.duration <= 0 || config.hot_objects <= 0) {
+        throw std::invalid_argument("threads, rate, duration and hot objects must be positive");
+    }
+}
+
+int main(int argc, char ** argv) {
+    try {
+        parseArgs(argc, argv);
+    } catch (const std::exception & e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        proxy_endpoint = resolve(config.proxy);
+    } catch (const std::exception & e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    // every exchange in flight holds a socket
+    long files = raiseFileLimit();
+    if (!config.connections.empty() && files < config.connections.back() + 64) {
+        std::cerr << argv[0] << ": " << config.connections.back() << " connections need a higher open file limit than "
+                  << files << "\n";
+        return EXIT_FAILURE;
+    }
+    run_id = (uint64_t)time(NULL);
+    post_body.assign(config.post_size, 'p');
+    if (!startRss()) {
+        return EXIT_FAILURE;
+    }
+    std::ostringstream json;
+    bool ok;
+    if (config.object) {
+        ok = runObject(json);
+    } else if (!config.connections.empty()) {
+        ok = runConnections(json);
+    } else if (config.burst > 0) {
+        ok = runBurst(json);
+    } else {
+        ok = runSchedule(json);
+    }
+    stopRss();
+    if (json.str().empty()) {
+        return EXIT_FAILURE;
+    }
+
+    if (config.json_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(config.json_path.c_str());
+        out << json.str();
+        if (!out) {
+            std::cerr << argv[0] << ": cannot write " << config.json_path << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,569 @@
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.hpp"
+#include "Cache.hpp"
+#include "HttpParser.hpp"
+#include "Logger.hpp"
+#include "RegexParser.hpp"
+
+/**
+ * Microbenchmarks of the parsing and cache hot paths, run over the header
+ * corpus in tests/headers: HttpParser::findEmptyLine, parseHeader next to the
+ * regex parser it replaced (RegexParser), parseRespHeader, the freshness
+ * deadlines a put computes (Cache::freshnessOf) and the check a hit makes
+ * (Freshness::isFresh), and Cache get/put from 1 to 64 threads, one put in
+ * --put-every operations. Every benchmark is timed --repeat times for at least
+ * --min-time milliseconds each and reported by its median in ns per
+ * operation, as a table and as json. Given the json of an earlier run with
+ * --compare, the change of every benchmark is printed next to it, so an
+ * optimization comes with its before and after numbers.
+ */
+
+// keys in the cache before get/put is timed
+#define CACHE_KEYS 16384
+// one put in this many cache operations by default, the rest are gets
+#define DEFAULT_PUT_EVERY 20
+// objects every client stores in the sharing check
+#define SHARED_KEYS_PER_CLIENT 256
+// cache operations of one round, shared out over the threads
+#define CACHE_OPS_PER_ROUND 400000
+
+struct BenchConfig {
+    std::string corpus;
+    int repeat;
+    int min_time_ms;
+    std::string filter;
+    int max_threads;
+    // one cache operation in put_every is a put
+    int put_every;
+    std::string json_path;
+    std::string compare_path;
+
+    BenchConfig() :
+        corpus("../../tests/headers"), repeat(5), min_time_ms(200), max_threads(64), put_every(DEFAULT_PUT_EVERY) {}
+};
+
+struct Result {
+    std::string name;
+    // per operation, median of the rounds
+    double ns_per_op;
+    double ops_per_s;
+    // gets among the operations, cache benchmarks only
+    double lookups_per_s;
+    // gets answered by the entry another client stored, -1 when not checked
+    double hit_ratio;
+};
+
+static BenchConfig config;
+static std::vector<std::vector<char> > requests;
+static std::vector<std::vector<char> > responses;
+// keeps results alive so the compiler cannot drop the work
+static volatile uint64_t sink;
+
+/* header blocks of path, separated by lines holding only %%, with CRLF line
+ * ends and the terminating empty line */
+static std::vector<std::vector<char> > loadCorpus(const std::string & path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        throw std::runtime_error("cannot read corpus " + path);
+    }
+    std::vector<std::vector<char> > blocks;
+    std::string block;
+    std::string line;
+    bool more = true;
+    while (more) {
+        more = (bool)std::getline(in, line);
+        if (more && line != "%%") {
+            if (!line.empty()) {
+                block += line + "\r\n";
+            }
+            continue;
+        }
+        if (!block.empty()) {
+            block += "\r\n";
+            blocks.push_back(std::vector<char>(block.begin(), block.end()));
+            block.clear();
+        }
+    }
+    if (blocks.empty()) {
+        throw std::runtime_error("empty corpus " + path);
+    }
+    return blocks;
+}
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* run op over batches until min_time passed, repeat times, and keep the
+ * median. op returns the number of operations it did */
+template <typename Op>
+static Result measure(const std::string & name, Op op) {
+    std::vector<double> rounds;
+    for (int r = 0; r < config.repeat; ++r) {
+        uint64_t ops = 0;
+        double start = nowSeconds();
+        double elapsed = 0;
+        while (elapsed * 1000 < config.min_time_ms) {
+            ops += op();
+            elapsed = nowSeconds() - start;
+        }
+        rounds.push_back(elapsed * 1e9 / ops);
+    }
+    std::sort(rounds.begin(), rounds.end());
+    Result result;
+    result.name = name;
+    result.ns_per_op = rounds[rounds.size() / 2];
+    result.ops_per_s = 1e9 / result.ns_per_op;
+    result.lookups_per_s = 0;
+    result.hit_ratio = -1;
+    return result;
+}
+
+struct CacheRun {
+    Cache * cache;
+    const std::vector<CacheKey> * keys;
+    const std::vector<char> * resp;
+    ResponseMeta::Ptr header;
+    uint64_t seed;
+    int ops;
+    uint64_t gets;
+    uint64_t found;
+};
+
+// gets and operations of every cache round so far
+static uint64_t cache_gets;
+static uint64_t cache_ops;
+
+static void * cacheWork(void * arg) {
+    CacheRun * run = (CacheRun *)arg;
+    uint64_t state = run->seed;
+    time_t now = time(NULL);
+    for (int i = 0; i < run->ops; ++i) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        uint64_t random = state * 0x2545f4914f6cdd1dULL;
+        const CacheKey & key = (*run->keys)[random % run->keys->size()];
+        if ((random >> 32) % config.put_every == 0) {
+            run->cache->put(key, *run->resp, run->header, now, now);
+        } else {
+            run->gets++;
+            run->found += run->cache->get(key) ? 1 : 0;
+        }
+    }
+    return NULL;
+}
+
+/* CACHE_OPS_PER_ROUND gets and puts spread over threads threads, returns
+ * the number of operations */
+static uint64_t cacheRound(Cache & cache, const std::vector<CacheKey> & keys, const std::vector<char> & resp,
+                           const ResponseMeta::Ptr & header, int threads) {
+    std::vector<CacheRun> runs(threads);
+    std::vector<pthread_t> ids(threads);
+    for (int i = 0; i < threads; ++i) {
+        runs[i].cache = &cache;
+        runs[i].keys = &keys;
+        runs[i].resp = &resp;
+        runs[i].header = header;
+        runs[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        runs[i].ops = CACHE_OPS_PER_ROUND / threads;
+        runs[i].gets = 0;
+        runs[i].found = 0;
+        if (pthread_create(&ids[i], NULL, cacheWork, &runs[i]) != 0) {
+            throw std::runtime_error("cannot start cache thread");
+        }
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+        sink += runs[i].found;
+        cache_gets += runs[i].gets;
+    }
+    cache_ops += (uint64_t)threads * (CACHE_OPS_PER_ROUND / threads);
+    return (uint64_t)threads * (CACHE_OPS_PER_ROUND / threads);
+}
+
+struct SharedRun {
+    Cache * cache;
+    const std::vector<CacheKey> * keys;
+    const std::vector<char> * resp;
+    ResponseMeta::Ptr header;
+    pthread_barrier_t * stored;
+    // every client's run, this one is all[client]
+    SharedRun * all;
+    int client;
+    int clients;
+    // the entries this client stored, in key order
+    std::vector<CacheEntry::Ptr> own;
+    uint64_t gets;
+    uint64_t shared;
+};
+
+// operations and gets of the sharing check so far, and the gets that got
+//  another client's entry
+static uint64_t shared_ops;
+static uint64_t shared_gets;
+static uint64_t shared_hits;
+
+/* one client: store its own objects, wait for the others to store theirs,
+ * then look up every object of every other client */
+static void * sharedWork(void * arg) {
+    SharedRun * run = (SharedRun *)arg;
+    time_t now = time(NULL);
+    size_t first = (size_t)run->client * SHARED_KEYS_PER_CLIENT;
+    for (size_t i = 0; i < SHARED_KEYS_PER_CLIENT; ++i) {
+        run->own[i] = run->cache->put((*run->keys)[first + i], *run->resp, run->header, now, now);
+    }
+    pthread_barrier_wait(run->stored);
+    for (int c = 1; c < run->clients; ++c) {
+        const SharedRun & other = run->all[(run->client + c) % run->clients];
+        size_t other_first = (size_t)other.client * SHARED_KEYS_PER_CLIENT;
+        for (size_t i = 0; i < SHARED_KEYS_PER_CLIENT; ++i) {
+            CacheEntry::Ptr entry = run->cache->get((*run->keys)[other_first + i]);
+            run->gets++;
+            // the very entry the other client stored, not a copy of it
+            run->shared += entry && entry == other.own[i] ? 1 : 0;
+        }
+    }
+    return NULL;
+}
+
+/* clients threads sharing one cache, returns the number of puts and gets */
+static uint64_t sharedRound(Cache & cache, const std::vector<CacheKey> & keys, const std::vector<char> & resp,
+                            const ResponseMeta::Ptr & header, int clients) {
+    std::vector<SharedRun> runs(clients);
+    std::vector<pthread_t> ids(clients);
+    pthread_barrier_t stored;
+    pthread_barrier_init(&stored, NULL, clients);
+    for (int i = 0; i < clients; ++i) {
+        runs[i].cache = &cache;
+        runs[i].keys = &keys;
+        runs[i].resp = &resp;
+        runs[i].header = header;
+        runs[i].stored = &stored;
+        runs[i].all = runs.data();
+        runs[i].client = i;
+        runs[i].clients = clients;
+        runs[i].own.resize(SHARED_KEYS_PER_CLIENT);
+        runs[i].gets = 0;
+        runs[i].shared = 0;
+    }
+    for (int i = 0; i < clients; ++i) {
+        if (pthread_create(&ids[i], NULL, sharedWork, &runs[i]) != 0) {
+            throw std::runtime_error("cannot start client thread");
+        }
+    }
+    uint64_t ops = 0;
+    for (int i = 0; i < clients; ++i) {
+        pthread_join(ids[i], NULL);
+        shared_gets += runs[i].gets;
+        shared_hits += runs[i].shared;
+        ops += SHARED_KEYS_PER_CLIENT + runs[i].gets;
+    }
+    pthread_barrier_destroy(&stored);
+    shared_ops += ops;
+    return ops;
+}
+
+static bool selected(const std::string & name) {
+    return config.filter.empty() || name.find(config.filter) != std::string::npos;
+}
+
+static std::vector<Result> runAll() {
+    std::vector<Result> results;
+
+    if (selected("findEmptyLine")) {
+        results.push_back(measure("findEmptyLine", []() {
+            for (size_t i = 0; i < requests.size(); ++i) {
+                sink += HttpParser::findEmptyLine(requests[i]).second;
+            }
+            for (size_t i = 0; i < responses.size(); ++i) {
+                sink += HttpParser::findEmptyLine(responses[i]).second;
+            }
+            return (uint64_t)(requests.size() + responses.size());
+        }));
+    }
+    if (selected("parseHeader")) {
+        results.push_back(measure("parseHeader", []() {
+            for (size_t i = 0; i < requests.size(); ++i) {
+                sink += HttpParser::parseHeader(requests[i]).getPort();
+            }
+            return (uint64_t)requests.size();
+        }));
+    }
+    // the regex parser parseHeader replaced, on the same requests. Those it
+    //  throws on cost it a throw, as they did in the proxy
+    if (selected("parseHeader_regex")) {
+        results.push_back(measure("parseHeader_regex", []() {
+            for (size_t i = 0; i < requests.size(); ++i) {
+                try {
+                    sink += RegexParser::parseHeader(requests[i]).port;
+                } catch (const std::invalid_argument & e) {
+                    sink += 1;
+                }
+            }
+            return (uint64_t)requests.size();
+        }));
+    }
+    if (selected("parseRespHeader")) {
+        results.push_back(measure("parseRespHeader", []() {
+            for (size_t i = 0; i < responses.size(); ++i) {
+                sink += HttpParser::parseRespHeader(responses[i]).getStatus();
+            }
+            return (uint64_t)responses.size();
+        }));
+    }
+    if (selected("freshnessOf") || selected("isFresh")) {
+        std::vector<ResponseMeta> parsed;
+        for (size_t i = 0; i < responses.size(); ++i) {
+            parsed.push_back(HttpParser::parseRespHeader(responses[i]));
+        }
+        Cache cache;
+        time_t now = time(NULL);
+        // the deadlines a put computes once per stored response
+        if (selected("freshnessOf")) {
+            results.push_back(measure("freshnessOf", [&parsed, &cache, now]() {
+                for (size_t i = 0; i < parsed.size(); ++i) {
+                    sink += cache.freshnessOf(parsed[i], now, now).fresh_until;
+                }
+                return (uint64_t)parsed.size();
+            }));
+        }
+        // the check every hit makes, clock read included
+        if (selected("isFresh")) {
+            std::vector<Freshness> deadlines;
+            for (size_t i = 0; i < parsed.size(); ++i) {
+                deadlines.push_back(cache.freshnessOf(parsed[i], now, now));
+            }
+            results.push_back(measure("isFresh", [&deadlines]() {
+                for (size_t i = 0; i < deadlines.size(); ++i) {
+                    sink += deadlines[i].isFresh(monotonicMillis()) ? 1 : 0;
+                }
+                return (uint64_t)deadlines.size();
+            }));
+        }
+    }
+
+    // a typical small cacheable object from the corpus, with a 4K body
+    std::vector<char> resp = responses[0];
+    std::vector<char> body(4096, 'x');
+    std::string length = "Content-Length: 4096\r\n\r\n";
+    resp.resize(resp.size() - 2);
+    std::string head(resp.begin(), resp.end());
+    size_t field = head.find("Content-Length: ");
+    head.erase(field, head.find("\r\n", field) + 2 - field);
+    resp.assign(head.begin(), head.end());
+    resp.insert(resp.end(), length.begin(), length.end());
+    resp.insert(resp.end(), body.begin(), body.end());
+    ResponseMeta::Ptr header = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(resp));
+    std::vector<CacheKey> keys;
+    for (int i = 0; i < CACHE_KEYS; ++i) {
+        keys.push_back(CacheKey::of("GET http://bench.example/object/" + std::to_string(i)));
+    }
+    for (int threads = 1; threads <= config.max_threads; threads *= 2) {
+        std::string name = "cache_get_put/" + std::to_string(threads);
+        if (!selected(name)) {
+            continue;
+        }
+        Cache cache;
+        time_t now = time(NULL);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            cache.put(keys[i], resp, header, now, now);
+        }
+        cache_gets = cache_ops = 0;
+        Result result = measure(name, [&cache, &keys, &resp, &header, threads]() {
+            return cacheRound(cache, keys, resp, header, threads);
+        });
+        result.lookups_per_s = result.ops_per_s * cache_gets / cache_ops;
+        results.push_back(result);
+    }
+
+    // every client must hit the entries the others stored, all of them fit
+    //  the default budget
+    std::vector<CacheKey> shared_keys;
+    for (int i = 0; i < config.max_threads * SHARED_KEYS_PER_CLIENT; ++i) {
+        shared_keys.push_back(CacheKey::of("GET http://bench.example/shared/" + std::to_string(i)));
+    }
+    for (int clients = 2; clients <= config.max_threads; clients *= 2) {
+        std::string name = "cache_shared/" + std::to_string(clients);
+        if (!selected(name)) {
+            continue;
+        }
+        Cache cache;
+        shared_ops = shared_gets = shared_hits = 0;
+        Result result = measure(name, [&cache, &shared_keys, &resp, &header, clients]() {
+            return sharedRound(cache, shared_keys, resp, header, clients);
+        });
+        result.lookups_per_s = result.ops_per_s * shared_gets / shared_ops;
+        result.hit_ratio = (double)shared_hits / shared_gets;
+        if (shared_hits != shared_gets) {
+            throw std::runtime_error(name + ": only " + std::to_string(shared_hits) + " of " +
+                                     std::to_string(shared_gets) + " lookups hit another client's entry");
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+/* ns_per_op of every benchmark in json written by an earlier run */
+static std::map<std::string, double> loadBaseline(const std::string & path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        throw std::runtime_error("cannot read " + path);
+    }
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name_start = line.find('"');
+        size_t name_end = line.find('"', name_start + 1);
+        size_t value = line.find("\"ns_per_op\": ");
+        if (name_start != std::string::npos && name_end != std::string::npos && value != std::string::npos) {
+            baseline[line.substr(name_start + 1, name_end - name_start - 1)] = atof(line.c_str() + value + 13);
+        }
+    }
+    return baseline;
+}
+
+static void usage(const char * prog) {
+    std::cerr << "usage: " << prog << " [options]\n"
+              << "  -c, --corpus DIR         directory of requests.txt and responses.txt\n"
+              << "                           (default ../../tests/headers)\n"
+              << "  -r, --repeat N           timed rounds per benchmark, the median is kept\n"
+              << "                           (default 5)\n"
+              << "  -m, --min-time MS        shortest round (default 200)\n"
+              << "  -b, --bench NAME         only benchmarks whose name contains NAME\n"
+              << "  -t, --max-threads N      cache threads go 1, 2, 4... up to N (default 64)\n"
+              << "  -w, --put-every N        one cache operation in N is a put, the rest are\n"
+              << "                           gets (default 20, a 95/5 mix)\n"
+              << "  -j, --json PATH          write the results there (default stdout)\n"
+              << "  -C, --compare PATH       json of an earlier run to compare with\n"
+              << "  -h, --help               show this help\n";
+}
+
+int main(int argc, char ** argv) {
+    static const struct option long_options[] = {
+        {"corpus", required_argument, NULL, 'c'},
+        {"repeat", required_argument, NULL, 'r'},
+        {"min-time", required_argument, NULL, 'm'},
+        {"bench", required_argument, NULL, 'b'},
+        {"max-threads", required_argument, NULL, 't'},
+        {"put-every", required_argument, NULL, 'w'},
+        {"json", required_argument, NULL, 'j'},
+        {"compare", required_argument, NULL, 'C'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:m:b:t:w:j:C:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                config.corpus = optarg;
+                break;
+            case 'r':
+                config.repeat = std::max(1, atoi(optarg));
+                break;
+            case 'm':
+                config.min_time_ms = std::max(1, atoi(optarg));
+                break;
+            case 'b':
+                config.filter = optarg;
+                break;
+            case 't':
+                config.max_threads = std::max(1, atoi(optarg));
+                break;
+            case 'w':
+                config.put_every = std::max(1, atoi(optarg));
+                break;
+            case 'j':
+                config.json_path = optarg;
+                break;
+            case 'C':
+                config.compare_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Result> results;
+    std::map<std::string, double> baseline;
+    try {
+        set_log_level(LOG_LEVEL_ERROR);
+        requests = loadCorpus(config.corpus + "/requests.txt");
+        responses = loadCorpus(config.corpus + "/responses.txt");
+        if (!config.compare_path.empty()) {
+            baseline = loadBaseline(config.compare_path);
+        }
+        results = runAll();
+    } catch (const std::exception & e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(1);
+    json << "{\n  \"corpus\": {\"requests\": " << requests.size() << ", \"responses\": " << responses.size()
+         << "},\n  \"put_every\": " << config.put_every << ",\n  \"benchmarks\": {";
+    std::cerr << std::fixed << std::setprecision(1) << std::left;
+    std::cerr << std::setw(22) << "benchmark" << std::setw(14) << "ns/op" << std::setw(16) << "ops/s"
+              << std::setw(16) << "lookups/s"
+              << (baseline.empty() ? "\n" : "before ns/op  change\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result & r = results[i];
+        json << (i > 0 ? "," : "") << "\n    \"" << r.name << "\": {\"ns_per_op\": " << r.ns_per_op
+             << ", \"ops_per_s\": " << r.ops_per_s;
+        if (r.lookups_per_s > 0) {
+            json << ", \"lookups_per_s\": " << r.lookups_per_s;
+        }
+        if (r.hit_ratio >= 0) {
+            json << ", \"hit_ratio\": " << std::setprecision(4) << r.hit_ratio << std::setprecision(1);
+        }
+        json << "}";
+        std::cerr << std::setw(22) << r.name << std::setw(14) << r.ns_per_op << std::setw(16) << r.ops_per_s;
+        if (r.lookups_per_s > 0) {
+            std::cerr << std::setw(16) << r.lookups_per_s;
+        } else {
+            std::cerr << std::setw(16) << "";
+        }
+        std::map<std::string, double>::const_iterator before = baseline.find(r.name);
+        if (before != baseline.end() && before->second > 0) {
+            std::cerr << std::setw(13) << before->second << std::showpos
+                      << (r.ns_per_op - before->second) * 100 / before->second << "%" << std::noshowpos;
+        }
+        std::cerr << "\n";
+    }
+    json << "\n  }\n}\n";
+
+    if (config.json_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(config.json_path.c_str());
+        out << json.str();
+        if (!out) {
+            std::cerr << argv[0] << ": cannot write " << config.json_path << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
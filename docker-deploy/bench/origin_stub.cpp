@@ -0,0 +1,380 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.hpp"
+
+/**
+ * Local origin server for load tests. What it answers depends only on the
+ * request path, so the same url is always the same object:
+ *   /hit/ID     cacheable for a day, the load generator's hot set
+ *   /miss/ID    Cache-Control drawn from the --cache-control mix
+ *   /reval/ID   no-cache with an ETag, every hit is revalidated and answered
+ *               304 by If-None-Match
+ *   /burst/ID   cacheable for a day, answered --burst-delay late so that
+ *               concurrent requests for it pile up in the proxy
+ *   /stall/ID   never answered, the connection stays open until the proxy
+ *               gives up on it
+ *   /stats      json counters of what reached the origin
+ * Body sizes follow the --sizes distribution, a --chunked fraction of the
+ * objects is sent chunked. Bodies are streamed from a small repeating pattern,
+ * so objects of any size cost the stub no memory. POST bodies are read and
+ * answered not cacheable. Connections are kept alive, the proxy pools them.
+ */
+
+#define STUB_READ_SIZE 16384
+// longest request header accepted
+#define STUB_MAX_HEADER 65536
+// bytes per chunk of chunked bodies
+#define STUB_CHUNK_SIZE 8192
+// body bytes sent at once, byte i of every body is 'a' + i % 26
+#define STUB_SEND_SIZE 65536
+
+struct StubConfig {
+    int port;
+    // injected before every answer, latency_ms plus up to jitter_ms
+    int latency_ms;
+    int jitter_ms;
+    std::vector<std::pair<size_t, double> > sizes;
+    std::vector<std::pair<std::string, double> > cache_controls;
+    double chunked;
+    int burst_delay_ms;
+
+    StubConfig() : port(8081), latency_ms(0), jitter_ms(0), chunked(0.2), burst_delay_ms(200) {}
+};
+
+static StubConfig config;
+static std::string filler;
+
+// requests that reached the origin
+static std::atomic<uint64_t> hits(0);
+static std::atomic<uint64_t> misses(0);
+static std::atomic<uint64_t> revalidations(0);
+static std::atomic<uint64_t> not_modified(0);
+static std::atomic<uint64_t> posts(0);
+static std::atomic<uint64_t> bursts(0);
+static std::atomic<uint64_t> stalls(0);
+static std::atomic<uint64_t> others(0);
+static std::atomic<uint64_t> body_bytes(0);
+
+struct Request {
+    std::string method;
+    std::string path;
+    size_t content_length;
+    std::string if_none_match;
+    bool close;
+};
+
+static Request parseRequest(const std::string & head) {
+    Request req;
+    std::istringstream line(head.substr(0, head.find("\r\n")));
+    std::string version;
+    line >> req.method >> req.path >> version;
+    // absolute-form targets come from clients talking to us directly as a proxy
+    size_t scheme = req.path.find("://");
+    if (scheme != std::string::npos) {
+        size_t path = req.path.find('/', scheme + 3);
+        req.path = path == std::string::npos ? "/" : req.path.substr(path);
+    }
+    std::string length = fieldValue(head, "Content-Length");
+    req.content_length = length.empty() ? 0 : strtoul(length.c_str(), NULL, 10);
+    req.if_none_match = fieldValue(head, "If-None-Match");
+    std::string connection = fieldValue(head, "Connection");
+    req.close = strcasecmp(connection.c_str(), "close") == 0 || version == "HTTP/1.0";
+    return req;
+}
+
+template <typename T>
+static const T & pick(const std::vector<std::pair<T, double> > & mix, double point) {
+    double total = 0;
+    for (size_t i = 0; i < mix.size(); ++i) {
+        total += mix[i].second;
+    }
+    point *= total;
+    for (size_t i = 0; i + 1 < mix.size(); ++i) {
+        if (point < mix[i].second) {
+            return mix[i].first;
+        }
+        point -= mix[i].second;
+    }
+    return mix.back().first;
+}
+
+static std::string statsJson() {
+    std::ostringstream out;
+    out << "{\"hit\":" << hits << ",\"miss\":" << misses << ",\"revalidate\":" << revalidations
+        << ",\"not_modified\":" << not_modified << ",\"post\":" << posts << ",\"burst\":" << bursts
+        << ",\"stall\":" << stalls << ",\"other\":" << others << ",\"body_bytes\":" << body_bytes << "}";
+    return out.str();
+}
+
+/**
+ * An answer: head is sent as it is, followed by body_size pattern bytes
+ */
+struct Answer {
+    std::string head;
+    size_t body_size;
+    bool chunked;
+
+    Answer() : body_size(0), chunked(false) {}
+    explicit Answer(const std::string & head) : head(head), body_size(0), chunked(false) {}
+};
+
+/* the answer to req */
+static Answer answer(const Request & req) {
+    if (config.latency_ms > 0 || config.jitter_ms > 0) {
+        int jitter = config.jitter_ms > 0 ? (int)(hashPoint(req.path, 3) * config.jitter_ms) : 0;
+        usleep((config.latency_ms + jitter) * 1000);
+    }
+
+    std::ostringstream head;
+    if (req.method == "POST") {
+        posts++;
+        head << "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\nContent-Length: 2\r\n\r\nok";
+        return Answer(head.str());
+    }
+    if (req.path == "/stats") {
+        std::string body = statsJson();
+        head << "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\nContent-Type: application/json\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+        return Answer(head.str());
+    }
+
+    std::string cache_control;
+    std::string etag = "\"" + std::to_string((unsigned long long)(hashPoint(req.path, 0) * 1e12)) + "\"";
+    if (req.path.compare(0, 5, "/hit/") == 0) {
+        hits++;
+        cache_control = "max-age=86400";
+    } else if (req.path.compare(0, 7, "/reval/") == 0) {
+        revalidations++;
+        cache_control = "no-cache";
+        if (req.if_none_match == etag) {
+            not_modified++;
+            head << "HTTP/1.1 304 Not Modified\r\nCache-Control: no-cache\r\nETag: " << etag << "\r\n\r\n";
+            return Answer(head.str());
+        }
+    } else if (req.path.compare(0, 7, "/burst/") == 0) {
+        bursts++;
+        cache_control = "max-age=86400";
+        usleep(config.burst_delay_ms * 1000);
+    } else if (req.path.compare(0, 6, "/miss/") == 0) {
+        misses++;
+        cache_control = pick(config.cache_controls, hashPoint(req.path, 1));
+    } else {
+        others++;
+        return Answer("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    }
+
+    Answer resp;
+    resp.body_size = pick(config.sizes, hashPoint(req.path, 2));
+    resp.chunked = hashPoint(req.path, 4) < config.chunked;
+    body_bytes += resp.body_size;
+    head << "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nCache-Control: " << cache_control
+         << "\r\nETag: " << etag << "\r\n";
+    if (resp.chunked) {
+        head << "Transfer-Encoding: chunked\r\n\r\n";
+    } else {
+        head << "Content-Length: " << resp.body_size << "\r\n\r\n";
+    }
+    resp.head = head.str();
+    return resp;
+}
+
+/* send body bytes [offset, offset + len), false if the peer went away */
+static bool sendPattern(int fd, size_t offset, size_t len) {
+    while (len > 0) {
+        size_t part = std::min(len, (size_t)STUB_SEND_SIZE);
+        if (!sendAll(fd, filler.data() + offset % 26, part)) {
+            return false;
+        }
+        offset += part;
+        len -= part;
+    }
+    return true;
+}
+
+/* send resp, its body framed as the head announced */
+static bool sendAnswer(int fd, const Answer & resp) {
+    if (!sendAll(fd, resp.head.data(), resp.head.size())) {
+        return false;
+    }
+    if (!resp.chunked) {
+        return sendPattern(fd, 0, resp.body_size);
+    }
+    for (size_t sent = 0; sent < resp.body_size; sent += STUB_CHUNK_SIZE) {
+        size_t len = std::min((size_t)STUB_CHUNK_SIZE, resp.body_size - sent);
+        char line[32];
+        int line_len = snprintf(line, sizeof(line), "%zx\r\n", len);
+        if (!sendAll(fd, line, line_len) || !sendPattern(fd, sent, len) || !sendAll(fd, "\r\n", 2)) {
+            return false;
+        }
+    }
+    return sendAll(fd, "0\r\n\r\n", 5);
+}
+
+static void * serve(void * arg) {
+    int fd = (int)(intptr_t)arg;
+    std::string in;
+    char buffer[STUB_READ_SIZE];
+    try {
+        while (true) {
+            size_t end;
+            while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+                if (in.size() > STUB_MAX_HEADER) {
+                    throw std::runtime_error("request header too large");
+                }
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    throw std::runtime_error("closed");
+                }
+                in.append(buffer, n);
+            }
+            Request req = parseRequest(in.substr(0, end + 2));
+            in.erase(0, end + 4);
+            while (in.size() < req.content_length) {
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    throw std::runtime_error("closed");
+                }
+                in.append(buffer, n);
+            }
+            in.erase(0, req.content_length);
+            if (req.path.compare(0, 7, "/stall/") == 0) {
+                stalls++;
+                while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+                }
+                break;
+            }
+
+            if (!sendAnswer(fd, answer(req)) || req.close) {
+                break;
+            }
+        }
+    } catch (const std::exception & e) {
+        // the peer went away, nothing to report
+    }
+    close(fd);
+    return NULL;
+}
+
+static void usage(const char * prog) {
+    std::cerr << "usage: " << prog << " [options]\n"
+              << "  -p, --port PORT          port to listen on (default 8081)\n"
+              << "  -l, --latency MS[:JITTER]\n"
+              << "                           delay every answer by MS plus up to JITTER\n"
+              << "                           milliseconds (default 0)\n"
+              << "  -s, --sizes SIZE:W[,...] body size distribution, K/M/G suffixes allowed\n"
+              << "                           (default 1K:40,16K:40,256K:15,2M:5)\n"
+              << "  -c, --chunked F          fraction of objects sent chunked (default 0.2)\n"
+              << "  -C, --cache-control CC:W[;...]\n"
+              << "                           Cache-Control mix of /miss/ objects\n"
+              << "                           (default max-age=60:80;no-store:20)\n"
+              << "  -b, --burst-delay MS     extra delay of /burst/ answers (default 200)\n"
+              << "  -h, --help               show this help\n";
+}
+
+int main(int argc, char ** argv) {
+    static const struct option long_options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"latency", required_argument, NULL, 'l'},
+        {"sizes", required_argument, NULL, 's'},
+        {"chunked", required_argument, NULL, 'c'},
+        {"cache-control", required_argument, NULL, 'C'},
+        {"burst-delay", required_argument, NULL, 'b'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    std::string sizes = "1K:40,16K:40,256K:15,2M:5";
+    std::string cache_controls = "max-age=60:80;no-store:20";
+    try {
+        int opt;
+        while ((opt = getopt_long(argc, argv, "p:l:s:c:C:b:h", long_options, NULL)) != -1) {
+            switch (opt) {
+                case 'p':
+                    config.port = atoi(optarg);
+                    break;
+                case 'l':
+                    config.latency_ms = atoi(optarg);
+                    config.jitter_ms = strchr(optarg, ':') ? atoi(strchr(optarg, ':') + 1) : 0;
+                    break;
+                case 's':
+                    sizes = optarg;
+                    break;
+                case 'c':
+                    config.chunked = atof(optarg);
+                    break;
+                case 'C':
+                    cache_controls = optarg;
+                    break;
+                case 'b':
+                    config.burst_delay_ms = atoi(optarg);
+                    break;
+                case 'h':
+                    usage(argv[0]);
+                    return EXIT_SUCCESS;
+                default:
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+            }
+        }
+        std::vector<std::pair<std::string, double> > weighted = weightedList(sizes, ',');
+        for (size_t i = 0; i < weighted.size(); ++i) {
+            config.sizes.push_back(std::make_pair(parseSize(weighted[i].first), weighted[i].second));
+        }
+        config.cache_controls = weightedList(cache_controls, ';');
+    } catch (const std::exception & e) {
+        std::cerr << argv[0] << ": " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // a send of any offset starts within the first 26 bytes
+    filler.resize(STUB_SEND_SIZE + 26);
+    for (size_t i = 0; i < filler.size(); ++i) {
+        filler[i] = 'a' + i % 26;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config.port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, 4096) == -1) {
+        std::cerr << argv[0] << ": cannot listen on port " << config.port << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
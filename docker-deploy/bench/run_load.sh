@@ -0,0 +1,58 @@
+#!/bin/bash
+# Starts origin_stub and the proxy on local ports, drives them with loadgen
+# and writes the json results under results/. Knobs, as environment
+# variables: RATE, DURATION, THREADS, MIX, HOT (loadgen), STUB_ARGS
+# (origin_stub, e.g. "-l 20:10 -c 0.5"), PROXY_ARGS (proxy_daemon).
+# CONNECTIONS (e.g. 1000,2000,5000,10000) adds a run holding that many idle
+# keep-alive connections in steps, the proxy then keeps idle clients for 300s.
+# BURST (e.g. 1000) adds a run sending that many requests for one cold object
+# at once, which fails unless exactly one of them reaches the origin, and one
+# against an origin that never answers, which fails unless every request is
+# answered 504; the proxy then gives up on silent origins after 5s.
+# OBJECT_SIZE (e.g. 1G) adds a run fetching one object of that size from a
+# stub serving nothing else. The proxy's memory is sampled in every run.
+cd "$(dirname "$0")"
+STUB_PORT=${STUB_PORT:-18081}
+PROXY_PORT=${PROXY_PORT:-18345}
+mkdir -p results /var/log/erss
+# every held connection is a descriptor in both the proxy and loadgen
+ulimit -n "$(ulimit -Hn)"
+
+./origin_stub -p "$STUB_PORT" $STUB_ARGS &
+stub=$!
+../src/proxy_daemon -f -p "$PROXY_PORT" ${CONNECTIONS:+-k 300} ${BURST:+-u 5 -w 2} $PROXY_ARGS &
+proxy=$!
+trap 'kill $stub $proxy 2>/dev/null; wait $stub $proxy 2>/dev/null' EXIT
+sleep 1
+
+stamp=$(date +%Y%m%d-%H%M%S)
+out="results/load-$stamp.json"
+./loadgen -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$STUB_PORT" -r "${RATE:-500}" -d "${DURATION:-10}" \
+          -t "${THREADS:-4}" -m "${MIX:-hit:70,miss:10,revalidate:10,post:5,connect:5}" \
+          -k "${HOT:-100}" -P "$proxy" -j "$out" && echo "results in bench/$out"
+
+if [ -n "$CONNECTIONS" ]; then
+    out="results/connections-$stamp.json"
+    ./loadgen -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$STUB_PORT" -n "$CONNECTIONS" -r "${RATE:-500}" \
+              -d "${DURATION:-10}" -k "${HOT:-100}" -P "$proxy" -j "$out" && echo "results in bench/$out"
+fi
+
+if [ -n "$BURST" ]; then
+    out="results/burst-$stamp.json"
+    ./loadgen -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$STUB_PORT" -B "$BURST" -P "$proxy" -j "$out" &&
+        echo "results in bench/$out" || echo "burst check failed, see bench/$out"
+    out="results/stall-$stamp.json"
+    ./loadgen -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$STUB_PORT" -B "$BURST" -s -P "$proxy" -j "$out" &&
+        echo "results in bench/$out" || echo "stall check failed, see bench/$out"
+fi
+
+if [ -n "$OBJECT_SIZE" ]; then
+    kill $stub
+    wait $stub 2>/dev/null
+    ./origin_stub -p "$STUB_PORT" -s "$OBJECT_SIZE:1" -c 0 &
+    stub=$!
+    sleep 1
+    out="results/object-$stamp.json"
+    ./loadgen -x "127.0.0.1:$PROXY_PORT" -o "127.0.0.1:$STUB_PORT" -O -P "$proxy" -j "$out" &&
+        echo "results in bench/$out"
+fi
@@ -0,0 +1,196 @@
+#include "ByteRanges.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+// range specs looked at in one Range field, more make it malformed
+#define MAX_RANGE_SPECS 100
+
+static std::string trimmed(const std::string & text, size_t start, size_t end) {
+    size_t first = text.find_first_not_of(" \t", start);
+    if (first >= end) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t", end - 1);
+    return text.substr(first, last - first + 1);
+}
+
+// a non-empty run of at most 18 digits, so it cannot overflow
+static bool parseNumber(const std::string & text, size_t start, size_t end, uint64_t & value) {
+    if (start >= end || end - start > 18) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = start; i < end; ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+static bool byFirst(const ByteRange & a, const ByteRange & b) {
+    return a.first < b.first;
+}
+
+ByteRanges::Outcome ByteRanges::select(const RequestMeta & req, const ResponseMeta & header, uint64_t length,
+                                       std::vector<ByteRange> & ranges) {
+    // only whole 200 bodies of a known length can be cut
+    if (req.getRequestType() != GET || header.getStatus() != 200 || header.isChunked() ||
+        header.getContentLength() < 0) {
+        return WHOLE;
+    }
+    std::pair<bool, std::string> range = req.getField("Range");
+    if (!range.first) {
+        return WHOLE;
+    }
+    std::pair<bool, std::string> if_range = req.getField("If-Range");
+    if (if_range.first && !ifRangeMatches(if_range.second, header)) {
+        return WHOLE;
+    }
+    if (!parse(range.second, length, ranges)) {
+        return WHOLE;
+    }
+    return ranges.empty() ? UNSATISFIABLE : PARTIAL;
+}
+
+bool ByteRanges::parse(const std::string & value, uint64_t length, std::vector<ByteRange> & ranges) {
+    size_t equals = value.find('=');
+    std::string unit = trimmed(value, 0, std::min(equals, value.size()));
+    if (equals == std::string::npos || unit.size() != 5 || !equalsIgnoreCase(unit.data(), 5, "bytes")) {
+        return false;
+    }
+
+    size_t specs = 0;
+    size_t start = equals + 1;
+    while (start <= value.size()) {
+        size_t end = std::min(value.find(',', start), value.size());
+        std::string spec = trimmed(value, start, end);
+        start = end + 1;
+        // empty list elements are allowed and ignored
+        if (spec.empty()) {
+            continue;
+        }
+        if (++specs > MAX_RANGE_SPECS) {
+            return false;
+        }
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) {
+            return false;
+        }
+        ByteRange range;
+        uint64_t first, last;
+        if (dash == 0) {
+            // the last n bytes
+            if (!parseNumber(spec, 1, spec.size(), last)) {
+                return false;
+            }
+            if (last == 0 || length == 0) {
+                continue;
+            }
+            range.first = last >= length ? 0 : length - last;
+            range.last = length - 1;
+        } else {
+            if (!parseNumber(spec, 0, dash, first)) {
+                return false;
+            }
+            bool open = dash + 1 == spec.size();
+            if (!open && (!parseNumber(spec, dash + 1, spec.size(), last) || last < first)) {
+                return false;
+            }
+            if (first >= length) {
+                continue;
+            }
+            range.first = first;
+            range.last = open ? length - 1 : std::min(last, length - 1);
+        }
+        ranges.push_back(range);
+    }
+
+    // overlapping and adjacent ranges are sent once
+    std::sort(ranges.begin(), ranges.end(), byFirst);
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            ranges[merged].last = std::max(ranges[merged].last, ranges[i].last);
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    ranges.resize(ranges.empty() ? 0 : merged + 1);
+    return specs > 0 && ranges.size() <= MAX_BYTE_RANGES;
+}
+
+bool ByteRanges::ifRangeMatches(const std::string & value, const ResponseMeta & header) {
+    std::string validator = trimmed(value, 0, value.size());
+    if (!validator.empty() && (validator[0] == '"' || validator.compare(0, 2, "W/") == 0)) {
+        // entity tags compare strongly, weak ones never match
+        std::pair<bool, std::string> etag = header.getEtag();
+        return etag.first && validator[0] == '"' && etag.second == validator;
+    }
+    std::pair<bool, std::string> modified = header.getLastModified();
+    time_t since = convertToTime(validator);
+    return modified.first && since != -1 && convertToTime(modified.second) == since;
+}
+
+// the header of a stored response with its status line replaced
+static std::string withStatus(const std::string & head, const ResponseMeta & header, const std::string & status) {
+    const std::string & first_line = header.getFirstLine();
+    std::string version = first_line.substr(0, first_line.find(' '));
+    return version + " " + status + head.substr(std::min(head.find("\r\n"), head.size()));
+}
+
+std::string ByteRanges::partialHead(const ResponseMeta & header, const ByteRange & range, uint64_t length) {
+    std::vector<std::pair<std::string, std::string> > changes;
+    changes.push_back(std::make_pair("Content-Length", std::to_string(range.length())));
+    changes.push_back(std::make_pair("Content-Range", "bytes " + std::to_string(range.first) + "-" +
+                                                          std::to_string(range.last) + "/" + std::to_string(length)));
+    return withStatus(header.withFields(changes), header, "206 Partial Content") + "\r\n";
+}
+
+std::vector<char> ByteRanges::multipart(const ResponseMeta & header, const char * body, uint64_t length,
+                                        const std::vector<ByteRange> & ranges) {
+    static std::atomic<uint64_t> sequence(0);
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "byteranges-%08llx%016llx", (unsigned long long)(sequence++),
+             (unsigned long long)time(NULL));
+
+    std::string type = header.getValue(ResponseMeta::CONTENT_TYPE);
+    std::vector<std::string> part_heads;
+    std::string closing = std::string("\r\n--") + boundary + "--\r\n";
+    uint64_t total = closing.size();
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::string part = std::string("\r\n--") + boundary + "\r\n";
+        if (!type.empty()) {
+            part += "Content-Type: " + type + "\r\n";
+        }
+        part += "Content-Range: bytes " + std::to_string(ranges[i].first) + "-" + std::to_string(ranges[i].last) +
+                "/" + std::to_string(length) + "\r\n\r\n";
+        total += part.size() + ranges[i].length();
+        part_heads.push_back(part);
+    }
+
+    std::vector<std::pair<std::string, std::string> > changes;
+    changes.push_back(std::make_pair("Content-Length", std::to_string(total)));
+    changes.push_back(std::make_pair("Content-Type", std::string("multipart/byteranges; boundary=") + boundary));
+    changes.push_back(std::make_pair("Content-Range", ""));
+    std::string head = withStatus(header.withFields(changes), header, "206 Partial Content") + "\r\n";
+
+    std::vector<char> answer;
+    answer.reserve(head.size() + total);
+    answer.insert(answer.end(), head.begin(), head.end());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        answer.insert(answer.end(), part_heads[i].begin(), part_heads[i].end());
+        answer.insert(answer.end(), body + ranges[i].first, body + ranges[i].last + 1);
+    }
+    answer.insert(answer.end(), closing.begin(), closing.end());
+    return answer;
+}
+
+std::string ByteRanges::unsatisfiable(uint64_t length) {
+    return "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(length) +
+           "\r\nContent-Length: 0\r\n\r\n";
+}
@@ -0,0 +1,61 @@
+#ifndef __BYTE_RANGES_HPP_
+#define __BYTE_RANGES_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "RequestMeta.hpp"
+#include "ResponseMeta.hpp"
+
+// a request asking for more ranges than this (after merging overlapping
+//  ones) gets the whole representation instead
+#define MAX_BYTE_RANGES 16
+
+/**
+ * One satisfiable range of a representation, both ends included
+ */
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+
+    uint64_t length() const { return last - first + 1; }
+};
+
+/**
+ * Range requests (RFC 9110 section 14) answered from a complete stored
+ * representation: which ranges a request selects, and the header and
+ * multipart body of the 206 or 416 answer.
+ */
+class ByteRanges {
+public:
+    enum Outcome {
+        // no usable Range field, or If-Range says the representation changed
+        WHOLE,
+        PARTIAL,
+        UNSATISFIABLE
+    };
+
+    // how req is answered from the length byte body of a stored response
+    //  parsed into header. ranges are sorted and merged for PARTIAL
+    static Outcome select(const RequestMeta & req, const ResponseMeta & header, uint64_t length,
+                          std::vector<ByteRange> & ranges);
+
+    // the satisfiable ranges of a Range field value over length bytes, false
+    //  if the value is malformed or asks for too many ranges
+    static bool parse(const std::string & value, uint64_t length, std::vector<ByteRange> & ranges);
+
+    // whether an If-Range value still matches the representation with header,
+    //  by strong entity tag or exact Last-Modified date
+    static bool ifRangeMatches(const std::string & value, const ResponseMeta & header);
+
+    // header of the 206 answer carrying range of a length byte body
+    static std::string partialHead(const ResponseMeta & header, const ByteRange & range, uint64_t length);
+    // the whole 206 multipart/byteranges answer carrying ranges of body
+    static std::vector<char> multipart(const ResponseMeta & header, const char * body, uint64_t length,
+                                       const std::vector<ByteRange> & ranges);
+    // the 416 answer for a length byte body
+    static std::string unsatisfiable(uint64_t length);
+};
+
+#endif
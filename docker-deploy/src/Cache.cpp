@@ -1,50 +1,373 @@
 #include "Cache.hpp"
-#include <pthread.h>
-pthread_mutex_t cache_lock;
+#include <algorithm>
+#include <sstream>
+#include <tuple>
 
-void Cache::put(std::string key ,std::vector<char> val) {
-    pthread_mutex_lock(&cache_lock);
-    cash.insert(std::pair<std::string, std::vector<char>>(key, val));
-    pthread_mutex_unlock(&cache_lock);
+// rough per-entry bookkeeping: hash node, LRU links, expiry index node,
+//  shared_ptr control block
+#define ENTRY_OVERHEAD 208
+
+Cache::Cache(size_t budget_bytes, double max_object_ratio, DiskCache *disk, int stale_grace,
+             const std::vector<std::string> &ignored_params, Compressor *compressor) :
+    stale_grace(stale_grace), bypassed(0), disk(disk), compressor(compressor), keys(ignored_params) {
+    max_object_bytes = (size_t)(budget_bytes * max_object_ratio);
+
+    // every shard must be able to hold the largest cacheable object
+    size_t count = 1;
+    while (count < MAX_CACHE_SHARDS && budget_bytes / (count * 2) >= max_object_bytes) {
+        count <<= 1;
+    }
+    shards = new Shard[count];
+    shard_mask = count - 1;
+    shard_budget = budget_bytes / count;
+
+    // hits vastly outnumber puts, make sure a steady stream of readers cannot
+    //  starve a writer
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    for (size_t i = 0; i < count; ++i) {
+        pthread_rwlock_init(&shards[i].lock, &attr);
+    }
+    pthread_rwlockattr_destroy(&attr);
 }
 
-std::vector<char>& Cache::get(const std::string& key) {
-    pthread_mutex_lock(&cache_lock);
-    std::map<std::string, std::vector<char>>::iterator iter = cash.find(key);
-    if (iter == cash.end()) {
-        pthread_mutex_unlock(&cache_lock);
-        throw std::out_of_range("no such key stored in map");
+Cache::~Cache() {
+    for (size_t i = 0; i <= shard_mask; ++i) {
+        pthread_rwlock_destroy(&shards[i].lock);
     }
-    pthread_mutex_unlock(&cache_lock);
-    return iter->second;
+    delete[] shards;
 }
 
-void Cache::remove(const std::string& key) {
-    pthread_mutex_lock(&cache_lock);
-    cash.erase(key);
-    pthread_mutex_unlock(&cache_lock);
+Cache::Shard &Cache::shardFor(const CacheKey &key) {
+    // the tables bucket by the low half of the key, pick shards from the high
+    //  half instead
+    return shards[(key.hi >> 32) & shard_mask];
 }
 
-bool Cache::find(const std::string& key){
-    pthread_mutex_lock(&cache_lock);
-    std::map<std::string, std::vector<char>>::iterator iter = cash.find(key);
-    if (iter == cash.end()) {
-        pthread_mutex_unlock(&cache_lock);
-       return false;
+void Cache::unlink(Shard &shard, Node *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        shard.lru_head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        shard.lru_tail = node->prev;
+    }
+    node->prev = node->next = NULL;
+}
+
+void Cache::pushFront(Shard &shard, Node *node) {
+    node->prev = NULL;
+    node->next = shard.lru_head;
+    if (shard.lru_head) {
+        shard.lru_head->prev = node;
+    } else {
+        shard.lru_tail = node;
+    }
+    shard.lru_head = node;
+}
+
+void Cache::drop(Shard &shard, Node *node, CacheEntry::Ptr &gone) {
+    unlink(shard, node);
+    shard.expiry.erase(node->expiry);
+    shard.bytes_used -= node->charge;
+    gone.swap(node->entry);
+    shard.entries.erase(*node->key);
+}
+
+void Cache::evict(Shard &shard, const Node *keep, std::vector<Victim> &evicted) {
+    while (shard.bytes_used > shard_budget && shard.lru_tail) {
+        Node *victim = shard.lru_tail;
+        if (victim == keep || victim->referenced.exchange(false, std::memory_order_relaxed)) {
+            // recently hit, give it a second chance
+            unlink(shard, victim);
+            pushFront(shard, victim);
+            continue;
+        }
+
+        shard.evictions++;
+        Victim gone;
+        gone.key = *victim->key;
+        drop(shard, victim, gone.entry);
+        evicted.push_back(gone);
+    }
+}
+
+Freshness Cache::freshnessOf(const ResponseMeta &header, time_t request_time, time_t response_time) const {
+    // the deadlines count from now on the monotonic clock, the time the
+    //  response spent on its way here since response_time is already age
+    int64_t now = monotonicMillis();
+    double age = header.initialAge(request_time, response_time) + std::max(0.0, difftime(time(NULL), response_time));
+    double lifetime = header.freshnessLifetime();
+
+    Freshness freshness;
+    if (lifetime < 0) {
+        // nothing says how long it is fresh, every use revalidates
+        freshness.fresh_until = freshness.stale_until = now;
+    } else {
+        freshness.fresh_until = now + (int64_t)((lifetime - age) * 1000);
+        int window = header.staleWindow(stale_grace);
+        freshness.stale_until = freshness.fresh_until + (window > 0 ? window * 1000LL : 0);
+    }
+    freshness.purge_at = freshness.stale_until;
+    if (header.has(ResponseMeta::ETAG) || header.has(ResponseMeta::LAST_MODIFIED)) {
+        freshness.purge_at += VALIDATOR_RETENTION_SECONDS * 1000LL;
+    }
+    return freshness;
+}
+
+size_t Cache::chargeOf(const CacheEntry &entry) {
+    return entry.size() + entry.getHeader().footprint() + ENTRY_OVERHEAD;
+}
+
+/* a chunked response, collected with its body already decoded, gets a header
+ * with the decoded length instead of the chunked framing */
+static void withLength(std::vector<char> &val, ResponseMeta::Ptr &header) {
+    const char *terminator = "\r\n\r\n";
+    size_t head_len = std::search(val.data(), val.data() + val.size(), terminator, terminator + 4) - val.data();
+    head_len = std::min(head_len + 4, val.size());
+    std::vector<std::pair<std::string, std::string> > changes;
+    changes.push_back(std::make_pair("Transfer-Encoding", ""));
+    changes.push_back(std::make_pair("Trailer", ""));
+    changes.push_back(std::make_pair("Content-Length", std::to_string(val.size() - head_len)));
+    std::string head = header->withFields(changes) + "\r\n";
+
+    // sized exactly, the fill buffer grew in steps
+    std::vector<char> resp;
+    resp.reserve(head.size() + val.size() - head_len);
+    resp.assign(head.begin(), head.end());
+    resp.insert(resp.end(), val.begin() + head_len, val.end());
+    val.swap(resp);
+    header = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(val));
+}
+
+CacheEntry::Ptr Cache::put(const CacheKey &key, std::vector<char> val, ResponseMeta::Ptr header,
+                           time_t request_time, time_t response_time) {
+    // build the entry outside the lock, publishing it is a pointer swap
+    if (header->isChunked()) {
+        withLength(val, header);
+    }
+    std::vector<char> packed;
+    if (compressor && compressor->compress(val, *header, packed)) {
+        header = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(packed));
+        val.swap(packed);
+    }
+    Freshness freshness = freshnessOf(*header, request_time, response_time);
+    CacheEntry::Ptr entry = std::make_shared<const CacheEntry>(std::move(val), std::move(header), freshness);
+    size_t charge = chargeOf(*entry);
+    if (charge > max_object_bytes) {
+        bypassed++;
+        log_info("not cacheable because response exceeds " + std::to_string(max_object_bytes) + " bytes");
+        // whatever is stored under key is outdated by this response
+        remove(key);
+        return entry;
+    }
+
+    if (disk) {
+        disk->remove(key);
+    }
+    insert(key, entry, charge);
+    return entry;
+}
+
+bool Cache::insert(const CacheKey &key, const CacheEntry::Ptr &entry, size_t charge, bool replace) {
+    // replaced and evicted entries are released after the lock is dropped
+    CacheEntry::Ptr replaced;
+    std::vector<Victim> evicted;
+    Shard &shard = shardFor(key);
+    pthread_rwlock_wrlock(&shard.lock);
+    std::pair<std::unordered_map<CacheKey, Node, CacheKeyHash>::iterator, bool> slot =
+        shard.entries.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple());
+    Node *node = &slot.first->second;
+    if (slot.second) {
+        node->key = &slot.first->first;
+    } else if (!replace) {
+        pthread_rwlock_unlock(&shard.lock);
+        return false;
+    } else {
+        unlink(shard, node);
+        shard.expiry.erase(node->expiry);
+        shard.bytes_used -= node->charge;
+        replaced.swap(node->entry);
+    }
+    node->entry = entry;
+    node->expiry = shard.expiry.insert(std::make_pair(entry->getFreshness().purge_at, node));
+    node->charge = charge;
+    node->referenced.store(false, std::memory_order_relaxed);
+    pushFront(shard, node);
+    shard.bytes_used += charge;
+    evict(shard, node, evicted);
+    pthread_rwlock_unlock(&shard.lock);
+
+    // demoted on the putting thread, appending mostly lands in the page cache.
+    //  Markers are not worth a disk read, a miss stores them again
+    int64_t now = monotonicMillis();
+    for (size_t i = 0; disk && i < evicted.size(); ++i) {
+        if (evicted[i].entry->getFreshness().purge_at > now && !evicted[i].entry->isVaryMarker()) {
+            disk->store(evicted[i].key, evicted[i].entry);
+        }
     }
-    pthread_mutex_unlock(&cache_lock);
     return true;
 }
+
+bool Cache::restore(const CacheKey &key, const CacheEntry::Ptr &entry) {
+    size_t charge = chargeOf(*entry);
+    return charge <= max_object_bytes && insert(key, entry, charge, false);
+}
+
+std::vector<std::pair<CacheKey, CacheEntry::Ptr> > Cache::listEntries() {
+    std::vector<std::pair<CacheKey, CacheEntry::Ptr> > listed;
+    for (size_t i = 0; i <= shard_mask; ++i) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        for (Node *node = shards[i].lru_head; node; node = node->next) {
+            listed.push_back(std::make_pair(*node->key, node->entry));
+        }
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+    return listed;
+}
+
+CacheEntry::Ptr Cache::get(const CacheKey& key) {
+    CacheEntry::Ptr entry;
+    Shard &shard = shardFor(key);
+    pthread_rwlock_rdlock(&shard.lock);
+    std::unordered_map<CacheKey, Node, CacheKeyHash>::iterator iter = shard.entries.find(key);
+    if (iter != shard.entries.end()) {
+        entry = iter->second.entry;
+        // avoid dirtying the cache line when the flag is already set
+        if (!iter->second.referenced.load(std::memory_order_relaxed)) {
+            iter->second.referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+    pthread_rwlock_unlock(&shard.lock);
+    if (entry || !disk) {
+        return entry;
+    }
+
+    bool promote = false;
+    entry = disk->get(key, promote);
+    if (entry && promote) {
+        // hot again, serve it from memory from now on
+        std::vector<char> copy(entry->data(), entry->data() + entry->size());
+        entry = std::make_shared<const CacheEntry>(std::move(copy), entry->shareHeader(), entry->getFreshness(), true);
+        insert(key, entry, chargeOf(*entry));
+    }
+    return entry;
+}
+
+void Cache::remove(const CacheKey& key) {
+    CacheEntry::Ptr removed;
+    Shard &shard = shardFor(key);
+    pthread_rwlock_wrlock(&shard.lock);
+    std::unordered_map<CacheKey, Node, CacheKeyHash>::iterator iter = shard.entries.find(key);
+    if (iter != shard.entries.end()) {
+        drop(shard, &iter->second, removed);
+    }
+    pthread_rwlock_unlock(&shard.lock);
+    if (disk) {
+        disk->remove(key);
+    }
+}
+
+CacheEntry::Ptr Cache::lookup(const RequestMeta &req, CacheKey &key) {
+    std::string primary = keys.primary(req);
+    key = CacheKey::of(primary);
+    CacheEntry::Ptr entry = get(key);
+    if (entry && entry->isVaryMarker()) {
+        std::string fields = CacheKeyBuilder::varyFields(entry->getHeader());
+        key = CacheKey::of(CacheKeyBuilder::secondary(primary, fields, req));
+        entry = get(key);
+    }
+    return entry;
+}
+
+CacheKey Cache::storeKey(const RequestMeta &req, const ResponseMeta::Ptr &response) {
+    std::string primary = keys.primary(req);
+    CacheKey key = CacheKey::of(primary);
+    std::string fields = CacheKeyBuilder::varyFields(*response);
+    if (fields.empty()) {
+        // a put under the primary key replaces any marker left there
+        return key;
+    }
+
+    CacheEntry::Ptr marker = get(key);
+    if (!marker || !marker->isVaryMarker() || CacheKeyBuilder::varyFields(marker->getHeader()) != fields) {
+        marker = std::make_shared<const CacheEntry>(response);
+        if (disk) {
+            disk->remove(key);
+        }
+        insert(key, marker, chargeOf(*marker));
+    }
+    return CacheKey::of(CacheKeyBuilder::secondary(primary, fields, req));
+}
+
+void Cache::purgeExpired() {
+    int64_t now = monotonicMillis();
+    std::vector<CacheEntry::Ptr> purged;
+    for (size_t i = 0; i <= shard_mask; ++i) {
+        Shard &shard = shards[i];
+        if (pthread_rwlock_trywrlock(&shard.lock) != 0) {
+            continue;
+        }
+        while (!shard.expiry.empty() && shard.expiry.begin()->first <= now) {
+            purged.push_back(CacheEntry::Ptr());
+            drop(shard, shard.expiry.begin()->second, purged.back());
+            shard.purged++;
+        }
+        pthread_rwlock_unlock(&shard.lock);
+    }
+}
+
+size_t Cache::getMaxObjectBytes() const {
+    return max_object_bytes;
+}
+
+FetchTable &Cache::getFetches() {
+    return fetches;
+}
+
+Compressor *Cache::getCompressor() {
+    return compressor;
+}
+
+CacheStats Cache::getStats() {
+    CacheStats stats;
+    for (size_t i = 0; i <= shard_mask; ++i) {
+        pthread_rwlock_rdlock(&shards[i].lock);
+        stats.entries += shards[i].entries.size();
+        stats.bytes_used += shards[i].bytes_used;
+        stats.evictions += shards[i].evictions;
+        stats.purged += shards[i].purged;
+        pthread_rwlock_unlock(&shards[i].lock);
+    }
+    stats.bypassed = bypassed.load();
+    return stats;
+}
+
+std::string CacheStats::toString() const {
+    std::stringstream ss;
+    ss << "entries=" << entries << " bytes_used=" << bytes_used
+       << " evictions=" << evictions << " purged=" << purged << " bypassed=" << bypassed;
+    return ss.str();
+}
+
 /* response need to revalidate, if it has etag or last modified header field,
  * send the ask revalidation request to the server, else send the original
  * request to the server */
 
 
-std::string Cache::revalidate(ResponseMeta val, RequestMeta req_val){
-    std::pair<bool, std::string> etag = val.getEtag();
+std::string Cache::revalidate(const ResponseMeta &val, const RequestMeta &req_val){
+    std::pair<bool, std::string> etag = Compressor::originEtag(val);
     std::pair<bool, std::string> lastModified = val.getLastModified();
     std::string newRequest;
-    std::string head = req_val.getHead();
+    // the whole response is revalidated, ranges are cut from it afterwards.
+    //  The client's own validators go too, a 304 must answer the cache's
+    static const char * const dropped_fields[] = {"Range", "If-Range", "If-None-Match", "If-Modified-Since",
+                                                  "If-Match", "If-Unmodified-Since", NULL};
+    std::string head = req_val.headWithout(dropped_fields);
     if(etag.first){
         newRequest = head + "\r\n" + "If-None-Match: "+ etag.second + "\r\n\r\n";
     }
@@ -52,41 +375,57 @@ std::string Cache::revalidate(ResponseMeta val, RequestMeta req_val){
         newRequest = head + "\r\n" + "If-Modified-Since: "+ lastModified.second + "\r\n\r\n";
     }
     else{
-        newRequest = head;
+        newRequest = head + "\r\n\r\n";
     }
     return newRequest;
 }
 
-/* check if the response can be stored in the cache */
+CacheEntry::Ptr Cache::refresh(const CacheKey &key, const CacheEntry::Ptr &stale,
+                               const ResponseMeta &not_modified, time_t request_time, time_t response_time) {
+    std::string head = stale->getHeader().updatedHead(not_modified);
+    if (Compressor::isTransformed(stale->getHeader())) {
+        // the 304 carries the origin's validators, not those of the gzipped body
+        ResponseMeta updated(head);
+        head = updated.withFields(Compressor::transformedFields(updated));
+    }
+    const char *terminator = "\r\n\r\n";
+    const char *body = std::search(stale->data(), stale->data() + stale->size(), terminator, terminator + 4);
+    body = std::min(body + 4, stale->data() + stale->size());
 
-bool Cache::store_response(std::vector<char> resp) {
-    ResponseMeta response = HttpParser::parseRespHeader(resp);
-    size_t f = response.getFirstLine().find("HTTP/1.1 200 OK\r\n\r\n");
-    if (f != std::string::npos) {
-        bool whether_have_cache_control = response.getCacheControl().first;
-        //have cache control
-        if (whether_have_cache_control) {
-
-            if (response.isNoStore()) {
-                log_info("not cacheable because Cache-Control : no-store");
-                return false;
-            } else if (response.isPrivate()) {
-                log_info("not cacheable because Cache-Control : is-private");
-                return false;
-            } else {
-                // TODO: check if no cache and print log
-                if (response.isNoCache()) {
-                    log_info("cached, but requires re-validation");
-                }
-                return true;
-            }
-        }
+    std::vector<char> resp(head.begin(), head.end());
+    resp.push_back('\r');
+    resp.push_back('\n');
+    resp.insert(resp.end(), body, stale->data() + stale->size());
+    return put(key, std::move(resp), std::make_shared<const ResponseMeta>(head), request_time, response_time);
+}
 
-        else {
-            return true;
-        }
+/* check if the response can be stored in the cache */
+
+bool Cache::store_response(const ResponseMeta &response) {
+    // only plain 200 responses are cached
+    if (response.getStatus() != 200) {
+        return false;
     }
-    else{
+    std::string coding = response.getValue(ResponseMeta::TRANSFER_ENCODING);
+    coding.erase(coding.find_last_not_of(" \t") + 1);
+    coding.erase(0, coding.find_first_not_of(" \t"));
+    if (!coding.empty() && !equalsIgnoreCase(coding.data(), coding.size(), "chunked")) {
+        // only the chunked framing is removed before storing
+        log_info("not cacheable because Transfer-Encoding : " + coding);
         return false;
     }
+    if (response.isNoStore()) {
+        log_info("not cacheable because Cache-Control : no-store");
+        return false;
+    } else if (response.isPrivate()) {
+        log_info("not cacheable because Cache-Control : is-private");
+        return false;
+    } else if (CacheKeyBuilder::varyFields(response) == "*") {
+        log_info("not cacheable because Vary : *");
+        return false;
+    }
+    if (response.isNoCache()) {
+        log_info("cached, but requires re-validation");
+    }
+    return true;
 }
@@ -1,29 +1,246 @@
 #ifndef __CACHE_HPP__
 #define __CACHE_HPP__
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include "Util.hpp"
+#include "CacheKey.hpp"
+#include "Compressor.hpp"
+#include "DiskCache.hpp"
+#include "FetchTable.hpp"
+#include "Freshness.hpp"
 #include "ResponseMeta.hpp"
 #include "RequestMeta.hpp"
 #include "HttpParser.hpp"
 #include "assert.h"
 
+/**
+ * An immutable cached response. Entries are shared between the cache and every
+ * connection serving them, so a hit only takes a reference instead of copying
+ * the body, and replacing or removing the entry never frees bytes that are
+ * still being sent. The response header is kept parsed next to the bytes, a
+ * hit never parses it again.
+ *
+ * Entries read from the disk tier keep their bytes in the mapped segment
+ * instead, and are sent to clients straight from its file.
+ *
+ * A vary marker is an entry that is never served: it holds the header of a
+ * response with a Vary field, stored under the primary key of its URI, and
+ * tells lookups which request fields select the variant to look for.
+ */
+class CacheEntry {
+private:
+    const std::vector<char> response;
+    const ResponseMeta::Ptr header;
+    const Freshness freshness;
+    const DiskSegment::Ptr segment;
+    const off_t offset;
+    const size_t length;
+    // a copy of the response is in the disk tier
+    const bool persisted;
+    const bool vary_marker;
+
+public:
+    typedef std::shared_ptr<const CacheEntry> Ptr;
+
+    CacheEntry(std::vector<char> resp, ResponseMeta::Ptr header, const Freshness &freshness,
+               bool persisted = false) :
+        response(std::move(resp)), header(std::move(header)), freshness(freshness), offset(0),
+        length(response.size()), persisted(persisted), vary_marker(false) {}
+    // length response bytes at offset in segment
+    CacheEntry(DiskSegment::Ptr segment, off_t offset, size_t length, ResponseMeta::Ptr header,
+               const Freshness &freshness, bool persisted = true) :
+        header(std::move(header)), freshness(freshness), segment(std::move(segment)), offset(offset),
+        length(length), persisted(persisted), vary_marker(false) {}
+    // a vary marker for responses like header, its bytes are the header text
+    explicit CacheEntry(ResponseMeta::Ptr header) :
+        response(header->getHead().begin(), header->getHead().end()), header(std::move(header)),
+        freshness(Freshness::forever()), offset(0), length(response.size()), persisted(false),
+        vary_marker(true) {}
+
+    const ResponseMeta &getHeader() const { return *header; }
+    const Freshness &getFreshness() const { return freshness; }
+    const ResponseMeta::Ptr &shareHeader() const { return header; }
+    const char *data() const { return segment ? segment->at(offset) : response.data(); }
+    size_t size() const { return length; }
+    bool isPersisted() const { return persisted; }
+    bool isVaryMarker() const { return vary_marker; }
+    // file holding the response at getFileOffset(), -1 for entries in memory
+    int getFd() const { return segment ? segment->getFd() : -1; }
+    off_t getFileOffset() const { return offset; }
+};
+
+#define MAX_CACHE_SHARDS 64
+#define DEFAULT_CACHE_BYTES (256UL << 20)
+#define DEFAULT_CACHE_OBJECT_RATIO 0.0625
+// seconds an expired entry with a validator is kept past its last usable
+//  moment, so a revalidation can still be answered with a 304
+#define VALIDATOR_RETENTION_SECONDS 600
+
+/**
+ * Counters describing the cache, summed over all shards
+ */
+struct CacheStats {
+    uint64_t entries;
+    uint64_t bytes_used;
+    uint64_t evictions;
+    // entries dropped once they were of no use anymore
+    uint64_t purged;
+    // responses too large to be cached at all
+    uint64_t bypassed;
+
+    CacheStats() : entries(0), bytes_used(0), evictions(0), purged(0), bypassed(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * One cache shared by all event loops. Responses are stored under the 128-bit
+ * hash of their canonical key (see CacheKeyBuilder), responses with a Vary
+ * field under a secondary key next to a vary marker under the primary one.
+ * Keys are spread over a power-of-two
+ * number of shards by hash, each shard is a hash table behind its own
+ * reader-writer lock, so lookups of different keys never contend and
+ * concurrent hits on the same shard only take the lock shared.
+ *
+ * Memory is bounded by a byte budget split evenly over the shards. Every shard
+ * keeps its entries on an intrusive LRU list; hits only mark their node as
+ * referenced (they hold the lock shared), puts evict from the cold end and
+ * give referenced nodes a second chance at the hot end. Every shard also
+ * orders its entries by the time they become useless, so expired entries are
+ * purged by the loops' timers instead of holding memory until evicted.
+ */
 class Cache {
 private:
-    std::map<std::string, std::vector<char>> cash;
+    struct Node;
+    typedef std::multimap<int64_t, Node *> ExpiryIndex;
+
+    struct Node {
+        CacheEntry::Ptr entry;
+        // bytes accounted for this entry: response, header and bookkeeping
+        size_t charge;
+        const CacheKey *key;
+        Node *prev;
+        Node *next;
+        ExpiryIndex::iterator expiry;
+        std::atomic<bool> referenced;
+
+        Node() : charge(0), key(NULL), prev(NULL), next(NULL), referenced(false) {}
+    };
+
+    struct Shard {
+        pthread_rwlock_t lock;
+        std::unordered_map<CacheKey, Node, CacheKeyHash> entries;
+        // most recently inserted or rescued node first
+        Node *lru_head;
+        Node *lru_tail;
+        // every node by the purge time of its entry
+        ExpiryIndex expiry;
+        size_t bytes_used;
+        uint64_t evictions;
+        uint64_t purged;
+        // keep the locks of neighbouring shards off the same cache line
+        char pad[64];
+
+        Shard() : lru_head(NULL), lru_tail(NULL), bytes_used(0), evictions(0), purged(0) {}
+    };
+
+    Shard *shards;
+    size_t shard_mask;
+    size_t shard_budget;
+    size_t max_object_bytes;
+    int stale_grace;
+    std::atomic<uint64_t> bypassed;
+    FetchTable fetches;
+    DiskCache *disk;
+    Compressor *compressor;
+    CacheKeyBuilder keys;
+
+    Shard &shardFor(const CacheKey &key);
+    static void unlink(Shard &shard, Node *node);
+    static void pushFront(Shard &shard, Node *node);
+    // drop node from the shard's lists and table, its entry is moved to gone
+    static void drop(Shard &shard, Node *node, CacheEntry::Ptr &gone);
+    // an entry pushed out of memory, kept by the disk tier if there is one
+    struct Victim {
+        CacheKey key;
+        CacheEntry::Ptr entry;
+    };
+
+    // drop cold entries until the shard fits its budget, keep is never evicted
+    void evict(Shard &shard, const Node *keep, std::vector<Victim> &evicted);
+    // publish entry, which takes charge bytes, in memory. An entry already
+    //  stored under key is kept unless replace is set, returns whether entry
+    //  was published
+    bool insert(const CacheKey &key, const CacheEntry::Ptr &entry, size_t charge, bool replace = true);
+    static size_t chargeOf(const CacheEntry &entry);
+
+    Cache(const Cache &);
+    Cache &operator=(const Cache &);
 
 public:
-    Cache() {}
+    // budget_bytes bounds all cached responses, responses larger than
+    //  max_object_ratio of the budget are never cached. Entries evicted from
+    //  memory move to disk if it is given. Stored responses without a
+    //  stale-while-revalidate window of their own get stale_grace seconds.
+    //  Query parameters named in ignored_params are not part of any key.
+    //  Compressible responses are stored gzipped if compressor is given
+    explicit Cache(size_t budget_bytes = DEFAULT_CACHE_BYTES,
+                   double max_object_ratio = DEFAULT_CACHE_OBJECT_RATIO, DiskCache *disk = NULL,
+                   int stale_grace = 0,
+                   const std::vector<std::string> &ignored_params = std::vector<std::string>(),
+                   Compressor *compressor = NULL);
+
+    ~Cache();
+
+    // store resp, parsed into header, under key, replacing any previous entry,
+    //  returns the stored entry (which is not cached if it exceeds the object
+    //  size limit, and may be gzipped). The request was sent at request_time and the response
+    //  received at response_time. A chunked response is given with its
+    //  payload already decoded and stored with a Content-Length
+    CacheEntry::Ptr put(const CacheKey &key, std::vector<char> resp, ResponseMeta::Ptr header,
+                        time_t request_time, time_t response_time);
+    // returns a handle to the entry stored under key in memory or on disk,
+    //  empty if there is none
+    CacheEntry::Ptr get(const CacheKey &key);
+    void remove(const CacheKey &key);
+    // store entry under key unless the key is cached already or the entry is
+    //  too large, for entries restored from a snapshot
+    bool restore(const CacheKey &key, const CacheEntry::Ptr &entry);
+    // every key in memory with its entry, most recently used first per shard
+    std::vector<std::pair<CacheKey, CacheEntry::Ptr> > listEntries();
 
-    ~Cache() {}
+    // the entry (never a vary marker) answering req, empty if there is none.
+    //  key is set to the key it is or would be stored under
+    CacheEntry::Ptr lookup(const RequestMeta &req, CacheKey &key);
+    // the key response to req is stored under. If it varies, a marker for it
+    //  is stored under the primary key first
+    CacheKey storeKey(const RequestMeta &req, const ResponseMeta::Ptr &response);
 
-    void put(std::string key, std::vector<char> resp);
-    std::vector<char> &get(const std::string &key);
-    void remove(const std::string &key);
+    std::string revalidate(const ResponseMeta &val, const RequestMeta &req_val);
+    // the origin answered the revalidation of stale with not_modified, store
+    //  and return stale's body under the updated header
+    CacheEntry::Ptr refresh(const CacheKey &key, const CacheEntry::Ptr &stale,
+                            const ResponseMeta &not_modified, time_t request_time, time_t response_time);
+    // deadlines of the response header to a request sent at request_time,
+    //  received at response_time
+    Freshness freshnessOf(const ResponseMeta &header, time_t request_time, time_t response_time) const;
+    // drop entries whose purge time passed, shards busy right now are skipped
+    //  until the next call
+    void purgeExpired();
+    bool store_response(const ResponseMeta &response);
 
-    bool find(const std::string &key);
-    std::string revalidate(ResponseMeta val, RequestMeta req_val);
-    bool store_response(std::vector<char> resp);
+    CacheStats getStats();
+    // largest response the cache accepts
+    size_t getMaxObjectBytes() const;
+    // misses being fetched, for collapsing concurrent ones
+    FetchTable &getFetches();
+    // NULL unless responses are stored compressed
+    Compressor *getCompressor();
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,93 @@
+#include "CacheControl.hpp"
+#include <climits>
+
+#include "Util.hpp"
+
+CacheControl::CacheControl() :
+    flags(0), max_age(UNSPECIFIED), s_maxage(UNSPECIFIED), max_stale(UNSPECIFIED),
+    min_fresh(UNSPECIFIED), stale_while_revalidate(UNSPECIFIED), stale_if_error(UNSPECIFIED) {}
+
+/* comma separated directives, each a token optionally followed by =value */
+void CacheControl::parse(const char * value, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) {
+            ++i;
+        }
+        const char * directive = value + i;
+        while (i < len && value[i] != '=' && value[i] != ',' && value[i] != ' ' && value[i] != '\t') {
+            ++i;
+        }
+        size_t directive_len = value + i - directive;
+
+        bool has_seconds = false;
+        long seconds = 0;
+        if (i < len && value[i] == '=') {
+            ++i;
+            if (i < len && value[i] == '"') {
+                ++i;
+            }
+            while (i < len && value[i] >= '0' && value[i] <= '9') {
+                has_seconds = true;
+                if (seconds < INT_MAX) {
+                    seconds = seconds * 10 + (value[i] - '0');
+                }
+                ++i;
+            }
+            if (seconds > INT_MAX) {
+                seconds = INT_MAX;
+            }
+            // field names of no-cache="..." and private="..." are not used,
+            //  the directive then applies to the whole response
+            bool quoted = false;
+            while (i < len && (quoted || value[i] != ',')) {
+                if (value[i] == '"') {
+                    quoted = !quoted;
+                }
+                ++i;
+            }
+        }
+
+        if (equalsIgnoreCase(directive, directive_len, "max-age")) {
+            if (has_seconds) {
+                max_age = (int)seconds;
+            }
+        } else if (equalsIgnoreCase(directive, directive_len, "s-maxage")) {
+            if (has_seconds) {
+                s_maxage = (int)seconds;
+            }
+        } else if (equalsIgnoreCase(directive, directive_len, "max-stale")) {
+            max_stale = has_seconds ? (int)seconds : INT_MAX;
+        } else if (equalsIgnoreCase(directive, directive_len, "min-fresh")) {
+            if (has_seconds) {
+                min_fresh = (int)seconds;
+            }
+        } else if (equalsIgnoreCase(directive, directive_len, "stale-while-revalidate")) {
+            if (has_seconds) {
+                stale_while_revalidate = (int)seconds;
+            }
+        } else if (equalsIgnoreCase(directive, directive_len, "stale-if-error")) {
+            if (has_seconds) {
+                stale_if_error = (int)seconds;
+            }
+        } else if (equalsIgnoreCase(directive, directive_len, "no-cache")) {
+            flags |= NO_CACHE;
+        } else if (equalsIgnoreCase(directive, directive_len, "no-store")) {
+            flags |= NO_STORE;
+        } else if (equalsIgnoreCase(directive, directive_len, "private")) {
+            flags |= PRIVATE;
+        } else if (equalsIgnoreCase(directive, directive_len, "public")) {
+            flags |= PUBLIC;
+        } else if (equalsIgnoreCase(directive, directive_len, "must-revalidate")) {
+            flags |= MUST_REVALIDATE;
+        } else if (equalsIgnoreCase(directive, directive_len, "proxy-revalidate")) {
+            flags |= PROXY_REVALIDATE;
+        } else if (equalsIgnoreCase(directive, directive_len, "no-transform")) {
+            flags |= NO_TRANSFORM;
+        } else if (equalsIgnoreCase(directive, directive_len, "only-if-cached")) {
+            flags |= ONLY_IF_CACHED;
+        } else if (equalsIgnoreCase(directive, directive_len, "immutable")) {
+            flags |= IMMUTABLE;
+        }
+    }
+}
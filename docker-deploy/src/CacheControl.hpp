@@ -0,0 +1,47 @@
+#ifndef __CACHE_CONTROL_HPP_
+#define __CACHE_CONTROL_HPP_
+
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * Cache-Control directives of a request or response, parsed once into a set
+ * of flags and the integer valued directives so that checking them never
+ * looks at the header text again. Directive names are case-insensitive,
+ * several Cache-Control lines accumulate.
+ */
+struct CacheControl {
+    enum Flag {
+        NO_CACHE = 1 << 0,
+        NO_STORE = 1 << 1,
+        PRIVATE = 1 << 2,
+        PUBLIC = 1 << 3,
+        MUST_REVALIDATE = 1 << 4,
+        PROXY_REVALIDATE = 1 << 5,
+        NO_TRANSFORM = 1 << 6,
+        ONLY_IF_CACHED = 1 << 7,
+        IMMUTABLE = 1 << 8
+    };
+
+    // value of directives that were not sent
+    const static int UNSPECIFIED = -1;
+
+    uint32_t flags;
+    // delta-seconds, UNSPECIFIED when absent. A max-stale without value
+    //  accepts any staleness and is stored as INT_MAX
+    int max_age;
+    int s_maxage;
+    int max_stale;
+    int min_fresh;
+    int stale_while_revalidate;
+    int stale_if_error;
+
+    CacheControl();
+
+    // add the directives of one Cache-Control field value
+    void parse(const char * value, size_t len);
+
+    bool has(Flag flag) const { return (flags & flag) != 0; }
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "CacheKey.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+// fixed, keys must hash the same across restarts for snapshots
+#define KEY_SEED 0x48435053ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+CacheKey CacheKey::of(const std::string & text) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const char * data = text.data();
+    size_t len = text.size();
+    uint64_t h1 = KEY_SEED;
+    uint64_t h2 = KEY_SEED;
+
+    size_t blocks = len / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // the tail zero-padded to a block, mixed without the rounds
+    size_t rest = len & 15;
+    if (rest > 0) {
+        char tail[16] = {0};
+        memcpy(tail, data + blocks * 16, rest);
+        uint64_t k1, k2;
+        memcpy(&k1, tail, 8);
+        memcpy(&k2, tail + 8, 8);
+        if (rest > 8) {
+            k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        }
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    CacheKey key;
+    key.hi = h1;
+    key.lo = h2;
+    return key;
+}
+
+std::string CacheKey::toString() const {
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+    return text;
+}
+
+CacheKeyBuilder::CacheKeyBuilder(const std::vector<std::string> & ignored_params) :
+    ignored_params(ignored_params) {}
+
+bool CacheKeyBuilder::isIgnored(const char * name, size_t len) const {
+    for (size_t i = 0; i < ignored_params.size(); ++i) {
+        if (ignored_params[i].size() == len && memcmp(ignored_params[i].data(), name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = tolower((unsigned char)c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* RFC 3986 section 6.2.2: escapes of unreserved characters are decoded, the
+ * hex digits of the others uppercased */
+void CacheKeyBuilder::appendNormalized(std::string & out, const char * data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        int high = i + 2 < len && data[i] == '%' ? hexValue(data[i + 1]) : -1;
+        int low = high >= 0 ? hexValue(data[i + 2]) : -1;
+        if (low < 0) {
+            out.push_back(data[i]);
+            continue;
+        }
+        char c = (char)(high * 16 + low);
+        if (isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            out.push_back(c);
+        } else {
+            out.push_back('%');
+            out.push_back(toupper((unsigned char)data[i + 1]));
+            out.push_back(toupper((unsigned char)data[i + 2]));
+        }
+        i += 2;
+    }
+}
+
+std::string CacheKeyBuilder::primary(const RequestMeta & req) const {
+    // the target is absolute-form when sent to a proxy, origin-form otherwise
+    const std::string & target = req.getUrl();
+    std::string scheme = "http";
+    size_t path = 0;
+    size_t sep = target.find("://");
+    if (!target.empty() && target[0] != '/' && sep != std::string::npos) {
+        scheme = target.substr(0, sep);
+        path = target.find_first_of("/?#", sep + 3);
+    }
+    size_t end = std::min(target.find('#'), target.size());
+    path = std::min(path, end);
+    size_t query = std::min(target.find('?', path), end);
+
+    std::string key = req_type_repr(req.getRequestType()) + " ";
+    std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+    key += scheme + "://";
+    const std::string & host = req.getHost();
+    bool ipv6 = host.find(':') != std::string::npos;
+    key += ipv6 ? "[" : "";
+    for (size_t i = 0; i < host.size(); ++i) {
+        key.push_back(tolower((unsigned char)host[i]));
+    }
+    key += ipv6 ? "]" : "";
+    uint16_t default_port = scheme == "https" ? 443 : 80;
+    if (req.getPort() != default_port) {
+        key += ":" + std::to_string(req.getPort());
+    }
+
+    if (path == query) {
+        key.push_back('/');
+    }
+    appendNormalized(key, target.data() + path, query - path);
+
+    // parameters keep their order, only the ignored ones and empty ones go
+    bool first = true;
+    size_t param = query + 1;
+    while (param < end) {
+        size_t param_end = std::min(target.find('&', param), end);
+        size_t name_end = std::min(target.find('=', param), param_end);
+        if (param_end > param && !isIgnored(target.data() + param, name_end - param)) {
+            key.push_back(first ? '?' : '&');
+            appendNormalized(key, target.data() + param, param_end - param);
+            first = false;
+        }
+        param = param_end + 1;
+    }
+    return key;
+}
+
+std::string CacheKeyBuilder::varyFields(const ResponseMeta & response) {
+    std::vector<std::string> names;
+    std::string value = response.getValue(ResponseMeta::VARY);
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = std::min(value.find(',', start), value.size());
+        size_t first = value.find_first_not_of(" \t", start);
+        size_t last = value.find_last_not_of(" \t", end - 1);
+        if (first < end && last != std::string::npos && last >= first) {
+            std::string name = value.substr(first, last - first + 1);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == "*") {
+                return name;
+            }
+            names.push_back(name);
+        }
+        start = end + 1;
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    std::string fields;
+    for (size_t i = 0; i < names.size(); ++i) {
+        fields += (i > 0 ? "," : "") + names[i];
+    }
+    return fields;
+}
+
+std::string CacheKeyBuilder::secondary(const std::string & primary, const std::string & vary_fields,
+                                       const RequestMeta & req) {
+    std::string key = primary;
+    size_t start = 0;
+    while (start < vary_fields.size()) {
+        size_t end = std::min(vary_fields.find(',', start), vary_fields.size());
+        std::string name = vary_fields.substr(start, end - start);
+        std::pair<bool, std::string> value = req.getField(name);
+        // a missing field differs from an empty one
+        key += "\n" + name;
+        if (value.first) {
+            key.push_back(':');
+            // runs of whitespace compare equal
+            bool space = false;
+            for (size_t i = 0; i < value.second.size(); ++i) {
+                char c = value.second[i];
+                if (c == ' ' || c == '\t') {
+                    space = true;
+                    continue;
+                }
+                if (space) {
+                    key.push_back(' ');
+                    space = false;
+                }
+                key.push_back(c);
+            }
+        }
+        start = end + 1;
+    }
+    return key;
+}
@@ -0,0 +1,78 @@
+#ifndef __CACHE_KEY_HPP_
+#define __CACHE_KEY_HPP_
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "RequestMeta.hpp"
+#include "ResponseMeta.hpp"
+
+/**
+ * What the cache indexes responses by: a 128-bit hash of the canonical key
+ * text built by CacheKeyBuilder. Only the hash is kept in the memory index,
+ * the disk index, the fetch table and snapshots, never the text itself; at
+ * 128 bits two distinct keys colliding is not a practical concern.
+ */
+struct CacheKey {
+    uint64_t hi;
+    uint64_t lo;
+
+    CacheKey() : hi(0), lo(0) {}
+
+    // murmur3 (x64, 128-bit) of text
+    static CacheKey of(const std::string & text);
+
+    bool operator==(const CacheKey & other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!=(const CacheKey & other) const { return !(*this == other); }
+
+    // 32 hex digits, for logs
+    std::string toString() const;
+};
+
+// the key is a hash already, hash tables take its low half as is
+struct CacheKeyHash {
+    size_t operator()(const CacheKey & key) const { return (size_t)key.lo; }
+};
+
+/**
+ * Builds the text of cache keys from requests.
+ *
+ * The primary key is the method and the normalized absolute URI: scheme and
+ * host lowercased, the default port of the scheme dropped, percent-escapes
+ * uppercased and unreserved characters unescaped, the fragment dropped, and
+ * query parameters named in the ignore list (tracking parameters and the
+ * like) removed. So spellings of the same resource share one entry.
+ *
+ * A response with a Vary header is stored under a secondary key: the primary
+ * key followed by the request's values of the fields it varies on, with
+ * whitespace normalized. The cache keeps a marker under the primary key that
+ * tells which fields a lookup must add.
+ */
+class CacheKeyBuilder {
+private:
+    std::vector<std::string> ignored_params;
+
+    bool isIgnored(const char * name, size_t len) const;
+    // percent-escapes of data[0, len) normalized, appended to out
+    static void appendNormalized(std::string & out, const char * data, size_t len);
+
+public:
+    // query parameters named in ignored_params are not part of any key
+    explicit CacheKeyBuilder(const std::vector<std::string> & ignored_params = std::vector<std::string>());
+
+    // e.g. "GET http://example.com/a?b=1"
+    std::string primary(const RequestMeta & req) const;
+
+    // names of the request fields response varies on, lowercased, sorted and
+    //  comma separated. Empty if it does not vary, "*" if it varies on more
+    //  than the request header
+    static std::string varyFields(const ResponseMeta & response);
+
+    // primary extended by req's values of vary_fields
+    static std::string secondary(const std::string & primary, const std::string & vary_fields,
+                                 const RequestMeta & req);
+};
+
+#endif
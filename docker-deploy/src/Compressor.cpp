@@ -0,0 +1,231 @@
+#include "Compressor.hpp"
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "CacheKey.hpp"
+
+// window bits selecting the gzip wrapper instead of zlib's
+#define GZIP_WINDOW_BITS (15 + 16)
+#define INFLATE_CHUNK_SIZE 16384
+
+std::string CompressionStats::toString() const {
+    std::stringstream ss;
+    ss << "compressed=" << compressed << " skipped=" << skipped << " bytes_in=" << bytes_in
+       << " bytes_out=" << bytes_out << " saved=" << bytes_in - bytes_out << " inflated=" << inflated;
+    return ss.str();
+}
+
+Compressor::Compressor(int level, const std::vector<std::string> & types) :
+    level(level), compressed(0), skipped(0), bytes_in(0), bytes_out(0), inflated(0) {
+    for (size_t i = 0; i < types.size(); ++i) {
+        std::string type = types[i];
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+        this->types.push_back(type);
+    }
+}
+
+static std::string trimmedLower(const std::string & text, size_t start, size_t end) {
+    size_t first = text.find_first_not_of(" \t", start);
+    if (first >= end) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t", end - 1);
+    std::string trimmed = text.substr(first, last - first + 1);
+    std::transform(trimmed.begin(), trimmed.end(), trimmed.begin(), ::tolower);
+    return trimmed;
+}
+
+// offset of the body in data[0, len), len if the header does not end
+static size_t bodyOffset(const char * data, size_t len) {
+    const char * terminator = "\r\n\r\n";
+    const char * end = std::search(data, data + len, terminator, terminator + 4);
+    return end == data + len ? len : end - data + 4;
+}
+
+bool Compressor::compressible(const ResponseMeta & header) const {
+    if (header.has(ResponseMeta::CONTENT_ENCODING) || header.isChunked() ||
+        header.getContentLength() < COMPRESS_MIN_BYTES ||
+        header.getCacheControl().has(CacheControl::NO_TRANSFORM)) {
+        return false;
+    }
+    std::string value = header.getValue(ResponseMeta::CONTENT_TYPE);
+    std::string type = trimmedLower(value, 0, std::min(value.find(';'), value.size()));
+    for (size_t i = 0; i < types.size(); ++i) {
+        const std::string & allowed = types[i];
+        if (type == allowed || (allowed.size() >= 2 && allowed.compare(allowed.size() - 2, 2, "/*") == 0 &&
+                                type.compare(0, allowed.size() - 1, allowed, 0, allowed.size() - 1) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Compressor::compress(const std::vector<char> & resp, const ResponseMeta & header, std::vector<char> & out) {
+    if (!compressible(header)) {
+        return false;
+    }
+    size_t head_len = bodyOffset(resp.data(), resp.size());
+    size_t body_len = resp.size() - head_len;
+    if (body_len != (size_t)header.getContentLength()) {
+        return false;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    std::vector<char> gz(deflateBound(&zs, body_len));
+    zs.next_in = (Bytef *)resp.data() + head_len;
+    zs.avail_in = body_len;
+    zs.next_out = (Bytef *)gz.data();
+    zs.avail_out = gz.size();
+    int status = deflate(&zs, Z_FINISH);
+    size_t gz_len = zs.total_out;
+    deflateEnd(&zs);
+    // not worth a decompression for every client without gzip
+    if (status != Z_STREAM_END || gz_len > body_len - body_len / 8) {
+        skipped++;
+        return false;
+    }
+
+    // the same entry answers clients with and without gzip
+    std::string vary = header.getValue(ResponseMeta::VARY);
+    std::string fields = "," + CacheKeyBuilder::varyFields(header) + ",";
+    if (vary.empty()) {
+        vary = "Accept-Encoding";
+    } else if (fields.find(",accept-encoding,") == std::string::npos) {
+        vary += ", Accept-Encoding";
+    }
+    std::vector<std::pair<std::string, std::string> > changes = transformedFields(header);
+    changes.push_back(std::make_pair("Content-Length", std::to_string(gz_len)));
+    changes.push_back(std::make_pair("Content-Encoding", "gzip"));
+    changes.push_back(std::make_pair("Vary", vary));
+    std::string head = header.withFields(changes) + "\r\n";
+
+    out.reserve(head.size() + gz_len);
+    out.assign(head.begin(), head.end());
+    out.insert(out.end(), gz.begin(), gz.begin() + gz_len);
+    compressed++;
+    bytes_in += body_len;
+    bytes_out += gz_len;
+    return true;
+}
+
+bool Compressor::isDecodable(const ResponseMeta & header) {
+    std::string coding = header.getValue(ResponseMeta::CONTENT_ENCODING);
+    return trimmedLower(coding, 0, coding.size()) == "gzip" && !header.isChunked() &&
+           header.getContentLength() >= 0;
+}
+
+std::vector<char> Compressor::decompress(const char * data, size_t len, const ResponseMeta & header) {
+    size_t head_len = bodyOffset(data, len);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, GZIP_WINDOW_BITS) != Z_OK) {
+        throw std::runtime_error("failed to start decompressing a cached response");
+    }
+    zs.next_in = (Bytef *)data + head_len;
+    zs.avail_in = len - head_len;
+
+    std::vector<char> body;
+    int status = Z_OK;
+    char buffer[INFLATE_CHUNK_SIZE];
+    while (status == Z_OK) {
+        zs.next_out = (Bytef *)buffer;
+        zs.avail_out = sizeof(buffer);
+        status = inflate(&zs, Z_NO_FLUSH);
+        body.insert(body.end(), buffer, buffer + (sizeof(buffer) - zs.avail_out));
+    }
+    inflateEnd(&zs);
+    if (status != Z_STREAM_END) {
+        throw std::runtime_error("cached response is not valid gzip");
+    }
+
+    // the identity bytes are the origin's again, its entity tag stays weak
+    std::vector<std::pair<std::string, std::string> > changes;
+    changes.push_back(std::make_pair("Content-Length", std::to_string(body.size())));
+    changes.push_back(std::make_pair("Content-Encoding", ""));
+    changes.push_back(std::make_pair("Warning", ""));
+    std::string head = header.withFields(changes) + "\r\n";
+
+    std::vector<char> identity;
+    identity.reserve(head.size() + body.size());
+    identity.assign(head.begin(), head.end());
+    identity.insert(identity.end(), body.begin(), body.end());
+    inflated++;
+    return identity;
+}
+
+bool Compressor::acceptsGzip(const RequestMeta & req) {
+    std::pair<bool, std::string> field = req.getField("Accept-Encoding");
+    const std::string & value = field.second;
+    // an explicit gzip overrides *, q=0 refuses a coding
+    int gzip = -1;
+    int any = -1;
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = std::min(value.find(',', start), value.size());
+        size_t params = std::min(value.find(';', start), end);
+        std::string coding = trimmedLower(value, start, params);
+        bool accepted = true;
+        size_t q = value.find("q=", params);
+        if (q < end) {
+            accepted = strtod(value.c_str() + q + 2, NULL) > 0;
+        }
+        if (coding == "gzip" || coding == "x-gzip") {
+            gzip = accepted;
+        } else if (coding == "*") {
+            any = accepted;
+        }
+        start = end + 1;
+    }
+    return gzip != -1 ? gzip == 1 : any == 1;
+}
+
+bool Compressor::isTransformed(const ResponseMeta & header) {
+    std::pair<bool, std::string> warning = header.getField("Warning");
+    return warning.first && warning.second.find(TRANSFORMATION_WARNING) != std::string::npos &&
+           isDecodable(header);
+}
+
+std::vector<std::pair<std::string, std::string> > Compressor::transformedFields(const ResponseMeta & header) {
+    std::vector<std::pair<std::string, std::string> > changes;
+    std::pair<bool, std::string> etag = header.getEtag();
+    if (etag.first && etag.second.compare(0, 2, "W/") != 0) {
+        changes.push_back(std::make_pair("ETag", "W/" + etag.second));
+    }
+    std::pair<bool, std::string> warning = header.getField("Warning");
+    if (!warning.first) {
+        changes.push_back(std::make_pair("Warning", TRANSFORMATION_WARNING));
+    } else if (warning.second.find(TRANSFORMATION_WARNING) == std::string::npos) {
+        changes.push_back(std::make_pair("Warning", warning.second + ", " + TRANSFORMATION_WARNING));
+    }
+    return changes;
+}
+
+std::pair<bool, std::string> Compressor::originEtag(const ResponseMeta & header) {
+    std::pair<bool, std::string> etag = header.getEtag();
+    // If-None-Match compares weakly, the strength of the tag sent back does
+    //  not matter to the origin
+    if (etag.first && isTransformed(header) && etag.second.compare(0, 2, "W/") == 0) {
+        etag.second.erase(0, 2);
+    }
+    return etag;
+}
+
+CompressionStats Compressor::getStats() const {
+    CompressionStats stats;
+    stats.compressed = compressed.load();
+    stats.skipped = skipped.load();
+    stats.bytes_in = bytes_in.load();
+    stats.bytes_out = bytes_out.load();
+    stats.inflated = inflated.load();
+    return stats;
+}
@@ -0,0 +1,98 @@
+#ifndef __COMPRESSOR_HPP_
+#define __COMPRESSOR_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "RequestMeta.hpp"
+#include "ResponseMeta.hpp"
+
+// media types compressed unless configured otherwise, "type/*" matches all
+//  subtypes
+#define DEFAULT_COMPRESS_TYPES \
+    "text/*,application/javascript,application/json,application/xml,application/xhtml+xml,image/svg+xml"
+// bodies smaller than this are stored as they are
+#define COMPRESS_MIN_BYTES 256
+// warning a proxy adds to a representation whose content coding it changed
+#define TRANSFORMATION_WARNING "214 - \"Transformation Applied\""
+
+/**
+ * Counters of compressed storage
+ */
+struct CompressionStats {
+    // responses stored gzipped
+    uint64_t compressed;
+    // compressible responses kept as they were, they did not shrink by 1/8
+    uint64_t skipped;
+    // body bytes before and after compressing the responses stored gzipped
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    // hits decompressed for clients that do not accept gzip
+    uint64_t inflated;
+
+    CompressionStats() : compressed(0), skipped(0), bytes_in(0), bytes_out(0), inflated(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * Compressed storage of cacheable text. Bodies with a Content-Length and an
+ * allowed media type are gzipped when they are put in the cache, and their
+ * stored header says so (Content-Encoding, Content-Length, Vary:
+ * Accept-Encoding). Hits on them are sent as stored to clients that accept
+ * gzip, the common case, and decompressed for the others only.
+ *
+ * A gzipped body is a different representation from the origin's, so it is
+ * marked as transformed: its entity tag is weakened, which If-Range never
+ * matches, and it carries a 214 warning, which keeps ranges from being cut
+ * out of it.
+ */
+class Compressor {
+private:
+    int level;
+    // lowercased media types, "type/*" for a whole type
+    std::vector<std::string> types;
+
+    std::atomic<uint64_t> compressed;
+    std::atomic<uint64_t> skipped;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<uint64_t> inflated;
+
+    Compressor(const Compressor &);
+    Compressor & operator=(const Compressor &);
+
+public:
+    // gzip at level (1 to 9) the responses of the given media types
+    Compressor(int level, const std::vector<std::string> & types);
+
+    // whether a response like header is compressed when it is stored
+    bool compressible(const ResponseMeta & header) const;
+    // resp, parsed into header, with its body gzipped and its header updated
+    //  into out. False if it is not compressible or does not shrink enough
+    bool compress(const std::vector<char> & resp, const ResponseMeta & header, std::vector<char> & out);
+
+    // whether a stored response like header is decompressed for clients that
+    //  do not accept gzip
+    static bool isDecodable(const ResponseMeta & header);
+    // the identity form of the gzipped response data[0, len) parsed into
+    //  header, throws std::runtime_error if its body is not valid gzip
+    std::vector<char> decompress(const char * data, size_t len, const ResponseMeta & header);
+
+    // whether req accepts gzip content coding
+    static bool acceptsGzip(const RequestMeta & req);
+
+    // whether a stored response like header was gzipped by the proxy
+    static bool isTransformed(const ResponseMeta & header);
+    // the field changes marking a response like header as gzipped by the proxy
+    static std::vector<std::pair<std::string, std::string> > transformedFields(const ResponseMeta & header);
+    // the entity tag to revalidate a stored response like header with, the
+    //  origin's one for responses the proxy gzipped
+    static std::pair<bool, std::string> originEtag(const ResponseMeta & header);
+
+    CompressionStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,359 @@
+#include "Config.hpp"
+#include <getopt.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "Cache.hpp"
+#include "Compressor.hpp"
+#include "DiskCache.hpp"
+#include "DnsClient.hpp"
+
+// options without a short form
+enum LongOption {
+  OPT_DNS_TTL = 256,
+  OPT_DNS_NEGATIVE_TTL,
+  OPT_SNAPSHOT_INTERVAL,
+  OPT_IGNORE_QUERY_PARAM,
+  OPT_COMPRESS_TYPES,
+  OPT_RANGE_PREFETCH
+};
+
+// split a comma separated option value, throws on empty items
+static std::vector<std::string> listArg(const char * name, const char * value) {
+  std::vector<std::string> items;
+  std::string list = value;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    end = end == std::string::npos ? list.size() : end;
+    if (end == start) {
+      throw std::invalid_argument(std::string("invalid value for ") + name + ": " + value);
+    }
+    items.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+ProxyConfig::ProxyConfig() :
+    port("12345"), queue_size(1024), cache_bytes(DEFAULT_CACHE_BYTES),
+    cache_object_ratio(DEFAULT_CACHE_OBJECT_RATIO), disk_bytes(DEFAULT_DISK_BYTES),
+    snapshot_interval(300), compress_level(0), range_prefetch(false), tunnel_timeout(300),
+    stale_grace(0), connect_timeout(10), upstream_timeout(60), fetch_wait(15), client_timeout(15),
+    max_body(64 << 20), upstream_per_host(8),
+    upstream_idle_timeout(30), dns_ttl(60), dns_negative_ttl(10), stats_interval(60),
+    log_level(LOG_LEVEL_INFO), foreground(false) {
+  compress_types = listArg("--compress-types", DEFAULT_COMPRESS_TYPES);
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  loop_threads = cores > 0 ? (int)cores : 1;
+}
+
+static void usage(const char * prog) {
+  std::cerr << "usage: " << prog << " [options]\n"
+            << "  -p, --port PORT        port to listen on (default 12345)\n"
+            << "  -t, --threads N        number of event loop threads (default: cores)\n"
+            << "  -q, --queue-size N     accepted clients queued per loop before\n"
+            << "                         answering 503, a power of two (default 1024)\n"
+            << "  -m, --cache-size BYTES cache memory budget, K/M/G suffixes allowed\n"
+            << "                         (default 256M)\n"
+            << "  -o, --max-object-ratio R\n"
+            << "                         largest fraction of the cache budget one\n"
+            << "                         response may use (default 0.0625)\n"
+            << "  -d, --disk-dir DIR     keep responses evicted from memory in segment\n"
+            << "                         files under DIR (default: memory only)\n"
+            << "  -S, --disk-size BYTES  disk cache budget, K/M/G suffixes allowed\n"
+            << "                         (default 4G)\n"
+            << "  -P, --snapshot PATH    save the memory cache to PATH periodically and\n"
+            << "                         on SIGTERM, and restore it from there at start\n"
+            << "      --snapshot-interval S\n"
+            << "                         seconds between two snapshots (default 300)\n"
+            << "      --ignore-query-param NAME[,NAME...]\n"
+            << "                         leave these query parameters out of cache keys,\n"
+            << "                         may be repeated (default: none)\n"
+            << "  -z, --compress-level N store cacheable text gzipped at zlib level N\n"
+            << "                         (1-9), serving it as is to clients accepting\n"
+            << "                         gzip (default 0, off)\n"
+            << "      --compress-types TYPE[,TYPE...]\n"
+            << "                         media types compressed, type/* for all of a\n"
+            << "                         type (default " DEFAULT_COMPRESS_TYPES ")\n"
+            << "      --range-prefetch   fetch the whole response in the background\n"
+            << "                         when a range request misses (default off)\n"
+            << "  -g, --stale-grace S    serve expired responses up to S seconds past\n"
+            << "                         expiry while revalidating them in the\n"
+            << "                         background, unless they carry their own\n"
+            << "                         stale-while-revalidate (default 0)\n"
+            << "  -T, --tunnel-timeout S close CONNECT tunnels idle for S seconds\n"
+            << "                         (default 300)\n"
+            << "  -c, --connect-timeout S\n"
+            << "                         give up connecting to an origin after S seconds\n"
+            << "                         (default 10)\n"
+            << "  -u, --upstream-timeout S\n"
+            << "                         answer 504 when the origin stays silent S seconds\n"
+            << "                         while a request is sent or its response read\n"
+            << "                         (default 60)\n"
+            << "  -w, --fetch-wait S     seconds a request waits for a concurrent request\n"
+            << "                         fetching the same response before asking the\n"
+            << "                         origin itself (default 15)\n"
+            << "  -k, --client-timeout S close client connections waiting S seconds\n"
+            << "                         for a request (default 15)\n"
+            << "  -b, --max-body BYTES   answer 413 to requests with a longer body, K/M/G\n"
+            << "                         suffixes allowed (default 64M)\n"
+            << "  -U, --upstream-per-host N\n"
+            << "                         idle origin connections kept per host and\n"
+            << "                         loop for reuse (default 8)\n"
+            << "  -I, --upstream-idle-timeout S\n"
+            << "                         close idle origin connections after S seconds\n"
+            << "                         (default 30)\n"
+            << "  -D, --dns-server IP[:PORT]\n"
+            << "                         query this dns server directly and cache\n"
+            << "                         answers for their ttl (default: system resolver)\n"
+            << "  -H, --hosts-file PATH  names looked up here before asking dns\n"
+            << "      --dns-ttl S        cache system resolver answers and hosts file\n"
+            << "                         entries for S seconds (default 60)\n"
+            << "      --dns-negative-ttl S\n"
+            << "                         remember failed lookups for at most S seconds\n"
+            << "                         (default 10)\n"
+            << "  -s, --stats-interval S seconds between statistics log lines (default 60)\n"
+            << "  -l, --log-level LEVEL  debug, info, warning or error (default info)\n"
+            << "  -f, --foreground       do not daemonize\n"
+            << "  -h, --help             show this message\n";
+}
+
+// parse a strictly positive integer option, throws on malformed input
+static long positiveArg(const char * name, const char * value) {
+  char * end = NULL;
+  long parsed = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || parsed <= 0) {
+    throw std::invalid_argument(std::string("invalid value for ") + name + ": " + value);
+  }
+  return parsed;
+}
+
+// parse an integer option that may be 0
+static long nonNegativeArg(const char * name, const char * value) {
+  char * end = NULL;
+  long parsed = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || parsed < 0) {
+    throw std::invalid_argument(std::string("invalid value for ") + name + ": " + value);
+  }
+  return parsed;
+}
+
+// parse a byte count with an optional K, M or G suffix
+static size_t sizeArg(const char * name, const char * value) {
+  char * end = NULL;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if (end != value && *end != '\0' && *(end + 1) == '\0') {
+    switch (*end) {
+      case 'k': case 'K': parsed <<= 10; ++end; break;
+      case 'm': case 'M': parsed <<= 20; ++end; break;
+      case 'g': case 'G': parsed <<= 30; ++end; break;
+    }
+  }
+  if (end == value || *end != '\0' || parsed == 0) {
+    throw std::invalid_argument(std::string("invalid value for ") + name + ": " + value);
+  }
+  return (size_t)parsed;
+}
+
+// parse a fraction in (0, 1]
+static double ratioArg(const char * name, const char * value) {
+  char * end = NULL;
+  double parsed = strtod(value, &end);
+  if (end == value || *end != '\0' || !(parsed > 0 && parsed <= 1)) {
+    throw std::invalid_argument(std::string("invalid value for ") + name + ": " + value);
+  }
+  return parsed;
+}
+
+ProxyConfig parseConfig(int argc, char ** argv) {
+  ProxyConfig config;
+  static const struct option long_options[] = {
+    {"port", required_argument, NULL, 'p'},
+    {"threads", required_argument, NULL, 't'},
+    {"queue-size", required_argument, NULL, 'q'},
+    {"cache-size", required_argument, NULL, 'm'},
+    {"max-object-ratio", required_argument, NULL, 'o'},
+    {"disk-dir", required_argument, NULL, 'd'},
+    {"disk-size", required_argument, NULL, 'S'},
+    {"snapshot", required_argument, NULL, 'P'},
+    {"snapshot-interval", required_argument, NULL, OPT_SNAPSHOT_INTERVAL},
+    {"ignore-query-param", required_argument, NULL, OPT_IGNORE_QUERY_PARAM},
+    {"compress-level", required_argument, NULL, 'z'},
+    {"compress-types", required_argument, NULL, OPT_COMPRESS_TYPES},
+    {"range-prefetch", no_argument, NULL, OPT_RANGE_PREFETCH},
+    {"stale-grace", required_argument, NULL, 'g'},
+    {"tunnel-timeout", required_argument, NULL, 'T'},
+    {"connect-timeout", required_argument, NULL, 'c'},
+    {"upstream-timeout", required_argument, NULL, 'u'},
+    {"fetch-wait", required_argument, NULL, 'w'},
+    {"client-timeout", required_argument, NULL, 'k'},
+    {"max-body", required_argument, NULL, 'b'},
+    {"upstream-per-host", required_argument, NULL, 'U'},
+    {"upstream-idle-timeout", required_argument, NULL, 'I'},
+    {"dns-server", required_argument, NULL, 'D'},
+    {"hosts-file", required_argument, NULL, 'H'},
+    {"dns-ttl", required_argument, NULL, OPT_DNS_TTL},
+    {"dns-negative-ttl", required_argument, NULL, OPT_DNS_NEGATIVE_TTL},
+    {"stats-interval", required_argument, NULL, 's'},
+    {"log-level", required_argument, NULL, 'l'},
+    {"foreground", no_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  try {
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:t:q:m:o:d:S:P:z:g:T:c:u:w:k:b:U:I:D:H:s:l:fh", long_options, NULL)) != -1) {
+      switch (opt) {
+        case 'p':
+          positiveArg("--port", optarg);
+          config.port = optarg;
+          break;
+        case 't':
+          config.loop_threads = (int)positiveArg("--threads", optarg);
+          break;
+        case 'q': {
+          // the queue is a ring indexed by mask, any other size would be rounded up
+          long size = positiveArg("--queue-size", optarg);
+          if (size < 2 || (size & (size - 1)) != 0) {
+            throw std::invalid_argument(std::string("--queue-size must be a power of two >= 2: ") + optarg);
+          }
+          config.queue_size = size;
+          break;
+        }
+        case 'm':
+          config.cache_bytes = sizeArg("--cache-size", optarg);
+          break;
+        case 'o':
+          config.cache_object_ratio = ratioArg("--max-object-ratio", optarg);
+          break;
+        case 'd': {
+          // the daemon changes to / before the directory is used
+          char * dir = realpath(optarg, NULL);
+          if (dir == NULL || access(dir, R_OK | W_OK | X_OK) != 0) {
+            free(dir);
+            throw std::invalid_argument(std::string("cannot use disk cache directory: ") + optarg);
+          }
+          config.disk_dir = dir;
+          free(dir);
+          break;
+        }
+        case 'S':
+          config.disk_bytes = sizeArg("--disk-size", optarg);
+          break;
+        case 'P': {
+          // the daemon changes to / before the file is used
+          std::string path = optarg;
+          if (path.empty()) {
+            throw std::invalid_argument("invalid value for --snapshot: empty path");
+          }
+          if (path[0] != '/') {
+            char * cwd = getcwd(NULL, 0);
+            path = std::string(cwd ? cwd : "") + "/" + path;
+            free(cwd);
+          }
+          config.snapshot_path = path;
+          break;
+        }
+        case OPT_SNAPSHOT_INTERVAL:
+          config.snapshot_interval = (int)positiveArg("--snapshot-interval", optarg);
+          break;
+        case OPT_IGNORE_QUERY_PARAM: {
+          std::vector<std::string> names = listArg("--ignore-query-param", optarg);
+          config.ignored_query_params.insert(config.ignored_query_params.end(), names.begin(), names.end());
+          break;
+        }
+        case 'z':
+          config.compress_level = (int)nonNegativeArg("--compress-level", optarg);
+          if (config.compress_level > 9) {
+            throw std::invalid_argument(std::string("invalid value for --compress-level: ") + optarg);
+          }
+          break;
+        case OPT_COMPRESS_TYPES:
+          config.compress_types = listArg("--compress-types", optarg);
+          break;
+        case OPT_RANGE_PREFETCH:
+          config.range_prefetch = true;
+          break;
+        case 'g':
+          config.stale_grace = (int)nonNegativeArg("--stale-grace", optarg);
+          break;
+        case 'T':
+          config.tunnel_timeout = (int)positiveArg("--tunnel-timeout", optarg);
+          break;
+        case 'c':
+          config.connect_timeout = (int)positiveArg("--connect-timeout", optarg);
+          break;
+        case 'u':
+          config.upstream_timeout = (int)positiveArg("--upstream-timeout", optarg);
+          break;
+        case 'w':
+          config.fetch_wait = (int)positiveArg("--fetch-wait", optarg);
+          break;
+        case 'k':
+          config.client_timeout = (int)positiveArg("--client-timeout", optarg);
+          break;
+        case 'b':
+          config.max_body = sizeArg("--max-body", optarg);
+          break;
+        case 'U':
+          config.upstream_per_host = positiveArg("--upstream-per-host", optarg);
+          break;
+        case 'I':
+          config.upstream_idle_timeout = (int)positiveArg("--upstream-idle-timeout", optarg);
+          break;
+        case 'D': {
+          struct sockaddr_storage addr;
+          socklen_t len;
+          if (!parseDnsServer(optarg, addr, len)) {
+            throw std::invalid_argument(std::string("invalid value for --dns-server: ") + optarg);
+          }
+          config.dns_server = optarg;
+          break;
+        }
+        case 'H': {
+          // the daemon changes to / before the file is used
+          char * path = realpath(optarg, NULL);
+          if (path == NULL || access(path, R_OK) != 0) {
+            free(path);
+            throw std::invalid_argument(std::string("cannot read hosts file: ") + optarg);
+          }
+          config.hosts_file = path;
+          free(path);
+          break;
+        }
+        case OPT_DNS_TTL:
+          config.dns_ttl = (int)positiveArg("--dns-ttl", optarg);
+          break;
+        case OPT_DNS_NEGATIVE_TTL:
+          config.dns_negative_ttl = (int)positiveArg("--dns-negative-ttl", optarg);
+          break;
+        case 's':
+          config.stats_interval = (int)positiveArg("--stats-interval", optarg);
+          break;
+        case 'l':
+          config.log_level = parse_log_level(optarg);
+          break;
+        case 'f':
+          config.foreground = true;
+          break;
+        case 'h':
+          usage(argv[0]);
+          exit(EXIT_SUCCESS);
+        default:
+          usage(argv[0]);
+          exit(EXIT_FAILURE);
+      }
+    }
+  } catch (const std::invalid_argument & e) {
+    std::cerr << e.what() << std::endl;
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  return config;
+}
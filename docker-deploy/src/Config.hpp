@@ -0,0 +1,109 @@
+#ifndef __CONFIG_HPP_
+#define __CONFIG_HPP_
+
+#include <string>
+#include <vector>
+#include "Logger.hpp"
+
+/**
+ * Runtime settings of the proxy, filled in from the command line
+ */
+struct ProxyConfig {
+  // port the proxy listens on
+  std::string port;
+
+  // number of event loop threads serving connections
+  int loop_threads;
+
+  // capacity of each loop's queue of accepted clients, clients arriving while
+  //  every queue is full are answered with 503. A power of two, so it is
+  //  exactly the capacity of the ring
+  size_t queue_size;
+
+  // byte budget of the in-memory cache, and the largest share of it a single
+  //  response may take before it bypasses the cache
+  size_t cache_bytes;
+  double cache_object_ratio;
+
+  // directory of the disk cache tier behind memory, empty for none, and the
+  //  bytes of segment files it may hold
+  std::string disk_dir;
+  size_t disk_bytes;
+
+  // file the memory cache is saved to and restored from at start, empty for
+  //  none, and seconds between two saves. It is also saved on SIGTERM
+  std::string snapshot_path;
+  int snapshot_interval;
+
+  // query parameters left out of cache keys, so urls differing only in them
+  //  share one cached response
+  std::vector<std::string> ignored_query_params;
+
+  // zlib level (1 to 9) cacheable responses of the compress_types media types
+  //  are stored gzipped at, 0 to store them as received
+  int compress_level;
+  std::vector<std::string> compress_types;
+
+  // range requests that miss also have the whole response fetched in the
+  //  background, so later ranges of it are served from the cache
+  bool range_prefetch;
+
+  // seconds a CONNECT tunnel may stay silent in both directions before it is
+  //  closed
+  int tunnel_timeout;
+
+  // seconds past expiry a cached response without a stale-while-revalidate
+  //  directive of its own is still served while it is revalidated in the
+  //  background, 0 to always revalidate before answering
+  int stale_grace;
+
+  // seconds to connect to an origin, racing over all of its addresses
+  int connect_timeout;
+
+  // seconds the origin may stay silent while the request is sent to it or its
+  //  response is read before the client is answered 504
+  int upstream_timeout;
+
+  // seconds a request waits for a concurrent fetch of the same response
+  //  before it asks the origin itself
+  int fetch_wait;
+
+  // seconds a client connection may wait for its next request
+  int client_timeout;
+
+  // largest request body accepted, longer ones are answered 413 before
+  //  any of it is buffered
+  size_t max_body;
+
+  // idle connections kept per origin server, and seconds one may stay idle
+  //  before it is closed
+  size_t upstream_per_host;
+  int upstream_idle_timeout;
+
+  // dns server (IP[:PORT]) asked for origin addresses and their ttls, empty
+  //  to use the system resolver instead
+  std::string dns_server;
+  // hosts file consulted before any dns lookup, empty for none
+  std::string hosts_file;
+  // seconds answers without a ttl of their own are cached, and the most
+  //  seconds a failed lookup is remembered
+  int dns_ttl;
+  int dns_negative_ttl;
+
+  // seconds between two statistics lines in the log
+  int stats_interval;
+
+  // lines below this level are not logged, debug adds message payloads
+  LogLevel log_level;
+
+  // stay attached to the terminal instead of daemonizing
+  bool foreground;
+
+  ProxyConfig();
+};
+
+// parse command line arguments into a ProxyConfig, prints usage and exits on
+//  invalid arguments
+ProxyConfig parseConfig(int argc, char ** argv);
+
+#endif
@@ -0,0 +1,967 @@
+#include "Connection.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "ByteRanges.hpp"
+#include "Config.hpp"
+#include "HttpParser.hpp"
+#include "Revalidator.hpp"
+#include "UpstreamPool.hpp"
+#include "Util.hpp"
+
+#define TCP_MAX_SIZE 65535
+#define READ_CHUNK_SIZE 16384
+// response bytes read ahead of the client before reading from the origin pauses
+#define STREAM_BUFFER_SIZE 262144
+// most bytes moved by one splice() call, the default pipe capacity
+#define TUNNEL_PIPE_SIZE 65536
+
+const char * SUCCESS_MSG = "HTTP/1.1 200 OK\r\n\r\n";
+
+Connection::Connection(EventLoop * loop, Cache * cache, int client_fd) :
+    loop(loop), cache(cache), state(READ_REQUEST), connector(NULL), server_ready(false), server_reused(false),
+    server_surplus(false), responded(false), persistent(false),
+    request_len(0), revalidating(false), leading(false), reply_off(0), reply_end(0), last_active(monotonicSeconds()),
+    request_time(0), response_time(0), header_done(false), server_eof(false), cacheable(false), client_out_off(0), server_out_off(0) {
+    client.fd = client_fd;
+    client.handler = this;
+    server.handler = this;
+}
+
+Connection::~Connection() {
+    endFetch(CacheEntry::Ptr());
+    closeRelay(upstream);
+    closeRelay(downstream);
+    closeServer();
+    if (client.fd != -1) {
+        close(client.fd);
+    }
+}
+
+void Connection::start() {
+    ip_addr = getIpAddr(client.fd);
+    loop->watch(&client, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+    loop->track(this);
+    drive();
+}
+
+void Connection::onEvent(int fd, uint32_t events) {
+    if (state == CLOSED) {
+        return;
+    }
+    last_active = monotonicSeconds();
+    // a stale event of an upstream socket closed in this batch comes with
+    //  fd -1, and server.fd is -1 too while a connector is still connecting
+    if (fd != -1 && fd == server.fd && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        server_ready = true;
+    }
+    drive();
+}
+
+/* run the state machine until it blocks on I/O or the connection is closed */
+void Connection::drive() {
+    while (state != CLOSED) {
+        bool progress = false;
+        try {
+            switch (state) {
+                case READ_REQUEST:
+                    progress = readRequest();
+                    break;
+                case AWAIT_FETCH:
+                    // onFetched() continues once the leading request is done
+                case RESOLVING:
+                    // onResolved() continues once the answer arrives
+                    break;
+                case CONNECTING:
+                    progress = finishConnect();
+                    break;
+                case FORWARD_REQUEST:
+                    progress = forwardRequest();
+                    break;
+                case READ_RESPONSE:
+                    progress = readResponse();
+                    break;
+                case WRITE_RESPONSE:
+                    progress = writeResponse();
+                    break;
+                case TUNNEL:
+                    progress = relayTunnel();
+                    break;
+                case CLOSED:
+                    break;
+            }
+        } catch (const std::exception & e) {
+            if (retryUpstream()) {
+                continue;
+            }
+            log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+            fail(502);
+            continue;
+        }
+
+        if (!progress) {
+            return;
+        }
+    }
+
+    finish();
+}
+
+/* report error_code to the client if nothing was sent yet, else just close */
+void Connection::fail(int error_code) {
+    endFetch(CacheEntry::Ptr());
+    closeServer();
+    if (responded || state == WRITE_RESPONSE || state == TUNNEL) {
+        state = CLOSED;
+        return;
+    }
+
+    std::string msg = error_response(error_code);
+    client_out.assign(msg.begin(), msg.end());
+    client_out_off = 0;
+    // error responses carry no length, closing ends them
+    persistent = false;
+    state = WRITE_RESPONSE;
+}
+
+void Connection::onTimer(time_t now) {
+    if (state == TUNNEL && now - last_active >= loop->getConfig().tunnel_timeout) {
+        log_info("Tunnel idle for " + std::to_string(now - last_active) + "s, closing");
+        state = CLOSED;
+        finish();
+    } else if (state == READ_REQUEST && now - last_active >= loop->getConfig().client_timeout) {
+        // clients waiting between requests, or never sending one, are let go
+        state = CLOSED;
+        finish();
+    } else if ((state == FORWARD_REQUEST || state == READ_RESPONSE) &&
+               now - last_active >= loop->getConfig().upstream_timeout) {
+        // also ends a fetch we lead, its followers go on without us
+        log_message(LOG_LEVEL_WARNING, "WARNING " + meta->getHost() + " silent for " +
+                                           std::to_string(now - last_active) + "s, giving up");
+        fail(504);
+        drive();
+    } else if (state == AWAIT_FETCH && now - last_active >= loop->getConfig().fetch_wait) {
+        log_info("concurrent request still not answered after " + std::to_string(now - last_active) +
+                 "s, asking the origin");
+        following->cancel();
+        following.reset();
+        // the origin gets its own upstream_timeout
+        last_active = now;
+        try {
+            fetch();
+        } catch (const std::exception & e) {
+            log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+            fail(502);
+        }
+        drive();
+    }
+}
+
+/* the response was written, keep the connection open for the next request,
+ * whatever the client sent past the current request is parsed next */
+void Connection::nextRequest() {
+    client_in.erase(client_in.begin(), client_in.begin() + request_len);
+    request_parser.reset();
+    meta.reset();
+    request_len = 0;
+    revalidating = false;
+    cached.reset();
+    response.reset();
+    framer = ResponseFramer();
+    header_done = false;
+    server_eof = false;
+    cacheable = false;
+    std::vector<char>().swap(fill);
+    server_in.clear();
+    server_out.clear();
+    server_out_off = 0;
+    server_ready = false;
+    server_reused = false;
+    server_surplus = false;
+    retry_request.clear();
+    responded = false;
+    persistent = false;
+    state = READ_REQUEST;
+}
+
+void Connection::finish() {
+    if (upstream.read_fd != -1) {
+        log_info("Tunnel closed, relayed " + std::to_string(upstream.relayed) + " bytes to " +
+                 meta->getHost() + " and " + std::to_string(downstream.relayed) + " bytes back");
+    }
+    closeRelay(upstream);
+    closeRelay(downstream);
+    loop->untrack(this);
+    endFetch(CacheEntry::Ptr());
+    closeServer();
+    if (client.fd != -1) {
+        loop->unwatch(&client);
+        close(client.fd);
+        client.fd = -1;
+    }
+    loop->retire(this);
+}
+
+void Connection::closeServer() {
+    if (following) {
+        following->cancel();
+        following.reset();
+    }
+    if (lookup) {
+        lookup->cancel();
+        lookup.reset();
+    }
+    if (connector != NULL) {
+        connector->cancel();
+        connector = NULL;
+    }
+    if (server.fd != -1) {
+        loop->unwatch(&server);
+        close(server.fd);
+        server.fd = -1;
+    }
+}
+
+/* the response was read completely, keep the connection for the next request
+ * to the same origin if the origin agrees. A request forwarded with
+ * "Connection: close" makes the origin close it after answering, even when
+ * the response says nothing about it */
+void Connection::releaseServer() {
+    if (server.fd == -1) {
+        return;
+    }
+    if (server_eof || server_surplus || !response->isPersistent() || !meta->isPersistent()) {
+        closeServer();
+        return;
+    }
+    loop->unwatch(&server);
+    loop->getPool().release(upstreamKey(), server.fd);
+    server.fd = -1;
+}
+
+bool Connection::readRequest() {
+    bool eof = readAvailable(client.fd, client_in, 0);
+
+    if (!meta) {
+        RequestParser::Status status;
+        try {
+            // resumes after the bytes looked at by previous reads
+            status = request_parser.parse(client_in.data(), client_in.size());
+            if (status == RequestParser::COMPLETE) {
+                meta.reset(new RequestMeta(request_parser.toMeta(client_in.data())));
+                // empty lines sent before the request line are not forwarded
+                size_t skipped = request_parser.getRequestOffset();
+                client_in.erase(client_in.begin(), client_in.begin() + skipped);
+                request_len = request_parser.getHeaderLength() - skipped + meta->getContentLength();
+            }
+        } catch (const std::exception & e) {
+            log_message(LOG_LEVEL_ERROR, "ERROR invalid client request: " + std::string(e.what()));
+            fail(400);
+            return true;
+        }
+
+        if (status == RequestParser::INCOMPLETE) {
+            if (eof && client_in.empty()) {
+                // client went away without sending anything
+                state = CLOSED;
+                return true;
+            }
+            if (eof || client_in.size() > TCP_MAX_SIZE) {
+                log_message(LOG_LEVEL_ERROR, "ERROR failed to receive client request");
+                fail(400);
+                return true;
+            }
+            return false;
+        }
+        // the body is buffered whole before it is forwarded
+        if (meta->getContentLength() > loop->getConfig().max_body) {
+            log_message(LOG_LEVEL_ERROR, "ERROR request body of " +
+                                             std::to_string(meta->getContentLength()) +
+                                             " bytes is over --max-body");
+            fail(413);
+            return true;
+        }
+    }
+
+    if (client_in.size() < request_len) {
+        if (eof) {
+            log_message(LOG_LEVEL_ERROR, "ERROR client closed before sending the full request body");
+            fail(400);
+            return true;
+        }
+        return false;
+    }
+
+    log_info("\"" + meta->getFirstLine() + "\" from " + ip_addr + " @ " + getTimeAsString());
+    dispatch();
+    return true;
+}
+
+void Connection::dispatch() {
+    RequestType r_type = meta->getRequestType();
+    if (r_type == CONNECT) {
+        // bytes the client sent past the CONNECT request belong to the tunnel
+        server_out.assign(client_in.begin() + request_len, client_in.end());
+        connectUpstream();
+    } else if (r_type == GET) {
+        handleGet();
+    } else if (r_type == POST) {
+        server_out.assign(client_in.begin(), client_in.begin() + request_len);
+        connectUpstream();
+    } else {
+        throw std::invalid_argument("Unsupported http request type");
+    }
+}
+
+/* receive GET request from client, check if it is in the cache. If in the cache
+ * check its revalidation and freshness. If not, forward the request to the
+ * server, unless a request for the same key is already on its way there */
+void Connection::handleGet() {
+    cached = cache->lookup(*meta, key);
+    if (!cached) {
+        log_info("not in cache");
+    } else if (cached->getHeader().isNoCache()) {
+        log_info("cached, but requires re-validation");
+    } else if (cached->getFreshness().isFresh(monotonicMillis())) {
+        log_info("in cache, valid");
+        respond(cached);
+        return;
+    } else if (cached->getFreshness().isStaleUsable(monotonicMillis())) {
+        log_info("in cache, stale, revalidating in the background");
+        revalidateLater();
+        respond(cached);
+        return;
+    }
+
+    if (!joinFetch()) {
+        if (!cached && meta->getField("Range").first) {
+            prefetchLater();
+        }
+        fetch();
+    }
+}
+
+/* have the revalidator refresh our stale copy, unless a fetch of key is
+ * already in progress */
+void Connection::revalidateLater() {
+    if (!cache->getFetches().lead(key)) {
+        return;
+    }
+    loop->getRevalidator().submit(key, cached, *meta, cache->revalidate(cached->getHeader(), *meta));
+}
+
+/* a range miss goes to the origin as it is, and its partial answer cannot be
+ * shared with the requests waiting on us. Hand the lead over to a background
+ * fetch of the whole response, or give it up */
+void Connection::prefetchLater() {
+    leading = false;
+    if (!loop->getConfig().range_prefetch) {
+        cache->getFetches().end(key, CacheEntry::Ptr());
+        return;
+    }
+    static const char * const partial_fields[] = {"Range", "If-Range", "If-Match", "If-None-Match",
+                                                  "If-Modified-Since", "If-Unmodified-Since", NULL};
+    loop->getRevalidator().prefetch(key, *meta, meta->headWithout(partial_fields) + "\r\n\r\n");
+}
+
+/* wait for a fetch of key already in progress, else lead it */
+bool Connection::joinFetch() {
+    following = cache->getFetches().join(key, loop,
+                                         [this](const CacheEntry::Ptr & entry) { onFetched(entry); });
+    if (!following) {
+        leading = true;
+        return false;
+    }
+    log_info("waiting for the response to a concurrent request");
+    state = AWAIT_FETCH;
+    return true;
+}
+
+void Connection::onFetched(const CacheEntry::Ptr & entry) {
+    following.reset();
+    if (state != AWAIT_FETCH) {
+        return;
+    }
+    last_active = monotonicSeconds();
+    try {
+        CacheEntry::Ptr shared = entry;
+        if (shared && shared->getHeader().has(ResponseMeta::VARY)) {
+            // the leader's variant is only ours if the cache picks it for us,
+            //  else we revalidate or fetch our own
+            cached = cache->lookup(*meta, key);
+            shared = cached == shared ? shared : CacheEntry::Ptr();
+        }
+        if (shared) {
+            log_info("served by a concurrent request");
+            respond(shared);
+        } else {
+            // the leader's response could not be shared, ask the origin ourselves
+            fetch();
+        }
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        fail(502);
+    }
+    drive();
+}
+
+/* the fetch this request leads is over, hand entry (empty if there is nothing
+ * to share) to the requests waiting for it */
+void Connection::endFetch(const CacheEntry::Ptr & entry) {
+    if (leading) {
+        leading = false;
+        cache->getFetches().end(key, entry);
+    }
+}
+
+/* forward the request to the origin, or ask it whether our stale copy is
+ * still valid */
+void Connection::fetch() {
+    request_time = time(NULL);
+    if (!cached) {
+        server_out.assign(client_in.begin(), client_in.begin() + request_len);
+        connectUpstream();
+        return;
+    }
+
+    revalidating = true;
+    std::string new_req = cache->revalidate(cached->getHeader(), *meta);
+    server_out.assign(new_req.begin(), new_req.end());
+    connectUpstream();
+}
+
+std::string Connection::upstreamKey() const {
+    return meta->getHost() + ":" + std::to_string(meta->getPort());
+}
+
+/* send the request on an idle pooled connection to the origin if there is
+ * one, else open a new connection. Tunnels always get their own */
+void Connection::connectUpstream() {
+    if (meta->getRequestType() != CONNECT) {
+        int fd = loop->getPool().acquire(upstreamKey());
+        if (fd != -1) {
+            server.fd = fd;
+            server_ready = true;
+            server_reused = true;
+            // kept in case the origin closed the connection meanwhile
+            retry_request = server_out;
+            loop->watch(&server, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+            state = CONNECTING;
+            return;
+        }
+    }
+    openUpstream();
+}
+
+/* a pooled connection failed before any response byte arrived: the origin
+ * closed it while we were sending, send the request again on a new one */
+bool Connection::retryUpstream() {
+    if (!server_reused || header_done || !server_in.empty() || meta->getRequestType() != GET ||
+        (state != FORWARD_REQUEST && state != READ_RESPONSE)) {
+        return false;
+    }
+
+    log_info("pooled connection to " + upstreamKey() + " was closed, reconnecting");
+    closeServer();
+    server_out.swap(retry_request);
+    server_out_off = 0;
+    try {
+        openUpstream();
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        fail(502);
+    }
+    return true;
+}
+
+/* look the origin up, cached names are connected to right away */
+void Connection::openUpstream() {
+    ResolveResult result;
+    lookup = loop->getResolver().resolve(meta->getHost(), loop,
+                                         [this](const ResolveResult & answer) { onResolved(answer); },
+                                         result);
+    if (lookup) {
+        state = RESOLVING;
+        return;
+    }
+    connectTo(result);
+}
+
+void Connection::onResolved(const ResolveResult & result) {
+    lookup.reset();
+    if (state != RESOLVING) {
+        return;
+    }
+    try {
+        connectTo(result);
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        fail(502);
+    }
+    drive();
+}
+
+void Connection::connectTo(const ResolveResult & result) {
+    if (result.error != 0) {
+        throw std::runtime_error("failed to resolve " + meta->getHost() + ": " + result.errorMessage());
+    }
+
+    connector = new Connector(loop, result.addresses, meta->getPort(),
+                              loop->getConfig().connect_timeout * 1000,
+                              [this](int fd, const struct sockaddr_storage & address, const std::string & error) {
+                                  onConnected(fd, address, error);
+                              });
+    try {
+        connector->start();
+    } catch (const std::exception & e) {
+        delete connector;
+        connector = NULL;
+        throw;
+    }
+    server_ready = false;
+    server_reused = false;
+    state = CONNECTING;
+}
+
+void Connection::onConnected(int fd, const struct sockaddr_storage & address, const std::string & error) {
+    connector = NULL;
+    if (fd == -1) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + error + " (" + meta->getHost() + ")");
+        fail(502);
+        drive();
+        return;
+    }
+
+    loop->getResolver().preferAddress(meta->getHost(), address);
+    server.fd = fd;
+    server_ready = true;
+    try {
+        loop->watch(&server, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        fail(502);
+    }
+    drive();
+}
+
+bool Connection::finishConnect() {
+    if (!server_ready) {
+        return false;
+    }
+
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(server.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1) {
+        err = errno;
+    }
+    if (err != 0) {
+        throw std::runtime_error("failed to establish connection with remote server: " +
+                                 std::string(strerror(err)));
+    }
+
+    if (meta->getRequestType() == CONNECT) {
+        // send success message back to client, then relay both directions
+        client_out.assign(SUCCESS_MSG, SUCCESS_MSG + strlen(SUCCESS_MSG));
+        openRelay(upstream);
+        openRelay(downstream);
+        state = TUNNEL;
+    } else {
+        state = FORWARD_REQUEST;
+    }
+    return true;
+}
+
+bool Connection::forwardRequest() {
+    if (!writePending(server.fd, server_out, server_out_off)) {
+        return false;
+    }
+    state = READ_RESPONSE;
+    return true;
+}
+
+/* stream the response to the client while it arrives: the header is
+ * collected first to decide whether the response is cached, then body bytes
+ * are forwarded as they come in, reading from the origin pauses while the
+ * client is behind */
+bool Connection::readResponse() {
+    bool progress = false;
+    while (!server_eof && !framer.done()) {
+        if (!writePending(client.fd, client_out, client_out_off)) {
+            return progress;
+        }
+
+        std::vector<char> & buf = header_done ? client_out : server_in;
+        size_t prev_size = buf.size();
+        server_eof = readAvailable(server.fd, buf, STREAM_BUFFER_SIZE);
+        if (buf.size() == prev_size && !server_eof) {
+            return progress;
+        }
+        progress = true;
+        if (buf.size() > prev_size && log_enabled(LOG_LEVEL_DEBUG)) {
+            log_debug("Received chunk:\n" + std::string(buf.begin() + prev_size, buf.end()));
+        }
+
+        if (header_done) {
+            forwardBody(prev_size);
+            continue;
+        }
+
+        std::pair<bool, size_t> ans = HttpParser::findEmptyLine(server_in);
+        if (ans.first) {
+            beginResponse(ans.second + 4);
+            if (state != READ_RESPONSE) {
+                return true;
+            }
+        } else if (server_in.size() >= STREAM_BUFFER_SIZE) {
+            throw std::runtime_error("response header too large");
+        }
+    }
+
+    if (!header_done) {
+        throw std::runtime_error("server closed before sending a full response header");
+    }
+    if (!framer.done() && !framer.finish()) {
+        throw std::runtime_error("server closed before sending the full response body");
+    }
+    log_info("Finished receving response");
+    releaseServer();
+
+    if (cacheable) {
+        endFetch(cache->put(cache->storeKey(*meta, response), std::move(fill), response, request_time,
+                            response_time));
+    }
+    state = WRITE_RESPONSE;
+    return true;
+}
+
+/* the response header is in, decide how the response is served */
+void Connection::beginResponse(size_t header_len) {
+    std::vector<char> header(server_in.begin(), server_in.begin() + header_len);
+    response = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(header));
+    response_time = time(NULL);
+
+    if (meta->getRequestType() == GET) {
+        if (revalidating) {
+            // if return 304, use the response in the cache, else store the response send by server.
+            if (response->getStatus() == 304) {
+                log_info("in cache, valid");
+                server_surplus = server_in.size() > header_len;
+                releaseServer();
+                // store the refreshed header so the entry is fresh again
+                CacheEntry::Ptr refreshed = cache->refresh(key, cached, *response, request_time, response_time);
+                endFetch(refreshed);
+                respond(refreshed);
+                return;
+            }
+            log_info("Responding \"" + response->getFirstLine() + "\"");
+        } else {
+            log_info("Received \"" + response->getFirstLine() + "\" from " + meta->getHost());
+        }
+
+        cacheable = cache->store_response(*response);
+        if (!cacheable) {
+            endFetch(CacheEntry::Ptr());
+            // a server error keeps the stale entry for the next attempt
+            if (revalidating && response->getStatus() < 500) {
+                cache->remove(key);
+            }
+        }
+    }
+
+    framer.begin(*response);
+    header_done = true;
+    // a body ended by closing the connection ends the client connection too
+    persistent = meta->isPersistent() && response->isPersistent() &&
+                 framer.getFraming() != ResponseFramer::UNTIL_CLOSE;
+
+    // the header and whatever body arrived with it go out first
+    client_out.swap(server_in);
+    client_out_off = 0;
+    if (cacheable) {
+        fill = header;
+    }
+    forwardBody(header_len);
+}
+
+/* client_out holds new response bytes from start onwards: cut them at the end
+ * of the message and tee their payload into the cache fill buffer. The client
+ * gets them as they came, chunked or not */
+void Connection::forwardBody(size_t start) {
+    size_t used = framer.consume(client_out.data() + start, client_out.size() - start, cacheable ? &fill : NULL);
+    if (start + used < client_out.size()) {
+        // the origin sent more than the message, its connection is unusable
+        server_surplus = true;
+    }
+    client_out.resize(start + used);
+
+    if (cacheable && fill.size() > cache->getMaxObjectBytes()) {
+        // too large to be cached anyway, stop collecting
+        cacheable = false;
+        std::vector<char>().swap(fill);
+        endFetch(CacheEntry::Ptr());
+    }
+}
+
+bool Connection::writeResponse() {
+    if (reply && reply->getFd() == -1) {
+        // whatever client_out holds goes out with the entry in one call
+        if (!writeWith(client.fd, client_out, client_out_off, reply->data(), reply_end, reply_off)) {
+            return false;
+        }
+        reply.reset();
+    }
+    if (!writePending(client.fd, client_out, client_out_off)) {
+        return false;
+    }
+    if (reply) {
+        if (!writeFile(client.fd, reply->getFd(), reply->getFileOffset(), reply_end, reply_off)) {
+            return false;
+        }
+        reply.reset();
+    }
+    if (persistent) {
+        nextRequest();
+    } else {
+        state = CLOSED;
+    }
+    return true;
+}
+
+bool Connection::relayTunnel() {
+    // the success message and anything the client sent along with the CONNECT
+    //  request go out first, through user space
+    bool flushed = writePending(server.fd, server_out, server_out_off);
+    flushed = writePending(client.fd, client_out, client_out_off) && flushed;
+    if (!flushed) {
+        return false;
+    }
+
+    bool progress = splice(client.fd, server.fd, upstream);
+    progress = splice(server.fd, client.fd, downstream) || progress;
+
+    // both sides hung up and everything they sent was delivered
+    if (upstream.shut && downstream.shut) {
+        state = CLOSED;
+        return true;
+    }
+    return progress;
+}
+
+/* move bytes from one socket to the other through relay's pipe until the
+ * sender runs dry or the receiver stops accepting, returns true if anything
+ * moved. Once the sender hung up and the pipe is drained, the receiver's
+ * write side is shut down so half-closed connections keep working */
+bool Connection::splice(int from, int to, Relay & relay) {
+    bool progress = false;
+    while (true) {
+        ssize_t in = 0;
+        if (!relay.eof && relay.buffered < TUNNEL_PIPE_SIZE) {
+            in = ::splice(from, NULL, relay.write_fd, NULL, TUNNEL_PIPE_SIZE - relay.buffered,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (in > 0) {
+                relay.buffered += in;
+            } else if (in == 0) {
+                relay.eof = true;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                throw std::runtime_error("tunnel failed to receive: " + getErrorMsg());
+            }
+        }
+
+        ssize_t out = 0;
+        if (relay.buffered > 0) {
+            out = ::splice(relay.read_fd, NULL, to, NULL, relay.buffered,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (out > 0) {
+                relay.buffered -= out;
+                relay.relayed += out;
+            } else if (out == -1 && errno != EAGAIN && errno != EINTR) {
+                throw std::runtime_error("tunnel failed to send: " + getErrorMsg());
+            }
+        }
+
+        if (in <= 0 && out <= 0) {
+            break;
+        }
+        progress = true;
+    }
+
+    if (relay.eof && relay.buffered == 0 && !relay.shut) {
+        shutdown(to, SHUT_WR);
+        relay.shut = true;
+        progress = true;
+    }
+    return progress;
+}
+
+void Connection::openRelay(Relay & relay) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        throw std::runtime_error("failed to create tunnel pipe: " + getErrorMsg());
+    }
+    relay.read_fd = fds[0];
+    relay.write_fd = fds[1];
+}
+
+void Connection::closeRelay(Relay & relay) {
+    if (relay.read_fd != -1) {
+        close(relay.read_fd);
+        close(relay.write_fd);
+        relay.read_fd = relay.write_fd = -1;
+    }
+}
+
+void Connection::respond(std::vector<char> & resp) {
+    client_out.swap(resp);
+    client_out_off = 0;
+    state = WRITE_RESPONSE;
+}
+
+/* answer from a cached response, or from the ranges of it the client asked
+ * for */
+void Connection::respond(const CacheEntry::Ptr & entry) {
+    persistent = meta->isPersistent() && entry->getHeader().isPersistent() &&
+                 ResponseFramer::framingOf(entry->getHeader()) != ResponseFramer::UNTIL_CLOSE;
+    reply = entry;
+    Compressor * compressor = cache->getCompressor();
+    if (compressor && Compressor::isDecodable(entry->getHeader()) && !Compressor::acceptsGzip(*meta)) {
+        // stored gzipped, the client cannot take it that way
+        std::vector<char> identity = compressor->decompress(entry->data(), entry->size(), entry->getHeader());
+        ResponseMeta::Ptr header = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(identity));
+        reply = std::make_shared<CacheEntry>(std::move(identity), header, entry->getFreshness());
+    }
+    reply_off = 0;
+    reply_end = reply->size();
+    client_out_off = 0;
+    state = WRITE_RESPONSE;
+    // ranges are never cut out of a body the proxy gzipped itself
+    if (!meta->getField("Range").first || Compressor::isTransformed(reply->getHeader())) {
+        return;
+    }
+
+    const char * terminator = "\r\n\r\n";
+    size_t body = std::search(reply->data(), reply->data() + reply->size(), terminator, terminator + 4) -
+                  reply->data() + 4;
+    uint64_t length = reply->size() - body;
+    std::vector<ByteRange> ranges;
+    ByteRanges::Outcome outcome = ByteRanges::select(*meta, reply->getHeader(), length, ranges);
+    if (outcome == ByteRanges::UNSATISFIABLE) {
+        log_info("range not satisfiable");
+        std::string head = ByteRanges::unsatisfiable(length);
+        client_out.assign(head.begin(), head.end());
+        reply.reset();
+    } else if (outcome == ByteRanges::PARTIAL && ranges.size() == 1) {
+        // the range is sent straight from the entry
+        std::string head = ByteRanges::partialHead(reply->getHeader(), ranges[0], length);
+        client_out.assign(head.begin(), head.end());
+        reply_off = body + ranges[0].first;
+        reply_end = body + ranges[0].last + 1;
+    } else if (outcome == ByteRanges::PARTIAL) {
+        std::vector<char> answer = ByteRanges::multipart(reply->getHeader(), reply->data() + body, length, ranges);
+        client_out.swap(answer);
+        reply.reset();
+    }
+}
+
+bool Connection::readAvailable(int fd, std::vector<char> & buf, size_t limit) {
+    char buffer[READ_CHUNK_SIZE];
+    while (limit == 0 || buf.size() < limit) {
+        ssize_t rcvd = recv(fd, buffer, sizeof(buffer), 0);
+        if (rcvd > 0) {
+            buf.insert(buf.end(), buffer, buffer + rcvd);
+        } else if (rcvd == 0) {
+            return true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        } else if (errno != EINTR) {
+            throw std::runtime_error("failed to receive: " + getErrorMsg());
+        }
+    }
+    return false;
+}
+
+bool Connection::writeBytes(int fd, const char * data, size_t len, size_t & off) {
+    while (off < len) {
+        ssize_t sent = send(fd, data + off, len - off, MSG_NOSIGNAL);
+        if (sent > 0) {
+            off += sent;
+            if (fd == client.fd) {
+                responded = true;
+            }
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        } else if (sent == -1 && errno != EINTR) {
+            throw std::runtime_error("Error failed to send message: " + getErrorMsg());
+        }
+    }
+    return true;
+}
+
+bool Connection::writeFile(int fd, int file_fd, off_t start, size_t len, size_t & off) {
+    while (off < len) {
+        off_t pos = start + off;
+        ssize_t sent = sendfile(fd, file_fd, &pos, len - off);
+        if (sent > 0) {
+            off += sent;
+            responded = true;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        } else if (sent == 0) {
+            throw std::runtime_error("cached response file ended early");
+        } else if (errno != EINTR) {
+            throw std::runtime_error("Error failed to send message: " + getErrorMsg());
+        }
+    }
+    return true;
+}
+
+bool Connection::writeWith(int fd, std::vector<char> & buf, size_t & buf_off, const char * data, size_t len,
+                           size_t & off) {
+    while (buf_off < buf.size() || off < len) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        if (buf_off < buf.size()) {
+            iov[msg.msg_iovlen].iov_base = buf.data() + buf_off;
+            iov[msg.msg_iovlen++].iov_len = buf.size() - buf_off;
+        }
+        if (off < len) {
+            iov[msg.msg_iovlen].iov_base = (void *)(data + off);
+            iov[msg.msg_iovlen++].iov_len = len - off;
+        }
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent > 0) {
+            size_t from_buf = std::min((size_t)sent, buf.size() - buf_off);
+            buf_off += from_buf;
+            off += sent - from_buf;
+            responded = true;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        } else if (sent == -1 && errno != EINTR) {
+            throw std::runtime_error("Error failed to send message: " + getErrorMsg());
+        }
+    }
+    buf.clear();
+    buf_off = 0;
+    return true;
+}
+
+bool Connection::writePending(int fd, std::vector<char> & buf, size_t & off) {
+    if (!writeBytes(fd, buf.data(), buf.size(), off)) {
+        return false;
+    }
+    buf.clear();
+    off = 0;
+    return true;
+}
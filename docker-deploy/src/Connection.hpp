@@ -0,0 +1,193 @@
+#ifndef __CONNECTION_HPP_
+#define __CONNECTION_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLoop.hpp"
+#include "Cache.hpp"
+#include "Connector.hpp"
+#include "RequestMeta.hpp"
+#include "RequestParser.hpp"
+#include "Resolver.hpp"
+#include "ResponseFramer.hpp"
+
+/**
+ * One client connection, driven by the EventLoop it was accepted on.
+ * The connection is a state machine: read the client request, resolve the
+ * origin's name without blocking the loop, connect to it (racing over all its
+ * addresses), forward the request and stream the response back to the client as
+ * it arrives (or relay a CONNECT tunnel in both directions with splice()).
+ * Concurrent misses of one cache key are collapsed: only the first goes to
+ * the origin, the others wait for its response.
+ * Persistent clients then go back to reading their next request; pipelined
+ * requests wait in the receive buffer and are answered in order.
+ * Sockets are non-blocking and edge-triggered, so every event simply re-runs
+ * drive() until no state can make further progress.
+ */
+class Connection : public EventHandler {
+private:
+    enum State {
+        READ_REQUEST,
+        AWAIT_FETCH,
+        RESOLVING,
+        CONNECTING,
+        FORWARD_REQUEST,
+        READ_RESPONSE,
+        WRITE_RESPONSE,
+        TUNNEL,
+        CLOSED
+    };
+
+    EventLoop * loop;
+    Cache * cache;
+    State state;
+
+    Watch client;
+    Watch server;
+    std::string ip_addr;
+
+    // origin name lookup running on the resolver while RESOLVING
+    ResolveRequest::Ptr lookup;
+    // connection attempts racing over the origin's addresses while CONNECTING
+    Connector * connector;
+
+    // set once the non-blocking connect to the origin reports writable
+    bool server_ready;
+    // the origin connection came from the pool, request kept for a retry
+    bool server_reused;
+    std::vector<char> retry_request;
+    // the origin sent bytes past the end of the response
+    bool server_surplus;
+    // set once anything was written to the client, errors can then no longer
+    //  be reported with a status code
+    bool responded;
+    // keep the client connection for another request after this response
+    bool persistent;
+
+    RequestParser request_parser;
+    std::unique_ptr<RequestMeta> meta;
+    size_t request_len;
+
+    // set when the cached response is being revalidated with the origin
+    bool revalidating;
+    CacheEntry::Ptr cached;
+    // what the request was looked up under, the key of cached and of the fetch
+    CacheKey key;
+
+    // this request leads the fetch of its cache key, others wait for it
+    bool leading;
+    // another request's fetch of the same key is awaited while AWAIT_FETCH
+    FetchWait::Ptr following;
+
+    // cached response being written to the client, sent straight from the
+    //  shared entry after client_out is flushed. Bytes [reply_off, reply_end)
+    //  are left to send, a single range only covers part of the entry
+    CacheEntry::Ptr reply;
+    size_t reply_off;
+    size_t reply_end;
+
+    // one direction of a CONNECT tunnel, bytes move kernel to kernel from
+    //  the sending socket into the pipe and on to the receiving socket
+    struct Relay {
+        int read_fd;
+        int write_fd;
+        // bytes sitting in the pipe
+        size_t buffered;
+        // sender hung up
+        bool eof;
+        // our end of the receiver was shut down after eof
+        bool shut;
+        uint64_t relayed;
+
+        Relay() : read_fd(-1), write_fd(-1), buffered(0), eof(false), shut(false), relayed(0) {}
+    };
+    // client to server and server to client
+    Relay upstream;
+    Relay downstream;
+
+    // monotonic time of the last event on either socket
+    time_t last_active;
+
+    // header of the response coming from the origin, and the wall clock
+    //  times the request went out and the response came in
+    ResponseMeta::Ptr response;
+    time_t request_time;
+    time_t response_time;
+    // tracks where the streamed response ends
+    ResponseFramer framer;
+    bool header_done;
+    bool server_eof;
+    // set while the streamed response is also collected in fill for the cache
+    bool cacheable;
+    std::vector<char> fill;
+
+    std::vector<char> client_in;
+    std::vector<char> client_out;
+    size_t client_out_off;
+    std::vector<char> server_in;
+    std::vector<char> server_out;
+    size_t server_out_off;
+
+    void drive();
+    void fail(int error_code);
+    void finish();
+    void nextRequest();
+
+    bool readRequest();
+    bool finishConnect();
+    bool forwardRequest();
+    bool readResponse();
+    bool writeResponse();
+    bool relayTunnel();
+    bool splice(int from, int to, Relay & relay);
+    void openRelay(Relay & relay);
+    void closeRelay(Relay & relay);
+
+    void dispatch();
+    void handleGet();
+    void revalidateLater();
+    void prefetchLater();
+    bool joinFetch();
+    void onFetched(const CacheEntry::Ptr & entry);
+    void endFetch(const CacheEntry::Ptr & entry);
+    void fetch();
+    void connectUpstream();
+    void openUpstream();
+    void onResolved(const ResolveResult & result);
+    void connectTo(const ResolveResult & result);
+    void onConnected(int fd, const struct sockaddr_storage & address, const std::string & error);
+    bool retryUpstream();
+    std::string upstreamKey() const;
+    void respond(std::vector<char> & resp);
+    void respond(const CacheEntry::Ptr & entry);
+    void closeServer();
+    void releaseServer();
+    void beginResponse(size_t header_len);
+    void forwardBody(size_t start);
+
+    // read everything available on fd into buf, returns true on end of stream
+    static bool readAvailable(int fd, std::vector<char> & buf, size_t limit);
+    // write data from off onwards until the socket would block, returns true
+    //  once everything is written
+    bool writeBytes(int fd, const char * data, size_t len, size_t & off);
+    // same as writeBytes for len bytes at start in file_fd, sent without
+    //  passing through user space
+    bool writeFile(int fd, int file_fd, off_t start, size_t len, size_t & off);
+    // same as writeBytes, buf is cleared once fully written
+    bool writePending(int fd, std::vector<char> & buf, size_t & off);
+    // writePending for buf followed by writeBytes for data, both sent with one
+    //  vectored call while they fit the socket buffer
+    bool writeWith(int fd, std::vector<char> & buf, size_t & buf_off, const char * data, size_t len, size_t & off);
+
+public:
+    Connection(EventLoop * loop, Cache * cache, int client_fd);
+    ~Connection();
+
+    void start();
+    void onEvent(int fd, uint32_t events);
+    void onTimer(time_t now);
+};
+
+#endif
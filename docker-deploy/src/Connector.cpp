@@ -0,0 +1,192 @@
+#include "Connector.hpp"
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Util.hpp"
+
+static struct sockaddr_storage none() {
+    struct sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    return address;
+}
+
+Connector::Connector(EventLoop * loop, const std::vector<struct sockaddr_storage> & addresses,
+                     uint16_t port, int timeout_ms, Callback done) :
+    loop(loop), addresses(addresses), port(port), done(std::move(done)), next(0),
+    deadline(monotonicMillis() + timeout_ms), last_error("no address to connect to"), finished(false) {
+    timer.handler = this;
+}
+
+Connector::~Connector() {
+    for (size_t i = 0; i < attempts.size(); ++i) {
+        closeAttempt(*attempts[i]);
+    }
+    if (timer.fd != -1) {
+        loop->unwatch(&timer);
+        close(timer.fd);
+    }
+}
+
+void Connector::start() {
+    timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer.fd == -1) {
+        throw std::runtime_error("failed to create connect timer: " + getErrorMsg());
+    }
+    loop->watch(&timer, EPOLLIN);
+    launch();
+}
+
+/* start the next attempt that gets as far as connecting, addresses failing
+ * right away are skipped */
+void Connector::launch() {
+    int64_t now = monotonicMillis();
+    while (next < addresses.size()) {
+        struct sockaddr_storage addr = addresses[next++];
+        socklen_t addr_len;
+        if (addr.ss_family == AF_INET6) {
+            ((struct sockaddr_in6 *)&addr)->sin6_port = htons(port);
+            addr_len = sizeof(struct sockaddr_in6);
+        } else {
+            ((struct sockaddr_in *)&addr)->sin_port = htons(port);
+            addr_len = sizeof(struct sockaddr_in);
+        }
+
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            last_error = "failed to create socket: " + getErrorMsg();
+            continue;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, addr_len) == -1 && errno != EINPROGRESS) {
+            last_error = "failed to establish connection with remote server: " + getErrorMsg();
+            close(fd);
+            continue;
+        }
+
+        // a socket connected right away reports writable as soon as it is watched
+        std::unique_ptr<Attempt> attempt(new Attempt());
+        attempt->watch.fd = fd;
+        attempt->watch.handler = this;
+        attempt->address = addr;
+        attempts.push_back(std::move(attempt));
+        loop->watch(&attempts.back()->watch, EPOLLOUT | EPOLLRDHUP);
+        armTimer(std::min(now + CONNECT_ATTEMPT_DELAY_MS, deadline));
+        return;
+    }
+
+    // nothing left to start, give the running attempts until the deadline
+    bool running = false;
+    for (size_t i = 0; i < attempts.size() && !running; ++i) {
+        running = attempts[i]->watch.fd != -1;
+    }
+    armTimer(running ? deadline : now);
+}
+
+/* have the timer fire at monotonic millisecond at, right away if that passed */
+void Connector::armTimer(int64_t at) {
+    int64_t delay = at - monotonicMillis();
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (delay > 0) {
+        spec.it_value.tv_sec = delay / 1000;
+        spec.it_value.tv_nsec = (delay % 1000) * 1000000;
+    } else {
+        // a zero value would disarm the timer
+        spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(timer.fd, 0, &spec, NULL);
+}
+
+void Connector::onEvent(int fd, uint32_t events) {
+    // a stale event of an attempt closed in this batch comes with fd -1
+    if (finished || fd == -1) {
+        return;
+    }
+    if (fd == timer.fd) {
+        uint64_t expirations;
+        ssize_t rcvd = read(timer.fd, &expirations, sizeof(expirations));
+        (void)rcvd;
+        onTimeout();
+        return;
+    }
+    for (size_t i = 0; i < attempts.size(); ++i) {
+        if (attempts[i]->watch.fd == fd) {
+            onAttempt(*attempts[i]);
+            return;
+        }
+    }
+}
+
+void Connector::onTimeout() {
+    if (monotonicMillis() >= deadline) {
+        complete(-1, none(), "timed out connecting to remote server");
+        return;
+    }
+    if (next < addresses.size()) {
+        launch();
+        return;
+    }
+    for (size_t i = 0; i < attempts.size(); ++i) {
+        if (attempts[i]->watch.fd != -1) {
+            armTimer(deadline);
+            return;
+        }
+    }
+    complete(-1, none(), last_error);
+}
+
+void Connector::onAttempt(Attempt & attempt) {
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(attempt.watch.fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1) {
+        err = errno;
+    }
+    if (err == 0) {
+        int fd = attempt.watch.fd;
+        loop->unwatch(&attempt.watch);
+        attempt.watch.fd = -1;
+        complete(fd, attempt.address, "");
+        return;
+    }
+
+    // a failed attempt lets the next one start without waiting
+    last_error = "failed to establish connection with remote server: " + std::string(strerror(err));
+    closeAttempt(attempt);
+    launch();
+}
+
+void Connector::closeAttempt(Attempt & attempt) {
+    if (attempt.watch.fd != -1) {
+        loop->unwatch(&attempt.watch);
+        close(attempt.watch.fd);
+        attempt.watch.fd = -1;
+    }
+}
+
+void Connector::complete(int fd, const struct sockaddr_storage & address, const std::string & error) {
+    Callback callback;
+    callback.swap(done);
+    cancel();
+    callback(fd, address, error);
+}
+
+void Connector::cancel() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+    for (size_t i = 0; i < attempts.size(); ++i) {
+        closeAttempt(*attempts[i]);
+    }
+    loop->unwatch(&timer);
+    close(timer.fd);
+    timer.fd = -1;
+    // events of this batch may still refer to the attempts
+    loop->retire(this);
+}
@@ -0,0 +1,69 @@
+#ifndef __CONNECTOR_HPP_
+#define __CONNECTOR_HPP_
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventLoop.hpp"
+
+// a new connection attempt starts when the previous one took this long
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+/**
+ * Happy eyeballs (RFC 8305) connection to one of the addresses of a host.
+ * Attempts start in address order, a new one each CONNECT_ATTEMPT_DELAY_MS
+ * or as soon as the previous one fails, and all of them race until the first
+ * succeeds or the connect timeout passes. The handler deletes itself: after
+ * done was called or after cancel().
+ */
+class Connector : public EventHandler {
+public:
+    // the connected socket and its address, or -1 and why no address could
+    //  be reached
+    typedef std::function<void(int fd, const struct sockaddr_storage & address, const std::string & error)>
+        Callback;
+
+private:
+    struct Attempt {
+        Watch watch;
+        struct sockaddr_storage address;
+    };
+
+    EventLoop * loop;
+    std::vector<struct sockaddr_storage> addresses;
+    uint16_t port;
+    Callback done;
+
+    // fires for the next attempt and at the deadline
+    Watch timer;
+    std::vector<std::unique_ptr<Attempt> > attempts;
+    size_t next;
+    // monotonic milliseconds
+    int64_t deadline;
+    std::string last_error;
+    bool finished;
+
+    void launch();
+    void armTimer(int64_t at);
+    void onTimeout();
+    void onAttempt(Attempt & attempt);
+    void closeAttempt(Attempt & attempt);
+    void complete(int fd, const struct sockaddr_storage & address, const std::string & error);
+
+public:
+    Connector(EventLoop * loop, const std::vector<struct sockaddr_storage> & addresses,
+              uint16_t port, int timeout_ms, Callback done);
+    ~Connector();
+
+    void start();
+    // close every attempt, done is never called
+    void cancel();
+
+    void onEvent(int fd, uint32_t events);
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "DiskCache.hpp"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "Cache.hpp"
+
+#define SEGMENT_PREFIX "segment-"
+
+DiskSegment::DiskSegment(const std::string & path, size_t capacity) :
+    path(path), fd(-1), base(NULL), capacity(capacity) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        throw std::runtime_error("failed to create " + path + ": " + getErrorMsg());
+    }
+    // sparse, blocks are only allocated as records are appended
+    void * mapped = MAP_FAILED;
+    if (ftruncate(fd, capacity) == 0) {
+        mapped = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        std::string error = getErrorMsg();
+        close(fd);
+        ::unlink(path.c_str());
+        throw std::runtime_error("failed to map " + path + ": " + error);
+    }
+    base = (char *)mapped;
+}
+
+DiskSegment::DiskSegment(const std::string & path) : path(path), fd(-1), base(NULL), capacity(0) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error("failed to open " + path + ": " + getErrorMsg());
+    }
+    struct stat info;
+    memset(&info, 0, sizeof(info));
+    void * mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        capacity = info.st_size;
+        mapped = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (mapped == MAP_FAILED) {
+        std::string error = info.st_size == 0 ? "empty file" : getErrorMsg();
+        close(fd);
+        throw std::runtime_error("failed to map " + path + ": " + error);
+    }
+    base = (char *)mapped;
+}
+
+DiskSegment::~DiskSegment() {
+    munmap(base, capacity);
+    close(fd);
+}
+
+void DiskSegment::write(off_t offset, const char * data, size_t len) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error("failed to write " + path + ": " + getErrorMsg());
+        }
+        offset += written;
+        data += written;
+        len -= written;
+    }
+}
+
+void DiskSegment::unlink() {
+    ::unlink(path.c_str());
+}
+
+std::string DiskStats::toString() const {
+    std::stringstream ss;
+    ss << "segments=" << segments << " entries=" << entries << " bytes_used=" << bytes_used
+       << " hits=" << hits << " misses=" << misses << " stores=" << stores
+       << " promotions=" << promotions << " reclaimed=" << reclaimed;
+    return ss.str();
+}
+
+DiskCache::DiskCache(const std::string & dir, size_t capacity) :
+    dir(dir), max_segments(std::max(capacity / DISK_SEGMENT_BYTES, (size_t)2)), next_id(0),
+    bytes_used(0), reclaimed(0), hits(0), misses(0), stores(0), promotions(0) {
+    if (access(dir.c_str(), R_OK | W_OK | X_OK) != 0) {
+        throw std::runtime_error("cannot use cache directory " + dir + ": " + getErrorMsg());
+    }
+    removeStale();
+    pthread_mutex_init(&lock, NULL);
+}
+
+DiskCache::~DiskCache() {
+    for (size_t i = 0; i < segments.size(); ++i) {
+        segments[i].file->unlink();
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+std::string DiskCache::segmentPath(uint64_t id) const {
+    return dir + "/" SEGMENT_PREFIX + std::to_string(id);
+}
+
+/* segments of a previous run cannot be used without their index */
+void DiskCache::removeStale() {
+    DIR * listing = opendir(dir.c_str());
+    if (listing == NULL) {
+        return;
+    }
+    struct dirent * item;
+    while ((item = readdir(listing)) != NULL) {
+        if (strncmp(item->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) == 0) {
+            ::unlink((dir + "/" + item->d_name).c_str());
+        }
+    }
+    closedir(listing);
+}
+
+void DiskCache::roll() {
+    if (segments.size() >= max_segments) {
+        Slot & oldest = segments.front();
+        for (size_t i = 0; i < oldest.keys.size(); ++i) {
+            std::unordered_map<CacheKey, Location, CacheKeyHash>::iterator it = index.find(oldest.keys[i]);
+            if (it != index.end() && it->second.segment == oldest.id) {
+                index.erase(it);
+            }
+        }
+        oldest.file->unlink();
+        bytes_used -= oldest.used;
+        segments.pop_front();
+        reclaimed++;
+    }
+
+    Slot slot;
+    slot.id = next_id++;
+    slot.used = 0;
+    slot.file = std::make_shared<DiskSegment>(segmentPath(slot.id), DISK_SEGMENT_BYTES);
+    segments.push_back(slot);
+}
+
+void DiskCache::store(const CacheKey & key, const CacheEntry::Ptr & entry) {
+    size_t record = entry->size();
+    if (record > DISK_SEGMENT_BYTES) {
+        return;
+    }
+
+    // reserve room for the record, the bytes are written without the lock
+    DiskSegment::Ptr file;
+    Location loc;
+    pthread_mutex_lock(&lock);
+    if ((entry->isPersisted() && index.count(key) != 0) || pending.count(key) != 0) {
+        // unchanged since it was promoted from here, or being written already
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    try {
+        if (segments.empty() || segments.back().used + record > DISK_SEGMENT_BYTES) {
+            roll();
+        }
+    } catch (const std::exception & e) {
+        pthread_mutex_unlock(&lock);
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        return;
+    }
+    file = segments.back().file;
+    loc.segment = segments.back().id;
+    loc.offset = segments.back().used;
+    loc.length = entry->size();
+    loc.hits = 0;
+    loc.freshness = entry->getFreshness();
+    segments.back().used += record;
+    bytes_used += record;
+    pending[key] = true;
+    pthread_mutex_unlock(&lock);
+
+    bool written = true;
+    try {
+        file->write(loc.offset, entry->data(), entry->size());
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        written = false;
+    }
+
+    // publish unless the key was removed or the segment reclaimed meanwhile
+    pthread_mutex_lock(&lock);
+    std::unordered_map<CacheKey, bool, CacheKeyHash>::iterator it = pending.find(key);
+    if (written && it->second && loc.segment >= segments.front().id) {
+        index[key] = loc;
+        segments[loc.segment - segments.front().id].keys.push_back(key);
+        stores++;
+    }
+    pending.erase(it);
+    pthread_mutex_unlock(&lock);
+}
+
+CacheEntry::Ptr DiskCache::get(const CacheKey & key, bool & promote) {
+    DiskSegment::Ptr file;
+    Location loc;
+    pthread_mutex_lock(&lock);
+    std::unordered_map<CacheKey, Location, CacheKeyHash>::iterator it = index.find(key);
+    if (it != index.end()) {
+        loc = it->second;
+        file = segments[loc.segment - segments.front().id].file;
+        promote = ++it->second.hits >= DISK_PROMOTE_HITS;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!file) {
+        misses++;
+        return CacheEntry::Ptr();
+    }
+    hits++;
+    if (promote) {
+        promotions++;
+    }
+
+    // the header is parsed again on every disk hit, the index stays small
+    off_t start = loc.offset;
+    const char * resp = file->at(start);
+    const char * terminator = "\r\n\r\n";
+    const char * head_end = std::search(resp, resp + loc.length, terminator, terminator + 4);
+    size_t head_len = head_end == resp + loc.length ? loc.length : head_end - resp + 2;
+    ResponseMeta::Ptr header = std::make_shared<const ResponseMeta>(std::string(resp, head_len));
+    return std::make_shared<const CacheEntry>(file, start, loc.length, header, loc.freshness);
+}
+
+void DiskCache::remove(const CacheKey & key) {
+    pthread_mutex_lock(&lock);
+    index.erase(key);
+    std::unordered_map<CacheKey, bool, CacheKeyHash>::iterator it = pending.find(key);
+    if (it != pending.end()) {
+        it->second = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+DiskStats DiskCache::getStats() {
+    DiskStats stats;
+    pthread_mutex_lock(&lock);
+    stats.segments = segments.size();
+    stats.entries = index.size();
+    stats.bytes_used = bytes_used;
+    stats.reclaimed = reclaimed;
+    pthread_mutex_unlock(&lock);
+    stats.hits = hits.load();
+    stats.misses = misses.load();
+    stats.stores = stores.load();
+    stats.promotions = promotions.load();
+    return stats;
+}
@@ -0,0 +1,156 @@
+#ifndef __DISK_CACHE_HPP_
+#define __DISK_CACHE_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CacheKey.hpp"
+#include "Freshness.hpp"
+
+class CacheEntry;
+
+// size of one segment file, a record never spans two
+#define DISK_SEGMENT_BYTES (64UL << 20)
+#define DEFAULT_DISK_BYTES (4UL << 30)
+// disk hits after which an object is copied back into memory
+#define DISK_PROMOTE_HITS 2
+
+/**
+ * One append-only segment file of the disk tier, mapped shared into memory.
+ * Entries served from a segment hold a reference to it, so a reclaimed
+ * segment's file is unlinked right away but stays open and mapped until the
+ * last response read from it is sent.
+ */
+class DiskSegment {
+private:
+    std::string path;
+    int fd;
+    char * base;
+    size_t capacity;
+
+    DiskSegment(const DiskSegment &);
+    DiskSegment & operator=(const DiskSegment &);
+
+public:
+    typedef std::shared_ptr<DiskSegment> Ptr;
+
+    // create the file at path sized to capacity and map it, throws on failure
+    DiskSegment(const std::string & path, size_t capacity);
+    // map the existing file at path read-only, throws on failure
+    explicit DiskSegment(const std::string & path);
+    ~DiskSegment();
+
+    // write data[0, len) at offset
+    void write(off_t offset, const char * data, size_t len);
+    void unlink();
+
+    int getFd() const { return fd; }
+    size_t size() const { return capacity; }
+    const char * at(off_t offset) const { return base + offset; }
+};
+
+/**
+ * Counters of the disk tier
+ */
+struct DiskStats {
+    uint64_t segments;
+    uint64_t entries;
+    // bytes of records appended to segments that were not reclaimed yet,
+    //  including overwritten and removed ones
+    uint64_t bytes_used;
+    uint64_t hits;
+    uint64_t misses;
+    // objects written when they were evicted from memory
+    uint64_t stores;
+    // objects copied back into memory after DISK_PROMOTE_HITS hits
+    uint64_t promotions;
+    // segments dropped to make room, with every object still in them
+    uint64_t reclaimed;
+
+    DiskStats() : segments(0), entries(0), bytes_used(0), hits(0), misses(0), stores(0), promotions(0),
+                  reclaimed(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * Second cache tier on local disk, behind the in-memory Cache. Objects
+ * evicted from memory are appended as response bytes to the newest of a ring
+ * of memory-mapped segment files. A compact index maps each 128-bit key to
+ * the segment, offset and length of its record. When the ring is full, the
+ * oldest segment is reclaimed whole (FIFO), objects still hot are in memory
+ * again by then.
+ *
+ * Hits return entries pointing into the mapping, so they are parsed and sent
+ * (with sendfile) straight from the page cache without a copy into user
+ * space. Only objects hit DISK_PROMOTE_HITS times are copied back into memory.
+ * The index is not persisted, segment files of a previous run are removed.
+ */
+class DiskCache {
+private:
+    struct Location {
+        uint64_t segment;
+        uint64_t offset;
+        uint64_t length;
+        uint32_t hits;
+        Freshness freshness;
+    };
+
+    struct Slot {
+        uint64_t id;
+        DiskSegment::Ptr file;
+        size_t used;
+        // keys appended to this segment, dropped from the index when it goes
+        std::vector<CacheKey> keys;
+    };
+
+    std::string dir;
+    size_t max_segments;
+
+    pthread_mutex_t lock;
+    std::unordered_map<CacheKey, Location, CacheKeyHash> index;
+    // oldest segment first, records are appended to the last one
+    std::deque<Slot> segments;
+    uint64_t next_id;
+    // keys being written outside the lock, set to false if removed meanwhile
+    std::unordered_map<CacheKey, bool, CacheKeyHash> pending;
+    uint64_t bytes_used;
+    uint64_t reclaimed;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> stores;
+    std::atomic<uint64_t> promotions;
+
+    std::string segmentPath(uint64_t id) const;
+    void removeStale();
+    // start a new segment, reclaiming the oldest when the ring is full
+    void roll();
+
+    DiskCache(const DiskCache &);
+    DiskCache & operator=(const DiskCache &);
+
+public:
+    // keep at most capacity bytes of segments in dir, throws if dir is not
+    //  usable
+    DiskCache(const std::string & dir, size_t capacity);
+    ~DiskCache();
+
+    // write entry (not on disk yet unless it was promoted from here) under key
+    void store(const CacheKey & key, const std::shared_ptr<const CacheEntry> & entry);
+    // the entry stored under key, empty if there is none. promote is set when
+    //  the entry is hot enough to be copied back into memory
+    std::shared_ptr<const CacheEntry> get(const CacheKey & key, bool & promote);
+    void remove(const CacheKey & key);
+
+    DiskStats getStats();
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include "DnsClient.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_MAX_MESSAGE 512
+#define DNS_FLAG_RESPONSE 0x8000
+#define DNS_FLAG_TRUNCATED 0x0200
+#define DNS_FLAG_RECURSION 0x0100
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_A 1
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+
+namespace {
+
+/* what came back for one of the two queries */
+struct Reply {
+    bool received;
+    int rcode;
+    bool truncated;
+    int ttl;
+    int negative_ttl;
+    std::vector<struct sockaddr_storage> addresses;
+
+    Reply() : received(false), rcode(0), truncated(false), ttl(-1), negative_ttl(-1) {}
+};
+
+uint16_t read16(const uint8_t * p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint32_t read32(const uint8_t * p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int minTtl(int current, uint32_t ttl) {
+    // ttls are 31 bit values, anything larger counts as zero
+    int value = ttl > 0x7fffffff ? 0 : (int)ttl;
+    return current < 0 || value < current ? value : current;
+}
+
+/* header and question of a recursive query, returns the message length or 0
+ * if name is not a valid domain name */
+size_t buildQuery(uint8_t * buf, uint16_t id, const std::string & name, uint16_t type) {
+    memset(buf, 0, DNS_HEADER_SIZE);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xff;
+    buf[2] = DNS_FLAG_RECURSION >> 8;
+    buf[5] = 1;
+
+    size_t pos = DNS_HEADER_SIZE;
+    size_t start = 0;
+    while (start < name.length()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.length();
+        }
+        size_t label = dot - start;
+        if (label == 0 || label > 63 || pos + label + 1 + 5 > DNS_MAX_MESSAGE) {
+            return 0;
+        }
+        buf[pos++] = (uint8_t)label;
+        memcpy(buf + pos, name.data() + start, label);
+        pos += label;
+        start = dot + 1;
+    }
+    buf[pos++] = 0;
+    buf[pos++] = type >> 8;
+    buf[pos++] = type & 0xff;
+    buf[pos++] = 0;
+    buf[pos++] = DNS_CLASS_IN;
+    return pos;
+}
+
+/* skip a possibly compressed name, returns the offset after it or 0 if the
+ * message is malformed */
+size_t skipName(const uint8_t * msg, size_t len, size_t pos) {
+    while (pos < len) {
+        uint8_t label = msg[pos];
+        if (label == 0) {
+            return pos + 1;
+        }
+        if ((label & 0xc0) == 0xc0) {
+            return pos + 2 <= len ? pos + 2 : 0;
+        }
+        if (label & 0xc0) {
+            return 0;
+        }
+        pos += label + 1;
+    }
+    return 0;
+}
+
+bool parseReply(const uint8_t * msg, size_t len, Reply & reply) {
+    if (len < DNS_HEADER_SIZE) {
+        return false;
+    }
+    uint16_t flags = read16(msg + 2);
+    if (!(flags & DNS_FLAG_RESPONSE)) {
+        return false;
+    }
+    reply.received = true;
+    reply.rcode = flags & 0xf;
+    reply.truncated = (flags & DNS_FLAG_TRUNCATED) != 0;
+
+    uint16_t questions = read16(msg + 4);
+    uint16_t answers = read16(msg + 6);
+    uint16_t authorities = read16(msg + 8);
+
+    size_t pos = DNS_HEADER_SIZE;
+    for (uint16_t i = 0; i < questions; ++i) {
+        pos = skipName(msg, len, pos);
+        if (pos == 0 || pos + 4 > len) {
+            return false;
+        }
+        pos += 4;
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)answers + authorities; ++i) {
+        pos = skipName(msg, len, pos);
+        if (pos == 0 || pos + 10 > len) {
+            return false;
+        }
+        uint16_t type = read16(msg + pos);
+        uint16_t klass = read16(msg + pos + 2);
+        uint32_t ttl = read32(msg + pos + 4);
+        uint16_t rdlength = read16(msg + pos + 8);
+        pos += 10;
+        if (pos + rdlength > len) {
+            return false;
+        }
+        const uint8_t * rdata = msg + pos;
+
+        if (i < answers && klass == DNS_CLASS_IN && type == DNS_TYPE_A && rdlength == 4) {
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            struct sockaddr_in * sin = (struct sockaddr_in *)&addr;
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, rdata, 4);
+            reply.addresses.push_back(addr);
+            reply.ttl = minTtl(reply.ttl, ttl);
+        } else if (i < answers && klass == DNS_CLASS_IN && type == DNS_TYPE_AAAA && rdlength == 16) {
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *)&addr;
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_addr, rdata, 16);
+            reply.addresses.push_back(addr);
+            reply.ttl = minTtl(reply.ttl, ttl);
+        } else if (i >= answers && type == DNS_TYPE_SOA) {
+            // negative answers are cached for min(soa ttl, soa minimum)
+            size_t soa = skipName(msg, pos + rdlength, pos);
+            soa = soa == 0 ? 0 : skipName(msg, pos + rdlength, soa);
+            if (soa != 0 && soa + 20 <= pos + rdlength) {
+                reply.negative_ttl = minTtl(minTtl(-1, ttl), read32(msg + soa + 16));
+            }
+        }
+        pos += rdlength;
+    }
+    return true;
+}
+
+}
+
+bool parseDnsServer(const std::string & spec, struct sockaddr_storage & addr, socklen_t & len) {
+    std::string host = spec;
+    std::string port = "53";
+    size_t colon = spec.rfind(':');
+    if (!spec.empty() && spec[0] == '[') {
+        size_t close = spec.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        host = spec.substr(1, close - 1);
+        if (close + 1 < spec.length()) {
+            if (spec[close + 1] != ':') {
+                return false;
+            }
+            port = spec.substr(close + 2);
+        }
+    } else if (colon != std::string::npos && spec.find(':') == colon) {
+        // a single colon separates the port, more make it a bare ipv6 address
+        host = spec.substr(0, colon);
+        port = spec.substr(colon + 1);
+    }
+
+    char * end = NULL;
+    long port_num = strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || port_num <= 0 || port_num > 65535) {
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in * sin = (struct sockaddr_in *)&addr;
+    struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *)&addr;
+    if (inet_pton(AF_INET, host.c_str(), &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons((uint16_t)port_num);
+        len = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, host.c_str(), &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons((uint16_t)port_num);
+        len = sizeof(struct sockaddr_in6);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+DnsAnswer dnsQuery(const struct sockaddr_storage & server, socklen_t server_len,
+                   const std::string & name, int timeout_ms) {
+    DnsAnswer answer;
+    static thread_local std::mt19937 random(std::random_device{}());
+
+    // AAAA first, the order addresses are returned in
+    const uint16_t types[2] = {DNS_TYPE_AAAA, DNS_TYPE_A};
+    uint8_t queries[2][DNS_MAX_MESSAGE];
+    size_t query_len[2];
+    uint16_t ids[2];
+    for (int q = 0; q < 2; ++q) {
+        ids[q] = (uint16_t)random();
+        query_len[q] = buildQuery(queries[q], ids[q], name, types[q]);
+        if (query_len[q] == 0) {
+            answer.error = EAI_NONAME;
+            return answer;
+        }
+    }
+
+    int fd = socket(server.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        answer.error = EAI_SYSTEM;
+        return answer;
+    }
+    if (connect(fd, (const struct sockaddr *)&server, server_len) == -1) {
+        close(fd);
+        answer.error = EAI_SYSTEM;
+        return answer;
+    }
+
+    Reply replies[2];
+    for (int attempt = 0; attempt < DNS_ATTEMPTS && !(replies[0].received && replies[1].received); ++attempt) {
+        for (int q = 0; q < 2; ++q) {
+            if (!replies[q].received) {
+                ssize_t sent = send(fd, queries[q], query_len[q], 0);
+                (void)sent;
+            }
+        }
+
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms / DNS_ATTEMPTS);
+        while (!(replies[0].received && replies[1].received)) {
+            long remaining = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) {
+                break;
+            }
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, (int)remaining) <= 0) {
+                continue;
+            }
+
+            uint8_t msg[DNS_MAX_MESSAGE];
+            ssize_t rcvd = recv(fd, msg, sizeof(msg), 0);
+            if (rcvd < DNS_HEADER_SIZE) {
+                continue;
+            }
+            // late replies to an earlier attempt carry the same id and count too
+            uint16_t id = read16(msg);
+            for (int q = 0; q < 2; ++q) {
+                if (id == ids[q] && !replies[q].received) {
+                    Reply reply;
+                    if (parseReply(msg, rcvd, reply)) {
+                        replies[q] = reply;
+                    }
+                }
+            }
+        }
+    }
+    close(fd);
+
+    bool nxdomain = false;
+    bool nodata = true;
+    int negative_ttl = -1;
+    for (int q = 0; q < 2; ++q) {
+        const Reply & reply = replies[q];
+        answer.truncated = answer.truncated || reply.truncated;
+        if (!reply.addresses.empty()) {
+            answer.addresses.insert(answer.addresses.end(), reply.addresses.begin(), reply.addresses.end());
+            answer.ttl = answer.ttl < 0 ? reply.ttl : std::min(answer.ttl, reply.ttl);
+        }
+        nxdomain = nxdomain || (reply.received && reply.rcode == DNS_RCODE_NXDOMAIN);
+        // only a definite empty answer from both queries means the name has no address
+        nodata = nodata && reply.received && reply.rcode == 0 && !reply.truncated;
+        if (reply.negative_ttl >= 0) {
+            negative_ttl = negative_ttl < 0 ? reply.negative_ttl : std::min(negative_ttl, reply.negative_ttl);
+        }
+    }
+
+    if (!answer.addresses.empty()) {
+        answer.error = 0;
+    } else if (nxdomain || nodata) {
+        answer.error = EAI_NONAME;
+        answer.ttl = negative_ttl;
+    } else if (replies[0].received || replies[1].received) {
+        answer.error = replies[0].rcode == DNS_RCODE_SERVFAIL || replies[1].rcode == DNS_RCODE_SERVFAIL
+                       ? EAI_AGAIN : EAI_FAIL;
+    } else {
+        answer.error = EAI_AGAIN;
+    }
+    return answer;
+}
@@ -0,0 +1,35 @@
+#ifndef __DNS_CLIENT_HPP_
+#define __DNS_CLIENT_HPP_
+
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+
+// queries are sent this many times before a server counts as unreachable
+#define DNS_ATTEMPTS 2
+
+/**
+ * Answer of a dns server for the A and AAAA records of one name
+ */
+struct DnsAnswer {
+    // 0 on success, else an EAI_* code
+    int error;
+    std::vector<struct sockaddr_storage> addresses;
+    // smallest ttl of the records used, for failures the negative caching ttl
+    //  the server announced; -1 when the server did not say
+    int ttl;
+    // the answer did not fit a udp datagram, ask a full resolver instead
+    bool truncated;
+
+    DnsAnswer() : error(0), ttl(-1), truncated(false) {}
+};
+
+/* parse a dns server given as IP[:PORT] or [IPV6]:PORT, port 53 by default */
+bool parseDnsServer(const std::string & spec, struct sockaddr_storage & addr, socklen_t & len);
+
+/* ask server (a recursive resolver) for the ipv6 and ipv4 addresses of name
+ * over udp. Both queries are sent at once, timeout_ms bounds the whole call */
+DnsAnswer dnsQuery(const struct sockaddr_storage & server, socklen_t server_len,
+                   const std::string & name, int timeout_ms);
+
+#endif
@@ -0,0 +1,223 @@
+#include "EventLoop.hpp"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "Config.hpp"
+#include "Connection.hpp"
+#include "UpstreamPool.hpp"
+#include "Util.hpp"
+
+#define MAX_EVENTS 256
+
+EventLoop::EventLoop(Cache * cache, Resolver * resolver, Revalidator * revalidator,
+                     const ProxyConfig & config) :
+    cache(cache), resolver(resolver), revalidator(revalidator), config(config), inbox(config.queue_size),
+    wakeup_pending(false), pool(NULL) {
+    pthread_mutex_init(&tasks_lock, NULL);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        throw std::runtime_error("failed to create epoll instance: " + getErrorMsg());
+    }
+
+    wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wakeup.handler = this;
+    if (wakeup.fd == -1) {
+        close(epoll_fd);
+        throw std::runtime_error("failed to create eventfd: " + getErrorMsg());
+    }
+    watch(&wakeup, EPOLLIN);
+
+    timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    timer.handler = this;
+    if (timer.fd == -1) {
+        close(wakeup.fd);
+        close(epoll_fd);
+        throw std::runtime_error("failed to create timerfd: " + getErrorMsg());
+    }
+    struct itimerspec interval;
+    interval.it_interval.tv_sec = 1;
+    interval.it_interval.tv_nsec = 0;
+    interval.it_value = interval.it_interval;
+    timerfd_settime(timer.fd, 0, &interval, NULL);
+    watch(&timer, EPOLLIN);
+
+    pool = new UpstreamPool(this, config.upstream_per_host, config.upstream_idle_timeout);
+    track(pool);
+}
+
+EventLoop::~EventLoop() {
+    int client_fd;
+    while (inbox.pop(client_fd)) {
+        close(client_fd);
+    }
+    delete pool;
+    close(timer.fd);
+    close(wakeup.fd);
+    close(epoll_fd);
+    pthread_mutex_destroy(&tasks_lock);
+}
+
+void EventLoop::watch(Watch * w, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLET;
+    ev.data.ptr = w;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->fd, &ev) == -1) {
+        throw std::runtime_error("failed to register fd with epoll: " + getErrorMsg());
+    }
+}
+
+void EventLoop::unwatch(Watch * w) {
+    if (w->fd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+    }
+}
+
+void EventLoop::retire(EventHandler * handler) {
+    retired.push_back(handler);
+}
+
+void EventLoop::track(EventHandler * handler) {
+    tracked.insert(handler);
+}
+
+void EventLoop::untrack(EventHandler * handler) {
+    tracked.erase(handler);
+}
+
+const ProxyConfig & EventLoop::getConfig() const {
+    return config;
+}
+
+Resolver & EventLoop::getResolver() {
+    return *resolver;
+}
+
+Revalidator & EventLoop::getRevalidator() {
+    return *revalidator;
+}
+
+UpstreamPool & EventLoop::getPool() {
+    return *pool;
+}
+
+const UpstreamPool & EventLoop::getPool() const {
+    return *pool;
+}
+
+bool EventLoop::post(int client_fd) {
+    if (!inbox.push(client_fd)) {
+        return false;
+    }
+    wake();
+    return true;
+}
+
+void EventLoop::runInLoop(std::function<void()> task) {
+    pthread_mutex_lock(&tasks_lock);
+    tasks.push_back(std::move(task));
+    pthread_mutex_unlock(&tasks_lock);
+    wake();
+}
+
+void EventLoop::wake() {
+    // only the first producer after the loop drained the inbox pays for a wakeup
+    if (!wakeup_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t written = write(wakeup.fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void * EventLoop::threadMain(void * ptr) {
+    ((EventLoop *)ptr)->run();
+    return NULL;
+}
+
+void EventLoop::start() {
+    if (pthread_create(&thread, NULL, threadMain, this) != 0) {
+        throw std::runtime_error("failed to start event loop thread");
+    }
+}
+
+void EventLoop::join() {
+    pthread_join(thread, NULL);
+}
+
+void EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_LEVEL_ERROR, "ERROR epoll_wait failed: " + getErrorMsg());
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Watch * w = (Watch *)events[i].data.ptr;
+            w->handler->onEvent(w->fd, events[i].events);
+        }
+
+        // safe to free handlers now, no pending events refer to them anymore
+        for (size_t i = 0; i < retired.size(); ++i) {
+            delete retired[i];
+        }
+        retired.clear();
+    }
+}
+
+void EventLoop::onEvent(int fd, uint32_t events) {
+    if (fd == timer.fd) {
+        tick();
+    } else {
+        drainInbox();
+    }
+}
+
+void EventLoop::tick() {
+    uint64_t expirations;
+    ssize_t rcvd = read(timer.fd, &expirations, sizeof(expirations));
+    (void)rcvd;
+
+    // handlers may untrack themselves from onTimer, walk a snapshot
+    std::vector<EventHandler *> handlers(tracked.begin(), tracked.end());
+    time_t now = monotonicSeconds();
+    for (size_t i = 0; i < handlers.size(); ++i) {
+        if (tracked.count(handlers[i])) {
+            handlers[i]->onTimer(now);
+        }
+    }
+    // every loop sweeps, shards another loop is sweeping are skipped
+    cache->purgeExpired();
+}
+
+void EventLoop::drainInbox() {
+    uint64_t count;
+    ssize_t rcvd = read(wakeup.fd, &count, sizeof(count));
+    (void)rcvd;
+
+    // clear the flag before draining so a client posted meanwhile either gets
+    //  drained below or triggers a new wakeup
+    wakeup_pending.store(false);
+
+    int client_fd;
+    while (inbox.pop(client_fd)) {
+        Connection * conn = new Connection(this, cache, client_fd);
+        conn->start();
+    }
+
+    std::vector<std::function<void()> > ready;
+    pthread_mutex_lock(&tasks_lock);
+    ready.swap(tasks);
+    pthread_mutex_unlock(&tasks_lock);
+    for (size_t i = 0; i < ready.size(); ++i) {
+        ready[i]();
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef __EVENT_LOOP_HPP_
+#define __EVENT_LOOP_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+
+#include "MpscQueue.hpp"
+
+class Cache;
+class EventLoop;
+class Resolver;
+class Revalidator;
+class UpstreamPool;
+struct ProxyConfig;
+
+/**
+ * Anything owning file descriptors registered with an EventLoop
+ */
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+
+    // called from the loop thread whenever fd reports events
+    virtual void onEvent(int fd, uint32_t events) = 0;
+
+    // called about once a second for handlers tracked by their loop, now is
+    //  the monotonic time in seconds
+    virtual void onTimer(time_t now) {}
+};
+
+/**
+ * A file descriptor registered with epoll, the loop hands events on fd back
+ * to its handler
+ */
+struct Watch {
+    int fd;
+    EventHandler * handler;
+
+    Watch() : fd(-1), handler(NULL) {}
+};
+
+/**
+ * One epoll instance driven by its own thread. All descriptors are registered
+ * edge-triggered, so handlers must drain reads/writes until EAGAIN.
+ * Handlers are never deleted while an epoll batch is being processed, retire()
+ * defers the deletion until the batch is done.
+ * Accepted clients are handed over through a bounded inbox queue, the loop is
+ * woken up through an eventfd whenever the inbox turns non-empty. Other
+ * threads hand work to the loop thread the same way through runInLoop().
+ * A timerfd ticks once a second so tracked handlers can expire idle state.
+ * Each loop keeps its own pool of idle origin connections.
+ */
+class EventLoop : public EventHandler {
+private:
+    int epoll_fd;
+    pthread_t thread;
+    Cache * cache;
+    Resolver * resolver;
+    Revalidator * revalidator;
+    const ProxyConfig & config;
+
+    Watch wakeup;
+    Watch timer;
+    std::unordered_set<EventHandler *> tracked;
+    MpscQueue<int> inbox;
+    std::atomic<bool> wakeup_pending;
+    // tasks from other threads, swapped out as a whole by the loop thread
+    pthread_mutex_t tasks_lock;
+    std::vector<std::function<void()> > tasks;
+    std::vector<EventHandler *> retired;
+    UpstreamPool * pool;
+
+    static void * threadMain(void * ptr);
+    void drainInbox();
+    void wake();
+    void tick();
+
+public:
+    EventLoop(Cache * cache, Resolver * resolver, Revalidator * revalidator, const ProxyConfig & config);
+    ~EventLoop();
+
+    // register/unregister w, events are epoll flags (EPOLLET is always added)
+    void watch(Watch * w, uint32_t events);
+    void unwatch(Watch * w);
+
+    // delete handler once the current batch of events is processed
+    void retire(EventHandler * handler);
+
+    // start/stop calling handler's onTimer every tick
+    void track(EventHandler * handler);
+    void untrack(EventHandler * handler);
+
+    const ProxyConfig & getConfig() const;
+    Resolver & getResolver();
+    Revalidator & getRevalidator();
+    UpstreamPool & getPool();
+    const UpstreamPool & getPool() const;
+
+    // hand an accepted, non-blocking client socket to this loop, callable
+    //  from any thread. Returns false if the inbox is full
+    bool post(int client_fd);
+
+    // run task on the loop thread soon, callable from any thread
+    void runInLoop(std::function<void()> task);
+
+    void start();
+    void join();
+    void run();
+
+    void onEvent(int fd, uint32_t events);
+};
+
+#endif
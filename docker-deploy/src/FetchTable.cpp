@@ -0,0 +1,75 @@
+#include "FetchTable.hpp"
+
+#include <sstream>
+
+#include "EventLoop.hpp"
+
+std::string FetchStats::toString() const {
+    std::stringstream ss;
+    ss << "leaders=" << leaders << " followers=" << followers << " fallbacks=" << fallbacks;
+    return ss.str();
+}
+
+FetchTable::FetchTable() : leaders(0), followers(0), fallbacks(0) {
+    pthread_mutex_init(&lock, NULL);
+}
+
+FetchTable::~FetchTable() {
+    pthread_mutex_destroy(&lock);
+}
+
+FetchWait::Ptr FetchTable::join(const CacheKey & key, EventLoop * loop, FetchCallback done) {
+    pthread_mutex_lock(&lock);
+    std::pair<std::unordered_map<CacheKey, std::vector<Waiter>, CacheKeyHash>::iterator, bool> slot =
+        fetches.emplace(key, std::vector<Waiter>());
+    if (slot.second) {
+        pthread_mutex_unlock(&lock);
+        leaders++;
+        return FetchWait::Ptr();
+    }
+
+    FetchWait::Ptr wait = std::make_shared<FetchWait>(std::move(done));
+    Waiter waiter = {loop, wait};
+    slot.first->second.push_back(waiter);
+    pthread_mutex_unlock(&lock);
+    followers++;
+    return wait;
+}
+
+bool FetchTable::lead(const CacheKey & key) {
+    pthread_mutex_lock(&lock);
+    bool led = fetches.emplace(key, std::vector<Waiter>()).second;
+    pthread_mutex_unlock(&lock);
+    if (led) {
+        leaders++;
+    }
+    return led;
+}
+
+void FetchTable::end(const CacheKey & key, const std::shared_ptr<const CacheEntry> & entry) {
+    std::vector<Waiter> waiters;
+    pthread_mutex_lock(&lock);
+    std::unordered_map<CacheKey, std::vector<Waiter>, CacheKeyHash>::iterator it = fetches.find(key);
+    if (it != fetches.end()) {
+        waiters.swap(it->second);
+        fetches.erase(it);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (!entry) {
+        fallbacks += waiters.size();
+    }
+    // followers always continue on their own loop, even the leader's
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        FetchWait::Ptr wait = waiters[i].wait;
+        waiters[i].loop->runInLoop([wait, entry]() { wait->complete(entry); });
+    }
+}
+
+FetchStats FetchTable::getStats() const {
+    FetchStats stats;
+    stats.leaders = leaders.load();
+    stats.followers = followers.load();
+    stats.fallbacks = fallbacks.load();
+    return stats;
+}
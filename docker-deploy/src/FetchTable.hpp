@@ -0,0 +1,102 @@
+#ifndef __FETCH_TABLE_HPP_
+#define __FETCH_TABLE_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CacheKey.hpp"
+
+class CacheEntry;
+class EventLoop;
+
+// the response of a fetch, empty when it produced nothing to share
+typedef std::function<void(const std::shared_ptr<const CacheEntry> &)> FetchCallback;
+
+/**
+ * A connection waiting for another one's fetch. The callback runs on the loop
+ * of the waiting connection; cancel() (on that loop's thread) makes sure it
+ * never does.
+ */
+class FetchWait {
+private:
+    FetchCallback done;
+    bool cancelled;
+
+public:
+    typedef std::shared_ptr<FetchWait> Ptr;
+
+    explicit FetchWait(FetchCallback done) : done(std::move(done)), cancelled(false) {}
+
+    void cancel() { cancelled = true; }
+    void complete(const std::shared_ptr<const CacheEntry> & entry) {
+        if (!cancelled) {
+            done(entry);
+        }
+    }
+};
+
+/**
+ * Counters of collapsed forwarding
+ */
+struct FetchStats {
+    // fetches that went to the origin for a key
+    uint64_t leaders;
+    // requests that waited for another request's fetch instead
+    uint64_t followers;
+    // followers that had to go to the origin after all, because the response
+    //  could not be shared
+    uint64_t fallbacks;
+
+    FetchStats() : leaders(0), followers(0), fallbacks(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * Cache misses and revalidations in progress, keyed like the cache. The first
+ * request missing a key leads the fetch from the origin, requests missing the
+ * same key meanwhile wait for the leader's response instead of sending the
+ * same request upstream again.
+ */
+class FetchTable {
+private:
+    struct Waiter {
+        EventLoop * loop;
+        FetchWait::Ptr wait;
+    };
+
+    pthread_mutex_t lock;
+    std::unordered_map<CacheKey, std::vector<Waiter>, CacheKeyHash> fetches;
+
+    std::atomic<uint64_t> leaders;
+    std::atomic<uint64_t> followers;
+    std::atomic<uint64_t> fallbacks;
+
+    FetchTable(const FetchTable &);
+    FetchTable & operator=(const FetchTable &);
+
+public:
+    FetchTable();
+    ~FetchTable();
+
+    // returns NULL if the caller now leads the fetch of key and must end() it.
+    //  Otherwise done runs on loop's thread once the leader is done
+    FetchWait::Ptr join(const CacheKey & key, EventLoop * loop, FetchCallback done);
+
+    // lead the fetch of key if nobody does, never waits. Returns whether the
+    //  caller now leads and must end() it
+    bool lead(const CacheKey & key);
+
+    // the leader of key is done, entry is handed to every waiting request
+    void end(const CacheKey & key, const std::shared_ptr<const CacheEntry> & entry);
+
+    FetchStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __FRESHNESS_HPP_
+#define __FRESHNESS_HPP_
+
+#include <stdint.h>
+
+/**
+ * Deadlines of a stored response on the monotonic clock in milliseconds.
+ * They are computed once when the response is stored, following the age
+ * calculation of RFC 9111 section 4.2.3, so checking a hit is a single
+ * comparison and wall clock steps cannot make entries fresh again.
+ */
+struct Freshness {
+    // fresh before this
+    int64_t fresh_until;
+    // may be served while it is revalidated in the background before this
+    int64_t stale_until;
+    // of no use after this, purged from the cache
+    int64_t purge_at;
+
+    Freshness() : fresh_until(0), stale_until(0), purge_at(0) {}
+
+    // deadlines that never pass
+    static Freshness forever() {
+        Freshness freshness;
+        freshness.fresh_until = freshness.stale_until = freshness.purge_at = INT64_MAX;
+        return freshness;
+    }
+
+    bool isFresh(int64_t now) const { return now < fresh_until; }
+    bool isStaleUsable(int64_t now) const { return now < stale_until; }
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "Logger.hpp"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "MpscQueue.hpp"
+
+namespace {
+
+/* lines of one thread, only that thread advances head and only the writer
+ * advances tail. Both are running byte counts, the ring index is taken modulo
+ * its size */
+struct LogRing {
+  std::atomic<size_t> head;
+  char pad0[CACHE_LINE_SIZE];
+  std::atomic<size_t> tail;
+  char pad1[CACHE_LINE_SIZE];
+  std::atomic<uint64_t> dropped;
+  // "<thread id>: " in front of every line
+  std::string prefix;
+  char data[LOG_RING_SIZE];
+
+  LogRing() : head(0), tail(0), dropped(0), prefix(std::to_string(pthread_self()) + ": ") {}
+
+  void copy(size_t pos, const char * src, size_t len) {
+    size_t offset = pos % LOG_RING_SIZE;
+    size_t first = len < LOG_RING_SIZE - offset ? len : LOG_RING_SIZE - offset;
+    memcpy(data + offset, src, first);
+    memcpy(data, src + first, len - first);
+  }
+};
+
+// every ring ever created, rings live as long as the process
+pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<LogRing *> rings;
+
+// serializes draining between the writer thread and flush_logger
+pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+int log_fd = -1;
+uint64_t reported_drops = 0;
+
+std::atomic<int> min_level(LOG_LEVEL_INFO);
+std::atomic<bool> started(false);
+
+thread_local LogRing * local_ring = NULL;
+
+LogRing * ringForThread() {
+  if (local_ring == NULL) {
+    local_ring = new LogRing();
+    pthread_mutex_lock(&rings_lock);
+    rings.push_back(local_ring);
+    pthread_mutex_unlock(&rings_lock);
+  }
+  return local_ring;
+}
+
+// write all of iov, short writes are continued
+void writeAll(struct iovec * iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(log_fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
+/* move everything currently in the rings to the file, returns true if
+ * anything was written */
+bool drain() {
+  pthread_mutex_lock(&rings_lock);
+  std::vector<LogRing *> snapshot(rings);
+  pthread_mutex_unlock(&rings_lock);
+
+  pthread_mutex_lock(&drain_lock);
+  struct iovec iov[IOV_MAX];
+  size_t ends[IOV_MAX / 2];
+  LogRing * owners[IOV_MAX / 2];
+  int count = 0;
+  int batched = 0;
+  uint64_t drops = 0;
+  bool wrote = false;
+
+  for (size_t i = 0; i <= snapshot.size(); ++i) {
+    // flush when the batch is full or every ring was visited
+    if (i == snapshot.size() || count + 2 > IOV_MAX) {
+      if (log_fd != -1) {
+        writeAll(iov, count);
+      }
+      for (int j = 0; j < batched; ++j) {
+        owners[j]->tail.store(ends[j], std::memory_order_release);
+      }
+      wrote = wrote || count > 0;
+      count = batched = 0;
+      if (i == snapshot.size()) {
+        break;
+      }
+    }
+
+    LogRing * ring = snapshot[i];
+    drops += ring->dropped.load(std::memory_order_relaxed);
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t head = ring->head.load(std::memory_order_acquire);
+    if (head == tail) {
+      continue;
+    }
+    // at most two pieces, the ring may wrap around
+    size_t offset = tail % LOG_RING_SIZE;
+    size_t len = head - tail;
+    size_t first = len < LOG_RING_SIZE - offset ? len : LOG_RING_SIZE - offset;
+    iov[count].iov_base = ring->data + offset;
+    iov[count++].iov_len = first;
+    if (first < len) {
+      iov[count].iov_base = ring->data;
+      iov[count++].iov_len = len - first;
+    }
+    owners[batched] = ring;
+    ends[batched++] = head;
+  }
+
+  if (drops > reported_drops && log_fd != -1) {
+    std::string warning = "WARNING dropped " + std::to_string(drops - reported_drops) +
+                          " log lines, the log writer fell behind\n";
+    struct iovec line = {(void *)warning.data(), warning.length()};
+    writeAll(&line, 1);
+    reported_drops = drops;
+  }
+  pthread_mutex_unlock(&drain_lock);
+  return wrote;
+}
+
+void * writer(void * arg) {
+  (void)arg;
+  while (true) {
+    if (!drain()) {
+      usleep(LOG_FLUSH_INTERVAL_US);
+    }
+  }
+  return NULL;
+}
+
+}
+
+bool start_logger(const std::string & path) {
+  if (started.exchange(true)) {
+    return log_fd != -1;
+  }
+
+  log_fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (log_fd == -1) {
+    std::cerr << "failed to open log file " << path << ": " << strerror(errno) << std::endl;
+  }
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, writer, NULL);
+  pthread_detach(thread);
+  atexit(flush_logger);
+  return log_fd != -1;
+}
+
+void flush_logger() {
+  drain();
+}
+
+void set_log_level(LogLevel level) {
+  min_level.store(level, std::memory_order_relaxed);
+}
+
+bool log_enabled(LogLevel level) {
+  return level >= min_level.load(std::memory_order_relaxed);
+}
+
+void log_message(LogLevel level, const std::string & payload) {
+  if (!log_enabled(level)) {
+    return;
+  }
+
+  LogRing * ring = ringForThread();
+  size_t len = ring->prefix.length() + payload.length() + 1;
+  size_t head = ring->head.load(std::memory_order_relaxed);
+  size_t tail = ring->tail.load(std::memory_order_acquire);
+  if (LOG_RING_SIZE - (head - tail) < len) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  ring->copy(head, ring->prefix.data(), ring->prefix.length());
+  ring->copy(head + ring->prefix.length(), payload.data(), payload.length());
+  ring->copy(head + len - 1, "\n", 1);
+  ring->head.store(head + len, std::memory_order_release);
+}
+
+void log_info(const std::string & payload) {
+  log_message(LOG_LEVEL_INFO, payload);
+}
+
+void log_debug(const std::string & payload) {
+  log_message(LOG_LEVEL_DEBUG, payload);
+}
+
+uint64_t log_dropped() {
+  uint64_t drops = 0;
+  pthread_mutex_lock(&rings_lock);
+  for (size_t i = 0; i < rings.size(); ++i) {
+    drops += rings[i]->dropped.load(std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&rings_lock);
+  return drops;
+}
+
+LogLevel parse_log_level(const std::string & name) {
+  if (name == "debug") {
+    return LOG_LEVEL_DEBUG;
+  } else if (name == "info") {
+    return LOG_LEVEL_INFO;
+  } else if (name == "warning") {
+    return LOG_LEVEL_WARNING;
+  } else if (name == "error") {
+    return LOG_LEVEL_ERROR;
+  }
+  throw std::invalid_argument("invalid log level: " + name);
+}
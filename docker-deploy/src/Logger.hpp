@@ -0,0 +1,52 @@
+#ifndef __LOGGER_HPP_
+#define __LOGGER_HPP_
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Asynchronous log. Every thread appends formatted lines to its own lock-free
+ * single-producer ring, one background thread drains all rings and appends
+ * them to the log file with a single writev() per round. Logging therefore
+ * never blocks on the file or on other threads; when a thread outruns the
+ * writer its ring fills up and further lines are dropped and counted.
+ */
+
+#define LOG_RING_SIZE (256 * 1024)
+// how long the writer sleeps when every ring is empty
+#define LOG_FLUSH_INTERVAL_US 10000
+
+enum LogLevel {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_ERROR
+};
+
+// open path for appending and start the writer thread, lines logged before
+//  are kept in the rings. Returns false if the file cannot be opened, lines
+//  are then discarded
+bool start_logger(const std::string & path);
+
+// write out everything logged so far, also run at exit
+void flush_logger();
+
+// lines below level are skipped
+void set_log_level(LogLevel level);
+
+// check before building expensive payloads, so disabled levels cost nothing
+bool log_enabled(LogLevel level);
+
+void log_message(LogLevel level, const std::string & payload);
+
+// write std string payload into log file
+void log_info(const std::string & payload);
+void log_debug(const std::string & payload);
+
+// lines lost because a ring was full
+uint64_t log_dropped();
+
+// parse "debug", "info", "warning" or "error", throws std::invalid_argument
+LogLevel parse_log_level(const std::string & name);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __MPSC_QUEUE_HPP_
+#define __MPSC_QUEUE_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <cstddef>
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Bounded lock-free queue for many producers and a single consumer.
+ * Based on Dmitry Vyukov's bounded queue: every cell carries a sequence number
+ * telling producers whether the slot is free and the consumer whether it is
+ * filled, so producers only contend on one atomic counter and never block.
+ * The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class MpscQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Cell * buffer;
+    size_t mask;
+
+    char pad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos;
+    char pad1[CACHE_LINE_SIZE];
+    // only ever touched by the consumer
+    size_t dequeue_pos;
+
+    MpscQueue(const MpscQueue &);
+    MpscQueue & operator=(const MpscQueue &);
+
+public:
+    explicit MpscQueue(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        buffer = new Cell[size];
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpscQueue() {
+        delete[] buffer;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    // safe to call from any thread, returns false if the queue is full
+    bool push(const T & data) {
+        Cell * cell;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &buffer[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = data;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer thread only, returns false if the queue is empty
+    bool pop(T & data) {
+        Cell * cell = &buffer[dequeue_pos & mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0) {
+            return false;
+        }
+
+        data = cell->data;
+        cell->sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+        ++dequeue_pos;
+        return true;
+    }
+};
+
+#endif
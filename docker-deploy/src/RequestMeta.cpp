@@ -1,10 +1,12 @@
 #include "RequestMeta.hpp"
+#include <algorithm>
 
 RequestMeta::RequestMeta(RequestType rt, std::string u, size_t l,
     std::string host, uint16_t port,std::string FirstLine, int max_age,
-    int max_stale, int min_fresh, bool is_no_cache, bool is_no_store, bool is_only_if_cached, std::string rh):
+    int max_stale, int min_fresh, bool is_no_cache, bool is_no_store, bool is_only_if_cached, bool keep_alive, std::string rh):
     req_t(rt), url(u), content_length(l), host(host), port(port), FirstLine(FirstLine), max_age(max_age),
-    min_fresh(min_fresh), is_no_cache(is_no_cache), is_no_store(is_no_store), is_only_if_cached(is_only_if_cached), req_head(rh) {}
+    max_stale(max_stale), min_fresh(min_fresh), is_no_cache(is_no_cache), is_no_store(is_no_store), is_only_if_cached(is_only_if_cached),
+    keep_alive(keep_alive), req_head(rh) {}
 
 RequestMeta::~RequestMeta() {}
 std::string RequestMeta::toString() const {
@@ -43,6 +45,49 @@ const std::string RequestMeta::getFirstLine() const {
     return this->FirstLine;
 }
 
+std::pair<bool, std::string> RequestMeta::getField(const std::string& name) const {
+    std::pair<bool, std::string> found(false, "");
+    size_t line = req_head.find('\n');
+    while (line != std::string::npos) {
+        size_t start = line + 1;
+        line = req_head.find('\n', start);
+        size_t end = line == std::string::npos ? req_head.size() : line;
+        size_t colon = req_head.find(':', start);
+        if (colon >= end || !equalsIgnoreCase(req_head.data() + start, colon - start, name.c_str())) {
+            continue;
+        }
+        size_t value = req_head.find_first_not_of(" \t", colon + 1);
+        size_t value_end = req_head.find_last_not_of(" \t\r", end - 1);
+        if (found.first) {
+            found.second += ",";
+        }
+        found.first = true;
+        if (value < end && value_end != std::string::npos && value_end >= value) {
+            found.second.append(req_head, value, value_end - value + 1);
+        }
+    }
+    return found;
+}
+
+std::string RequestMeta::headWithout(const char * const * names) const {
+    std::string head;
+    size_t start = 0;
+    while (start < req_head.size()) {
+        size_t end = std::min(req_head.find('\n', start), req_head.size());
+        size_t colon = req_head.find(':', start);
+        bool dropped = false;
+        for (size_t i = 0; start > 0 && colon < end && names[i] != NULL && !dropped; ++i) {
+            dropped = equalsIgnoreCase(req_head.data() + start, colon - start, names[i]);
+        }
+        size_t line_end = end > start && req_head[end - 1] == '\r' ? end - 1 : end;
+        if (!dropped && line_end > start) {
+            head += (head.empty() ? "" : "\r\n") + req_head.substr(start, line_end - start);
+        }
+        start = end + 1;
+    }
+    return head;
+}
+
 int RequestMeta::getMaxAge() const {
     return this->max_age;
 }
@@ -67,6 +112,10 @@ bool RequestMeta::isOnlyIfCached() const {
     return this->is_only_if_cached;
 }
 
+bool RequestMeta::isPersistent() const {
+    return this->keep_alive;
+}
+
 const std::string& RequestMeta::getHead() const {
     return this->req_head;
 }
@@ -24,12 +24,15 @@ private:
     bool is_no_store;
     bool is_only_if_cached;
 
+    // the client keeps the connection open for further requests
+    bool keep_alive;
+
     std::string req_head;
     
 public:
     const static int UNSPECIFIED = -1;
 
-    RequestMeta(RequestType rt, std::string u, size_t l, std::string host, uint16_t port, std::string FirstLine, int max_age, int max_stale, int min_fresh, bool is_no_cache, bool is_no_store, bool is_only_if_cached, std::string req_head);
+    RequestMeta(RequestType rt, std::string u, size_t l, std::string host, uint16_t port, std::string FirstLine, int max_age, int max_stale, int min_fresh, bool is_no_cache, bool is_no_store, bool is_only_if_cached, bool keep_alive, std::string req_head);
     std::string toString() const;
     const std::string& getUrl() const;
     const RequestType& getRequestType() const;
@@ -38,6 +41,12 @@ public:
     const std::string& getHead() const;
     const uint16_t getPort() const;
     const std::string getFirstLine() const;
+    // values of every field called name (ignoring case) joined by commas,
+    //  first is false if the request has no such field
+    std::pair<bool, std::string> getField(const std::string& name) const;
+    // the request line and fields without those named in the NULL terminated
+    //  names, lines end with CRLF except the last
+    std::string headWithout(const char * const * names) const;
 
     int getMaxAge() const;
     int getMaxStale() const;
@@ -45,6 +54,7 @@ public:
     bool isNoCache() const;
     bool isNoStore() const;
     bool isOnlyIfCached() const;
+    bool isPersistent() const;
 
 
 
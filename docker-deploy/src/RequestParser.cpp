@@ -0,0 +1,297 @@
+#include "RequestParser.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "Util.hpp"
+
+// longest method name accepted, CONNECT is the longest we support
+#define MAX_METHOD_LENGTH 16
+
+static bool equals(const char * data, size_t len, const char * literal) {
+    return len == strlen(literal) && memcmp(data, literal, len) == 0;
+}
+
+// whether the comma separated list value holds token, ignoring case
+static bool hasToken(const char * value, size_t len, const char * token) {
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) {
+            ++i;
+        }
+        size_t start = i;
+        while (i < len && value[i] != ',' && value[i] != ' ' && value[i] != '\t') {
+            ++i;
+        }
+        if (i > start && equalsIgnoreCase(value + start, i - start, token)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+RequestParser::RequestParser() {
+    reset();
+}
+
+void RequestParser::reset() {
+    state = LEADING_NEWLINES;
+    pos = 0;
+    method = target = request_line = name = value = host = head = Span();
+    req_t = GET;
+    has_host = false;
+    has_content_length = false;
+    content_length = 0;
+    port = 80;
+    http11 = false;
+    connection_close = connection_keep_alive = false;
+    cache_control = CacheControl();
+}
+
+RequestParser::Status RequestParser::parse(const char * buf, size_t len) {
+    size_t i = pos;
+    while (i < len && state != DONE) {
+        char c = buf[i];
+        switch (state) {
+            case LEADING_NEWLINES:
+                // robustness: ignore empty lines before the request line
+                if (c != '\r' && c != '\n') {
+                    method.begin = request_line.begin = head.begin = i;
+                    state = METHOD;
+                    continue;
+                }
+                break;
+            case METHOD:
+                if (c == ' ') {
+                    method.end = i;
+                    target.begin = i + 1;
+                    state = TARGET;
+                } else if (c == '\r' || c == '\n' || i - method.begin >= MAX_METHOD_LENGTH) {
+                    throw std::invalid_argument("Error: none or not supported http method specified");
+                }
+                break;
+            case TARGET:
+                if (c == ' ') {
+                    target.end = i;
+                    state = VERSION;
+                } else if (c == '\r' || c == '\n') {
+                    throw std::invalid_argument("Error: no url path in request");
+                }
+                break;
+            case VERSION:
+                if (c == '\r' || c == '\n') {
+                    request_line.end = i;
+                    state = REQUEST_LINE_LF;
+                    continue;
+                }
+                break;
+            case REQUEST_LINE_LF:
+                if (c == '\n') {
+                    endOfRequestLine(buf);
+                    state = FIELD_START;
+                } else if (i != request_line.end) {
+                    throw std::invalid_argument("Error: malformed request line");
+                }
+                break;
+            case FIELD_START:
+                if (c == '\r') {
+                    state = HEADER_END_LF;
+                } else if (c == '\n') {
+                    state = HEADER_END_LF;
+                    continue;
+                } else if (c == ' ' || c == '\t') {
+                    throw std::invalid_argument("Error: folded header lines are not supported");
+                } else {
+                    name.begin = i;
+                    state = FIELD_NAME;
+                }
+                break;
+            case FIELD_NAME:
+                if (c == ':') {
+                    name.end = i;
+                    state = FIELD_VALUE_START;
+                } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                    throw std::invalid_argument("Error: malformed header field");
+                }
+                break;
+            case FIELD_VALUE_START:
+                if (c != ' ' && c != '\t') {
+                    value.begin = i;
+                    state = FIELD_VALUE;
+                    continue;
+                }
+                break;
+            case FIELD_VALUE:
+                if (c == '\r' || c == '\n') {
+                    value.end = i;
+                    // drop trailing whitespace
+                    while (value.end > value.begin && (buf[value.end - 1] == ' ' || buf[value.end - 1] == '\t')) {
+                        --value.end;
+                    }
+                    state = FIELD_LF;
+                    continue;
+                }
+                break;
+            case FIELD_LF:
+                if (c == '\n') {
+                    endOfField(buf);
+                    state = FIELD_START;
+                } else if (c != '\r') {
+                    throw std::invalid_argument("Error: malformed header field");
+                }
+                break;
+            case HEADER_END_LF:
+                if (c != '\n') {
+                    throw std::invalid_argument("Error: malformed end of header");
+                }
+                head.end = i - (buf[i - 1] == '\r' ? 1 : 0);
+                endOfHeader(buf);
+                state = DONE;
+                break;
+            case DONE:
+                break;
+        }
+        ++i;
+    }
+
+    pos = i;
+    return state == DONE ? COMPLETE : INCOMPLETE;
+}
+
+void RequestParser::endOfRequestLine(const char * buf) {
+    // method names are case-sensitive
+    const char * m = buf + method.begin;
+    if (equals(m, method.length(), "GET")) {
+        req_t = GET;
+    } else if (equals(m, method.length(), "POST")) {
+        req_t = POST;
+    } else if (equals(m, method.length(), "CONNECT")) {
+        req_t = CONNECT;
+    } else {
+        throw std::invalid_argument("Error: none or not supported http method specified");
+    }
+
+    if (target.length() == 0) {
+        throw std::invalid_argument("Error: no url path in request");
+    }
+    const char * version = buf + target.end + 1;
+    size_t version_len = request_line.end - target.end - 1;
+    if (version_len != 8 || memcmp(version, "HTTP/1.", 7) != 0) {
+        throw std::invalid_argument("Error: unsupported http version");
+    }
+    http11 = version[7] != '0';
+
+    if (req_t == CONNECT) {
+        // the request target of CONNECT is the authority to tunnel to
+        parseAuthority(buf, target, 443);
+    }
+}
+
+void RequestParser::endOfField(const char * buf) {
+    const char * field = buf + name.begin;
+    size_t field_len = name.length();
+
+    if (equalsIgnoreCase(field, field_len, "Host")) {
+        if (req_t != CONNECT) {
+            parseAuthority(buf, value, 80);
+        }
+        has_host = true;
+    } else if (equalsIgnoreCase(field, field_len, "Content-Length")) {
+        size_t parsed = 0;
+        if (value.length() == 0) {
+            throw std::invalid_argument("Error: invalid content length");
+        }
+        for (size_t i = value.begin; i < value.end; ++i) {
+            if (buf[i] < '0' || buf[i] > '9' || parsed > (SIZE_MAX - 9) / 10) {
+                throw std::invalid_argument("Error: invalid content length");
+            }
+            parsed = parsed * 10 + (buf[i] - '0');
+        }
+        if (has_content_length && parsed != content_length) {
+            throw std::invalid_argument("Error: conflicting content lengths");
+        }
+        has_content_length = true;
+        content_length = parsed;
+    } else if (equalsIgnoreCase(field, field_len, "Transfer-Encoding")) {
+        throw std::invalid_argument("Error: chunked request bodies are not supported");
+    } else if (equalsIgnoreCase(field, field_len, "Connection") ||
+               equalsIgnoreCase(field, field_len, "Proxy-Connection")) {
+        connection_close = connection_close || hasToken(buf + value.begin, value.length(), "close");
+        connection_keep_alive = connection_keep_alive ||
+                                hasToken(buf + value.begin, value.length(), "keep-alive");
+    } else if (equalsIgnoreCase(field, field_len, "Cache-Control")) {
+        cache_control.parse(buf + value.begin, value.length());
+    }
+}
+
+/* host[:port] or [ipv6]:port */
+void RequestParser::parseAuthority(const char * buf, const Span & field, uint16_t default_port) {
+    size_t end = field.end;
+    size_t colon = end;
+    for (size_t i = field.end; i > field.begin; --i) {
+        if (buf[i - 1] == ':') {
+            colon = i - 1;
+            break;
+        }
+        if (buf[i - 1] < '0' || buf[i - 1] > '9') {
+            break;
+        }
+    }
+
+    host.begin = field.begin;
+    host.end = colon;
+    if (host.length() >= 2 && buf[host.begin] == '[' && buf[host.end - 1] == ']') {
+        ++host.begin;
+        --host.end;
+    }
+    if (host.length() == 0) {
+        throw std::invalid_argument("Error: invalid host format");
+    }
+
+    port = default_port;
+    if (colon + 1 < end) {
+        unsigned long parsed = 0;
+        for (size_t i = colon + 1; i < end; ++i) {
+            parsed = parsed * 10 + (buf[i] - '0');
+            if (parsed > 65535) {
+                throw std::invalid_argument("Error: invalid port");
+            }
+        }
+        port = (uint16_t)parsed;
+    }
+}
+
+void RequestParser::endOfHeader(const char * buf) {
+    if (!has_host && req_t != CONNECT) {
+        throw std::invalid_argument("Error: Missing host information");
+    }
+    if (req_t == POST && !has_content_length) {
+        throw std::invalid_argument("Error: invalid content length");
+    }
+    if (req_t != POST && content_length != 0) {
+        throw std::invalid_argument("Error: invalid content length");
+    }
+}
+
+size_t RequestParser::getHeaderLength() const {
+    return pos;
+}
+
+size_t RequestParser::getRequestOffset() const {
+    return request_line.begin;
+}
+
+RequestMeta RequestParser::toMeta(const char * buf) const {
+    return RequestMeta(req_t,
+                       std::string(buf + target.begin, target.length()),
+                       req_t == CONNECT ? 0 : content_length,
+                       std::string(buf + host.begin, host.length()),
+                       port,
+                       std::string(buf + request_line.begin, request_line.length()),
+                       cache_control.max_age, cache_control.max_stale, cache_control.min_fresh,
+                       cache_control.has(CacheControl::NO_CACHE),
+                       cache_control.has(CacheControl::NO_STORE),
+                       cache_control.has(CacheControl::ONLY_IF_CACHED),
+                       http11 ? !connection_close : connection_keep_alive && !connection_close,
+                       std::string(buf + head.begin, head.length()));
+}
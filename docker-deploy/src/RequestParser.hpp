@@ -0,0 +1,99 @@
+#ifndef __REQUEST_PARSER_HPP_
+#define __REQUEST_PARSER_HPP_
+
+#include <stdint.h>
+#include <cstddef>
+#include "CacheControl.hpp"
+#include "RequestMeta.hpp"
+#include "RequestType.hpp"
+
+/**
+ * Incremental http/1.1 request header parser.
+ * parse() is handed the bytes received so far and resumes where the previous
+ * call stopped, so a header split over many reads is still looked at only
+ * once. Fields are recorded as offsets into the caller's buffer and the
+ * headers the proxy cares about are interpreted as soon as their line ends,
+ * the parser itself never allocates.
+ */
+class RequestParser {
+public:
+    enum Status {
+        INCOMPLETE,
+        COMPLETE
+    };
+
+private:
+    enum State {
+        LEADING_NEWLINES,
+        METHOD,
+        TARGET,
+        VERSION,
+        REQUEST_LINE_LF,
+        FIELD_START,
+        FIELD_NAME,
+        FIELD_VALUE_START,
+        FIELD_VALUE,
+        FIELD_LF,
+        HEADER_END_LF,
+        DONE
+    };
+
+    // half-open byte range [begin, end) inside the request buffer
+    struct Span {
+        size_t begin;
+        size_t end;
+
+        Span() : begin(0), end(0) {}
+        size_t length() const { return end - begin; }
+    };
+
+    State state;
+    size_t pos;
+
+    Span method;
+    Span target;
+    Span request_line;
+    Span name;
+    Span value;
+    Span host;
+    Span head;
+
+    RequestType req_t;
+    bool has_host;
+    bool has_content_length;
+    size_t content_length;
+    uint16_t port;
+    // http/1.1 or later, and the connection tokens the client sent
+    bool http11;
+    bool connection_close;
+    bool connection_keep_alive;
+
+    CacheControl cache_control;
+
+    void endOfRequestLine(const char * buf);
+    void endOfField(const char * buf);
+    void parseAuthority(const char * buf, const Span & field, uint16_t default_port);
+    void endOfHeader(const char * buf);
+
+public:
+    RequestParser();
+
+    // forget the previous request, the next parse() starts a new one
+    void reset();
+
+    // parse buf[0, len) from where the last call stopped. buf must hold the
+    //  bytes of previous calls followed by newly received ones. Throws
+    //  std::invalid_argument on malformed requests
+    Status parse(const char * buf, size_t len);
+
+    // bytes up to and including the empty line ending the header
+    size_t getHeaderLength() const;
+
+    // bytes of empty lines skipped before the request line
+    size_t getRequestOffset() const;
+
+    // build the request description, buf is the buffer given to parse()
+    RequestMeta toMeta(const char * buf) const;
+};
+
+#endif
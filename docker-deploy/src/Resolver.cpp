@@ -0,0 +1,433 @@
+#include "Resolver.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Config.hpp"
+#include "DnsClient.hpp"
+#include "EventLoop.hpp"
+#include "Util.hpp"
+
+std::string ResolveResult::errorMessage() const {
+    return gai_strerror(error);
+}
+
+std::string ResolverStats::toString() const {
+    std::stringstream ss;
+    ss << "hits=" << hits << " negative_hits=" << negative_hits << " misses=" << misses
+       << " coalesced=" << coalesced << " refreshes=" << refreshes << " failures=" << failures
+       << " lookups=" << lookups << " latency_us avg=" << latency_avg_us << " p50=" << latency_p50_us
+       << " p99=" << latency_p99_us << " max=" << latency_max_us;
+    return ss.str();
+}
+
+/* fill result if host is an ip address literal */
+static bool parseNumeric(const std::string & host, ResolveResult & result) {
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in * sin = (struct sockaddr_in *)&addr;
+    struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *)&addr;
+    if (inet_pton(AF_INET, host.c_str(), &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+    } else if (inet_pton(AF_INET6, host.c_str(), &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+    } else {
+        return false;
+    }
+    result.error = 0;
+    result.addresses.assign(1, addr);
+    return true;
+}
+
+static bool sameAddress(const struct sockaddr_storage & a, const struct sockaddr_storage & b) {
+    if (a.ss_family != b.ss_family) {
+        return false;
+    }
+    if (a.ss_family == AF_INET6) {
+        return memcmp(&((const struct sockaddr_in6 *)&a)->sin6_addr,
+                      &((const struct sockaddr_in6 *)&b)->sin6_addr, sizeof(struct in6_addr)) == 0;
+    }
+    return ((const struct sockaddr_in *)&a)->sin_addr.s_addr == ((const struct sockaddr_in *)&b)->sin_addr.s_addr;
+}
+
+/* the address that connected last time first, then the families interleaved
+ * starting with its family (RFC 8305), so a dead address or family costs one
+ * attempt delay instead of a timeout per address */
+static std::vector<struct sockaddr_storage> arrange(const std::vector<struct sockaddr_storage> & addresses,
+                                                    const struct sockaddr_storage & preferred) {
+    std::vector<struct sockaddr_storage> first;
+    std::vector<struct sockaddr_storage> second;
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        if (sameAddress(addresses[i], preferred)) {
+            first.insert(first.begin(), addresses[i]);
+        } else {
+            (addresses[i].ss_family == preferred.ss_family ? first : second).push_back(addresses[i]);
+        }
+    }
+    std::vector<struct sockaddr_storage> arranged;
+    for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+        if (i < first.size()) {
+            arranged.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            arranged.push_back(second[i]);
+        }
+    }
+    return arranged;
+}
+
+static std::string lowercase(const std::string & host) {
+    std::string name(host);
+    for (size_t i = 0; i < name.length(); ++i) {
+        name[i] = (char)tolower((unsigned char)name[i]);
+    }
+    return name;
+}
+
+Resolver::Resolver(const ProxyConfig & config) :
+    stopping(false), default_ttl(config.dns_ttl), negative_ttl(config.dns_negative_ttl),
+    use_dns(false), dns_server_len(0), hosts_path(config.hosts_file), hits(0), negative_hits(0),
+    misses(0), coalesced(0), refreshes(0), failures(0), latency_total_us(0), latency_max_us(0) {
+    for (size_t i = 0; i < 32; ++i) {
+        latency_buckets[i] = 0;
+    }
+    memset(&dns_server, 0, sizeof(dns_server));
+    if (!config.dns_server.empty()) {
+        if (!parseDnsServer(config.dns_server, dns_server, dns_server_len)) {
+            throw std::invalid_argument("invalid dns server: " + config.dns_server);
+        }
+        use_dns = true;
+    }
+    if (!hosts_path.empty()) {
+        loadHosts();
+    }
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work, NULL);
+}
+
+Resolver::~Resolver() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&work);
+    pthread_mutex_destroy(&lock);
+}
+
+void Resolver::start() {
+    for (int i = 0; i < RESOLVER_THREADS; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadMain, this) != 0) {
+            throw std::runtime_error("failed to start resolver thread: " + getErrorMsg());
+        }
+        threads.push_back(thread);
+    }
+}
+
+/* address lines of the hosts file, later lines never override earlier ones */
+void Resolver::loadHosts() {
+    std::ifstream file(hosts_path.c_str());
+    if (!file) {
+        throw std::runtime_error("failed to open hosts file " + hosts_path);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string address;
+        ResolveResult parsed;
+        if (!(words >> address) || !parseNumeric(address, parsed)) {
+            continue;
+        }
+        std::string name;
+        while (words >> name) {
+            hosts[lowercase(name)].push_back(parsed.addresses[0]);
+        }
+    }
+}
+
+ResolveRequest::Ptr Resolver::resolve(const std::string & host, EventLoop * loop, ResolveCallback done,
+                                      ResolveResult & result) {
+    if (parseNumeric(host, result)) {
+        return ResolveRequest::Ptr();
+    }
+
+    std::string name = lowercase(host);
+    time_t now = monotonicSeconds();
+    pthread_mutex_lock(&lock);
+    if (names.size() >= RESOLVER_MAX_NAMES) {
+        purgeExpired(now);
+    }
+    Entry & entry = names[name];
+
+    if (entry.valid && now < entry.expires) {
+        result.error = entry.result.error;
+        result.addresses = arrange(entry.result.addresses, entry.preferred);
+        if (result.error != 0) {
+            negative_hits++;
+        } else {
+            hits++;
+            // the name is in use, have a fresh answer ready before this one expires
+            if (now >= entry.refresh_at && !entry.in_flight) {
+                refreshes++;
+                entry.in_flight = true;
+                jobs.push_back(name);
+                pthread_cond_signal(&work);
+            }
+        }
+        pthread_mutex_unlock(&lock);
+        return ResolveRequest::Ptr();
+    }
+
+    misses++;
+    ResolveRequest::Ptr request = std::make_shared<ResolveRequest>(std::move(done));
+    Waiter waiter = {loop, request};
+    entry.waiters.push_back(waiter);
+    if (entry.in_flight) {
+        coalesced++;
+    } else {
+        entry.in_flight = true;
+        jobs.push_back(name);
+        pthread_cond_signal(&work);
+    }
+    pthread_mutex_unlock(&lock);
+    return request;
+}
+
+ResolveResult Resolver::resolveNow(const std::string & host) {
+    ResolveResult result;
+    if (parseNumeric(host, result)) {
+        return result;
+    }
+
+    std::string name = lowercase(host);
+    time_t now = monotonicSeconds();
+    pthread_mutex_lock(&lock);
+    std::unordered_map<std::string, Entry>::iterator it = names.find(name);
+    if (it != names.end() && it->second.valid && now < it->second.expires) {
+        result.error = it->second.result.error;
+        result.addresses = arrange(it->second.result.addresses, it->second.preferred);
+        pthread_mutex_unlock(&lock);
+        hits++;
+        return result;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // rare: the name was resolved for the request that triggered this lookup
+    misses++;
+    int ttl;
+    return lookup(name, ttl);
+}
+
+void Resolver::preferAddress(const std::string & host, const struct sockaddr_storage & address) {
+    std::string name = lowercase(host);
+    pthread_mutex_lock(&lock);
+    std::unordered_map<std::string, Entry>::iterator it = names.find(name);
+    if (it != names.end()) {
+        it->second.preferred = address;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* drop expired names nobody waits for, called with the lock held */
+void Resolver::purgeExpired(time_t now) {
+    std::unordered_map<std::string, Entry>::iterator it = names.begin();
+    while (it != names.end()) {
+        if (!it->second.in_flight && (!it->second.valid || now >= it->second.expires)) {
+            it = names.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void * Resolver::threadMain(void * ptr) {
+    Resolver * resolver = (Resolver *)ptr;
+    resolver->runJobs();
+    return NULL;
+}
+
+void Resolver::runJobs() {
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (jobs.empty() && !stopping) {
+            pthread_cond_wait(&work, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        std::string name = jobs.front();
+        jobs.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        int ttl = 0;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        ResolveResult result = lookup(name, ttl);
+        recordLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - begin).count());
+        time_t now = monotonicSeconds();
+        ttl = std::max(0, std::min(ttl, RESOLVER_MAX_TTL));
+
+        pthread_mutex_lock(&lock);
+        Entry & entry = names[name];
+        entry.in_flight = false;
+        if (result.error != 0) {
+            failures++;
+            log_message(LOG_LEVEL_WARNING, "WARNING failed to resolve " + name + ": " + result.errorMessage());
+        }
+        if (result.error == 0 || result.error == EAI_NONAME) {
+            entry.result = result;
+            entry.valid = true;
+            entry.expires = now + ttl;
+            entry.refresh_at = result.error == 0 ? entry.expires - std::max(1, ttl / 10) : entry.expires;
+        } else if (entry.valid && now < entry.expires) {
+            // a refresh failed for a transient reason, keep serving the old
+            //  answer and try again in a second
+            entry.refresh_at = now + 1;
+        } else {
+            entry.valid = false;
+        }
+
+        std::vector<Waiter> waiters;
+        waiters.swap(entry.waiters);
+        result.addresses = arrange(result.addresses, entry.preferred);
+        pthread_mutex_unlock(&lock);
+
+        for (size_t i = 0; i < waiters.size(); ++i) {
+            ResolveRequest::Ptr request = waiters[i].request;
+            waiters[i].loop->runInLoop([request, result]() { request->complete(result); });
+        }
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+ResolveResult Resolver::lookup(const std::string & host, int & ttl) {
+    std::unordered_map<std::string, std::vector<struct sockaddr_storage> >::const_iterator it =
+        hosts.find(host);
+    if (it != hosts.end()) {
+        ResolveResult result;
+        result.addresses = it->second;
+        ttl = default_ttl;
+        return result;
+    }
+
+    if (use_dns) {
+        DnsAnswer answer = dnsQuery(dns_server, dns_server_len, host, RESOLVER_DNS_TIMEOUT_MS);
+        // answers too large for udp are left to the system resolver
+        if (!answer.truncated) {
+            ResolveResult result;
+            result.error = answer.error;
+            result.addresses.swap(answer.addresses);
+            if (result.error == 0) {
+                ttl = answer.ttl >= 0 ? answer.ttl : default_ttl;
+            } else {
+                ttl = answer.ttl >= 0 ? std::min(answer.ttl, negative_ttl) : negative_ttl;
+            }
+            return result;
+        }
+    }
+    return lookupSystem(host, ttl);
+}
+
+/* getaddrinfo tells no ttl, its answers are kept for the default ttl */
+ResolveResult Resolver::lookupSystem(const std::string & host, int & ttl) {
+    ResolveResult result;
+    struct addrinfo hints;
+    struct addrinfo * list = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    result.error = getaddrinfo(host.c_str(), NULL, &hints, &list);
+    if (result.error != 0) {
+        ttl = negative_ttl;
+        return result;
+    }
+
+    std::vector<struct sockaddr_storage> ipv4;
+    for (struct addrinfo * ai = list; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) {
+            continue;
+        }
+        struct sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+        std::vector<struct sockaddr_storage> & family = ai->ai_family == AF_INET6 ? result.addresses : ipv4;
+        bool duplicate = false;
+        for (size_t i = 0; i < family.size() && !duplicate; ++i) {
+            duplicate = memcmp(&family[i], &addr, sizeof(addr)) == 0;
+        }
+        if (!duplicate) {
+            family.push_back(addr);
+        }
+    }
+    freeaddrinfo(list);
+
+    result.addresses.insert(result.addresses.end(), ipv4.begin(), ipv4.end());
+    if (result.addresses.empty()) {
+        result.error = EAI_NONAME;
+        ttl = negative_ttl;
+    } else {
+        ttl = default_ttl;
+    }
+    return result;
+}
+
+void Resolver::recordLatency(uint64_t micros) {
+    size_t bucket = 0;
+    while (bucket < 31 && (micros >> (bucket + 1)) != 0) {
+        ++bucket;
+    }
+    latency_buckets[bucket]++;
+    latency_total_us += micros;
+    uint64_t max = latency_max_us.load();
+    while (micros > max && !latency_max_us.compare_exchange_weak(max, micros)) {
+    }
+}
+
+ResolverStats Resolver::getStats() const {
+    ResolverStats stats;
+    stats.hits = hits.load();
+    stats.negative_hits = negative_hits.load();
+    stats.misses = misses.load();
+    stats.coalesced = coalesced.load();
+    stats.refreshes = refreshes.load();
+    stats.failures = failures.load();
+
+    uint64_t buckets[32];
+    for (size_t i = 0; i < 32; ++i) {
+        buckets[i] = latency_buckets[i].load();
+        stats.lookups += buckets[i];
+    }
+    if (stats.lookups == 0) {
+        return stats;
+    }
+    stats.latency_avg_us = latency_total_us.load() / stats.lookups;
+    stats.latency_max_us = latency_max_us.load();
+
+    // percentiles are reported as the upper bound of their log2 bucket
+    uint64_t seen = 0;
+    for (size_t i = 0; i < 32; ++i) {
+        seen += buckets[i];
+        if (stats.latency_p50_us == 0 && seen * 2 >= stats.lookups) {
+            stats.latency_p50_us = std::min((uint64_t)2 << i, stats.latency_max_us);
+        }
+        if (seen * 100 >= stats.lookups * 99) {
+            stats.latency_p99_us = std::min((uint64_t)2 << i, stats.latency_max_us);
+            break;
+        }
+    }
+    return stats;
+}
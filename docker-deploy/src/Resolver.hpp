@@ -0,0 +1,187 @@
+#ifndef __RESOLVER_HPP_
+#define __RESOLVER_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class EventLoop;
+struct ProxyConfig;
+
+// threads running lookups in the background
+#define RESOLVER_THREADS 4
+// answers never stay cached longer than this, whatever their ttl
+#define RESOLVER_MAX_TTL 3600
+// expired names are purged once the cache holds this many
+#define RESOLVER_MAX_NAMES 10000
+// time a dns server has to answer both queries for a name
+#define RESOLVER_DNS_TIMEOUT_MS 2000
+
+/**
+ * Addresses of one host name, or why there are none
+ */
+struct ResolveResult {
+    // 0 on success, else an EAI_* code
+    int error;
+    // ports are left 0. The address that connected last time comes first,
+    //  then both families interleaved starting with its family (ipv6 at first)
+    std::vector<struct sockaddr_storage> addresses;
+
+    ResolveResult() : error(0) {}
+
+    std::string errorMessage() const;
+};
+
+typedef std::function<void(const ResolveResult &)> ResolveCallback;
+
+/**
+ * A lookup still running for a connection. The callback runs on the loop of
+ * the connection; cancel() (on that loop's thread) makes sure it never does.
+ */
+class ResolveRequest {
+private:
+    ResolveCallback done;
+    bool cancelled;
+
+public:
+    typedef std::shared_ptr<ResolveRequest> Ptr;
+
+    explicit ResolveRequest(ResolveCallback done) : done(std::move(done)), cancelled(false) {}
+
+    void cancel() { cancelled = true; }
+    void complete(const ResolveResult & result) {
+        if (!cancelled) {
+            done(result);
+        }
+    }
+};
+
+/**
+ * Counters of the resolver, lookup latency in microseconds
+ */
+struct ResolverStats {
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    // misses that joined a lookup already running for the name
+    uint64_t coalesced;
+    uint64_t refreshes;
+    uint64_t failures;
+    uint64_t lookups;
+    uint64_t latency_avg_us;
+    uint64_t latency_p50_us;
+    uint64_t latency_p99_us;
+    uint64_t latency_max_us;
+
+    ResolverStats() :
+        hits(0), negative_hits(0), misses(0), coalesced(0), refreshes(0), failures(0),
+        lookups(0), latency_avg_us(0), latency_p50_us(0), latency_p99_us(0), latency_max_us(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * Host name resolution off the event loops. Answers are cached for their ttl,
+ * failures for the negative ttl. Concurrent misses for one name share a single
+ * lookup, and a name that is still in use is looked up again in the
+ * background shortly before it expires, so busy names never miss.
+ *
+ * Lookups go to a hosts file first when one is configured, then either to a
+ * dns server over udp (which provides real ttls) or to getaddrinfo (whose
+ * answers are kept for the configured default ttl).
+ */
+class Resolver {
+private:
+    struct Waiter {
+        EventLoop * loop;
+        ResolveRequest::Ptr request;
+    };
+
+    struct Entry {
+        ResolveResult result;
+        bool valid;
+        // monotonic seconds
+        time_t expires;
+        time_t refresh_at;
+        bool in_flight;
+        std::vector<Waiter> waiters;
+        // address the last connection succeeded with
+        struct sockaddr_storage preferred;
+
+        Entry() : valid(false), expires(0), refresh_at(0), in_flight(false) {
+            memset(&preferred, 0, sizeof(preferred));
+            preferred.ss_family = AF_INET6;
+        }
+    };
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    std::unordered_map<std::string, Entry> names;
+    std::deque<std::string> jobs;
+    std::vector<pthread_t> threads;
+    bool stopping;
+
+    int default_ttl;
+    int negative_ttl;
+    bool use_dns;
+    struct sockaddr_storage dns_server;
+    socklen_t dns_server_len;
+    std::string hosts_path;
+    std::unordered_map<std::string, std::vector<struct sockaddr_storage> > hosts;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> negative_hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> refreshes;
+    std::atomic<uint64_t> failures;
+    // log2 buckets of lookup latency in microseconds
+    std::atomic<uint64_t> latency_buckets[32];
+    std::atomic<uint64_t> latency_total_us;
+    std::atomic<uint64_t> latency_max_us;
+
+    static void * threadMain(void * ptr);
+    void runJobs();
+    // the blocking lookup, sets ttl to how long the answer may be cached
+    ResolveResult lookup(const std::string & host, int & ttl);
+    ResolveResult lookupSystem(const std::string & host, int & ttl);
+    void loadHosts();
+    void recordLatency(uint64_t micros);
+    void purgeExpired(time_t now);
+
+    Resolver(const Resolver &);
+    Resolver & operator=(const Resolver &);
+
+public:
+    explicit Resolver(const ProxyConfig & config);
+    ~Resolver();
+
+    void start();
+
+    // numeric addresses and cached names are answered right away: result is
+    //  filled in and NULL returned. Otherwise the lookup continues in the
+    //  background and done runs on loop's thread with the answer
+    ResolveRequest::Ptr resolve(const std::string & host, EventLoop * loop, ResolveCallback done,
+                                ResolveResult & result);
+
+    // blocking lookup for threads outside the event loops, answered from the
+    //  cache when possible
+    ResolveResult resolveNow(const std::string & host);
+
+    // a connection to host succeeded with address, it and its family are
+    //  tried first from now on
+    void preferAddress(const std::string & host, const struct sockaddr_storage & address);
+
+    ResolverStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "ResponseFramer.hpp"
+#include <stdexcept>
+
+// longest chunk-size or trailer line accepted
+#define MAX_LINE_LENGTH 8192
+
+ResponseFramer::ResponseFramer() :
+    framing(UNTIL_CLOSE), chunk_state(CHUNK_SIZE), remaining(0), complete(false) {}
+
+ResponseFramer::Framing ResponseFramer::framingOf(const ResponseMeta & header) {
+    int status = header.getStatus();
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        return NO_BODY;
+    } else if (header.isChunked()) {
+        return CHUNKED;
+    } else if (header.getContentLength() >= 0) {
+        return CONTENT_LENGTH;
+    }
+    // no framing information, the origin closing the connection ends the body
+    return UNTIL_CLOSE;
+}
+
+void ResponseFramer::begin(const ResponseMeta & header) {
+    chunk_state = CHUNK_SIZE;
+    line.clear();
+    framing = framingOf(header);
+    remaining = framing == CONTENT_LENGTH ? header.getContentLength() : 0;
+    complete = framing == NO_BODY || (framing == CONTENT_LENGTH && remaining == 0);
+}
+
+size_t ResponseFramer::consume(const char * data, size_t len, std::vector<char> * payload) {
+    if (complete) {
+        return 0;
+    }
+
+    switch (framing) {
+        case CONTENT_LENGTH: {
+            size_t used = len < remaining ? len : remaining;
+            remaining -= used;
+            complete = remaining == 0;
+            if (payload) {
+                payload->insert(payload->end(), data, data + used);
+            }
+            return used;
+        }
+        case CHUNKED:
+            return consumeChunked(data, len, payload);
+        case UNTIL_CLOSE:
+            if (payload) {
+                payload->insert(payload->end(), data, data + len);
+            }
+            return len;
+        case NO_BODY:
+            break;
+    }
+    return 0;
+}
+
+size_t ResponseFramer::consumeChunked(const char * data, size_t len, std::vector<char> * payload) {
+    size_t i = 0;
+    while (i < len && !complete) {
+        if (chunk_state == CHUNK_DATA) {
+            // skip over chunk payload in one step
+            size_t used = len - i < remaining ? len - i : remaining;
+            if (payload) {
+                payload->insert(payload->end(), data + i, data + i + used);
+            }
+            i += used;
+            remaining -= used;
+            if (remaining == 0) {
+                chunk_state = CHUNK_DATA_END;
+            }
+            continue;
+        }
+
+        char c = data[i++];
+        if (c == '\n') {
+            endOfLine();
+        } else if (c != '\r') {
+            if (chunk_state == CHUNK_DATA_END) {
+                throw std::invalid_argument("Error: chunk data longer than its size");
+            }
+            if (line.length() >= MAX_LINE_LENGTH) {
+                throw std::invalid_argument("Error: chunk line too long");
+            }
+            line.push_back(c);
+        }
+    }
+    return i;
+}
+
+void ResponseFramer::endOfLine() {
+    switch (chunk_state) {
+        case CHUNK_SIZE: {
+            // chunk extensions after ';' are ignored
+            char * end = NULL;
+            unsigned long size = strtoul(line.c_str(), &end, 16);
+            if (end == line.c_str()) {
+                throw std::invalid_argument("Error: invalid chunk size");
+            }
+            remaining = size;
+            chunk_state = size == 0 ? TRAILER : CHUNK_DATA;
+            break;
+        }
+        case CHUNK_DATA_END:
+            chunk_state = CHUNK_SIZE;
+            break;
+        case TRAILER:
+            // trailer fields end with an empty line, they are forwarded but
+            //  not part of the payload
+            complete = line.empty();
+            break;
+        case CHUNK_DATA:
+            break;
+    }
+    line.clear();
+}
+
+bool ResponseFramer::finish() {
+    if (framing == UNTIL_CLOSE) {
+        complete = true;
+    }
+    return complete;
+}
+
+bool ResponseFramer::done() const {
+    return complete;
+}
+
+ResponseFramer::Framing ResponseFramer::getFraming() const {
+    return framing;
+}
@@ -0,0 +1,67 @@
+#ifndef __RESPONSE_FRAMER_HPP_
+#define __RESPONSE_FRAMER_HPP_
+
+#include <string>
+#include <vector>
+#include "ResponseMeta.hpp"
+
+/**
+ * Finds the end of an http response body while its bytes stream through.
+ * After begin() is given the response header, consume() is fed the body in
+ * arbitrary pieces and tells how many of them belong to the message, so the
+ * proxy can forward bytes as they arrive without buffering the whole response.
+ * Chunked bodies are tracked with an incremental state machine, every byte is
+ * looked at once no matter how the chunks are split across reads. The
+ * payload of the body can be collected on the way, with chunked framing
+ * and trailer fields removed, so it is stored with an explicit length.
+ */
+class ResponseFramer {
+public:
+    enum Framing {
+        NO_BODY,
+        CONTENT_LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE
+    };
+
+private:
+    enum ChunkState {
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILER
+    };
+
+    Framing framing;
+    ChunkState chunk_state;
+    // body bytes still expected, for Content-Length bodies and the current chunk
+    size_t remaining;
+    // partial chunk-size or trailer line carried over between reads
+    std::string line;
+    bool complete;
+
+    size_t consumeChunked(const char * data, size_t len, std::vector<char> * payload);
+    void endOfLine();
+
+public:
+    ResponseFramer();
+
+    // how the body of a response with this header is delimited
+    static Framing framingOf(const ResponseMeta & header);
+
+    // decide how the body is delimited from the parsed response header
+    void begin(const ResponseMeta & header);
+
+    // returns how many bytes of data belong to the body, the message is done
+    //  once done() turns true. The payload they carry is appended to payload
+    //  unless it is NULL
+    size_t consume(const char * data, size_t len, std::vector<char> * payload = NULL);
+
+    // the origin closed the connection, returns true if that ends the message
+    bool finish();
+
+    bool done() const;
+    Framing getFraming() const;
+};
+
+#endif
@@ -1,151 +1,324 @@
 #include "ResponseMeta.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 #include <time.h>
 
-ResponseMeta::ResponseMeta(std::string rh, std::string fl, std::string d,
-                           std::pair<bool, std::string> exp,
-                           std::pair<bool, std::string> lm, std::pair<bool, std::string> etag,
-                           std::pair<bool, std::string> age, std::pair<bool, std::string> cc,
-                           std::pair<bool, std::string> te) : res_head(rh),
-                                                               FirstLine(fl),
-                                                               Date(d),
-                                                               Expires(exp),
-                                                               LastModified(lm),
-                                                               Etag(etag),
-                                                               Age(age),
-                                                               CacheControl(cc),
-                                                               TransferEncoding(
-                                                                       te) {}
-
-ResponseMeta::~ResponseMeta() {}
-const std::string& ResponseMeta::getFirstLine(){
-    return this->FirstLine;
-}
-const std::string& ResponseMeta::getDate(){
-    return this->Date;
-}
-const std::pair<bool, std::string>& ResponseMeta::getExpires(){
-    return this->Expires;
-}
-const std::pair<bool, std::string>& ResponseMeta::getLastModified(){
-    return this->LastModified;
-}
-const std::pair<bool, std::string>& ResponseMeta::getEtag() {
-    return this->Etag;
-}
-const std::pair<bool, std::string>& ResponseMeta::getTransferEncoding() {
-    return this->TransferEncoding;
-}
-const std::pair<bool, std::string>& ResponseMeta::getAge() {
-    return this->Age;
-}
-const std::pair<bool, std::string>& ResponseMeta::getCacheControl(){
-    return this->CacheControl;
-}
-
-const bool ResponseMeta::checkCacheControl(std::string toCheck){
-    std::pair<bool, std::string> cc = getCacheControl();
-    if(cc.first){
-        size_t f = cc.second.find(toCheck);
-        if(f != std::string::npos){
-          return true;
+// names of the fields in ResponseMeta::Field, in order
+static const char * const KNOWN_NAMES[ResponseMeta::KNOWN_FIELDS] = {
+    "Date",
+    "Age",
+    "Expires",
+    "Last-Modified",
+    "ETag",
+    "Cache-Control",
+    "Content-Length",
+    "Transfer-Encoding",
+    "Content-Type",
+    "Content-Encoding",
+    "Vary",
+    "Connection"
+};
+
+ResponseMeta::ResponseMeta(std::string rh) :
+    res_head(std::move(rh)), status(0), date(-1), expires(-1), last_modified(-1),
+    age(0), content_length(-1), chunked(false), persistent(false) {
+    for (size_t i = 0; i < KNOWN_FIELDS; ++i) {
+        known[i] = -1;
+    }
+    parse();
+}
+
+void ResponseMeta::parse() {
+    const char * head = res_head.data();
+    size_t len = res_head.size();
+
+    size_t line_end = res_head.find('\n');
+    if (line_end == std::string::npos) {
+        line_end = len;
+    }
+    size_t first_end = line_end > 0 && head[line_end - 1] == '\r' ? line_end - 1 : line_end;
+    FirstLine = res_head.substr(0, first_end);
+    if (FirstLine.compare(0, 5, "HTTP/") != 0) {
+        throw std::invalid_argument("Error: invalid response status line");
+    }
+    size_t status_start = FirstLine.find(' ');
+    if (status_start != std::string::npos) {
+        status = atoi(FirstLine.c_str() + status_start + 1);
+    }
+
+    size_t i = line_end + 1;
+    while (i < len) {
+        size_t end = res_head.find('\n', i);
+        if (end == std::string::npos) {
+            end = len;
+        }
+        size_t colon = res_head.find(':', i);
+        if (colon != std::string::npos && colon < end) {
+            size_t value = colon + 1;
+            size_t value_end = end;
+            while (value < value_end && (head[value] == ' ' || head[value] == '\t')) {
+                ++value;
+            }
+            while (value_end > value && (head[value_end - 1] == '\r' || head[value_end - 1] == ' ' ||
+                                         head[value_end - 1] == '\t')) {
+                --value_end;
+            }
+            addField(i, colon - i, value, value_end - value);
+        }
+        i = end + 1;
+    }
+
+    // http/1.1 connections persist unless closed explicitly, http/1.0 ones
+    //  only when asked to
+    std::string connection = getValue(CONNECTION);
+    for (size_t c = 0; c < connection.length(); ++c) {
+        connection[c] = tolower((unsigned char)connection[c]);
+    }
+    if (FirstLine.compare(0, 9, "HTTP/1.1 ") == 0) {
+        persistent = connection.find("close") == std::string::npos;
+    } else {
+        persistent = connection.find("keep-alive") != std::string::npos;
+    }
+
+    if (date == -1) {
+        // a response without Date was generated when it reached us
+        date = time(NULL);
+    }
+}
+
+void ResponseMeta::addField(size_t name, size_t name_len, size_t value, size_t value_len) {
+    Entry entry = {(uint32_t)name, (uint32_t)name_len, (uint32_t)value, (uint32_t)value_len};
+    fields.push_back(entry);
+
+    const char * name_ptr = res_head.data() + name;
+    const char * value_ptr = res_head.data() + value;
+    for (int f = 0; f < KNOWN_FIELDS; ++f) {
+        if (!equalsIgnoreCase(name_ptr, name_len, KNOWN_NAMES[f])) {
+            continue;
+        }
+        bool first = known[f] == -1;
+        if (first) {
+            known[f] = (int16_t)(fields.size() - 1);
+        }
+
+        switch (f) {
+            case CACHE_CONTROL:
+                // repeated Cache-Control fields add up
+                cache_control.parse(value_ptr, value_len);
+                break;
+            case TRANSFER_ENCODING:
+                chunked = chunked || valueOf(entry).find("chunked") != std::string::npos;
+                break;
+            case CONTENT_LENGTH:
+                if (first) {
+                    char * end = NULL;
+                    long parsed = strtol(valueOf(entry).c_str(), &end, 10);
+                    content_length = end != NULL && *end == '\0' && value_len > 0 ? parsed : -1;
+                }
+                break;
+            case AGE:
+                if (first) {
+                    age = atol(valueOf(entry).c_str());
+                }
+                break;
+            case DATE:
+                if (first) {
+                    date = convertToTime(valueOf(entry));
+                }
+                break;
+            case EXPIRES:
+                if (first) {
+                    expires = convertToTime(valueOf(entry));
+                }
+                break;
+            case LAST_MODIFIED:
+                if (first) {
+                    last_modified = convertToTime(valueOf(entry));
+                }
+                break;
         }
+        break;
     }
-    return false;
 }
 
-const bool ResponseMeta::isNoCache(){
-    return checkCacheControl("no-cache");
+std::string ResponseMeta::valueOf(const Entry & entry) const {
+    return res_head.substr(entry.value, entry.value_len);
 }
-const bool ResponseMeta::isMustRevalidate(){
-    return checkCacheControl("must-revalidate");
+
+const std::string& ResponseMeta::getHead() const {
+    return res_head;
 }
-const bool ResponseMeta::isNoStore(){
-    return checkCacheControl("no-store");
+
+const std::string& ResponseMeta::getFirstLine() const {
+    return FirstLine;
 }
-const bool ResponseMeta::isPrivate(){
-    return checkCacheControl("private");
+
+int ResponseMeta::getStatus() const {
+    return status;
 }
 
-const std::pair<bool, std::string> ResponseMeta::getMaxAge(){
-    std::pair<bool, std::string> cc = getCacheControl();
-    if(cc.first){
-        size_t f1 = cc.second.find("max-age=");
-        if(f1 != std::string::npos){
-            size_t f2 = cc.second.find(",", f1+1);
-            if(f2 == std::string::npos){
-                f2 = cc.second.find("\r\n",f1+1);
-            }
-            std::string ans = cc.second.substr(f1+8,f2-f1-8);
-            return  std::pair<bool, std::string>(true, ans);
-        }
-    }
-    return std::pair<bool, std::string>(false, "");
-   }
-
-const std::pair<bool, std::string> ResponseMeta::get_sMaxAge(){
-    std::pair<bool, std::string> cc = getCacheControl();
-    if(cc.first){
-        size_t f1 = cc.second.find("s-maxage=");
-        if(f1 != std::string::npos){
-            size_t f2 = cc.second.find(",", f1+1);
-            if(f2 == std::string::npos){
-                f2 = cc.second.find("\r\n",f1+1);
-            }
-            std::string ans = cc.second.substr(f1+9,f2-f1-9);
-            return  std::pair<bool, std::string>(true, ans);
+bool ResponseMeta::has(Field field) const {
+    return known[field] != -1;
+}
+
+std::string ResponseMeta::getValue(Field field) const {
+    return has(field) ? valueOf(fields[known[field]]) : std::string();
+}
+
+std::pair<bool, std::string> ResponseMeta::getField(const std::string& name) const {
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (equalsIgnoreCase(res_head.data() + fields[i].name, fields[i].name_len, name.c_str())) {
+            return std::pair<bool, std::string>(true, valueOf(fields[i]));
         }
     }
     return std::pair<bool, std::string>(false, "");
 }
 
+std::pair<bool, std::string> ResponseMeta::getEtag() const {
+    return std::pair<bool, std::string>(has(ETAG), getValue(ETAG));
+}
 
+std::pair<bool, std::string> ResponseMeta::getLastModified() const {
+    return std::pair<bool, std::string>(has(LAST_MODIFIED), getValue(LAST_MODIFIED));
+}
+
+const CacheControl& ResponseMeta::getCacheControl() const {
+    return cache_control;
+}
+
+bool ResponseMeta::isNoCache() const {
+    return cache_control.has(CacheControl::NO_CACHE);
+}
+
+bool ResponseMeta::isMustRevalidate() const {
+    return cache_control.has(CacheControl::MUST_REVALIDATE);
+}
+
+bool ResponseMeta::isNoStore() const {
+    return cache_control.has(CacheControl::NO_STORE);
+}
+
+bool ResponseMeta::isPrivate() const {
+    return cache_control.has(CacheControl::PRIVATE);
+}
+
+long ResponseMeta::getContentLength() const {
+    return content_length;
+}
+
+bool ResponseMeta::isChunked() const {
+    return chunked;
+}
+
+bool ResponseMeta::isPersistent() const {
+    return persistent;
+}
 
 //is fresh: return true
-const bool ResponseMeta::if_fresh(){
-    //age field 不存在？
-    int age = std::stoi(getAge().second);
-    double fresh_lifetime;
+double ResponseMeta::freshnessLifetime() const {
     //s-maxage
-    if(get_sMaxAge().first){
-      fresh_lifetime = std::stoi(get_sMaxAge().second);
-     }
+    if (cache_control.s_maxage != CacheControl::UNSPECIFIED) {
+        return cache_control.s_maxage;
+    }
     //max-age
-    else if(getMaxAge().first){
-     fresh_lifetime = std::stoi(getMaxAge().second);
+    if (cache_control.max_age != CacheControl::UNSPECIFIED) {
+        return cache_control.max_age;
     }
-    //expires
-    else if(getExpires().first){
-    fresh_lifetime = std::stoi(getExpires().second);
+    //expires, an invalid date means already expired
+    if (has(EXPIRES)) {
+        return expires == -1 ? 0 : std::max(0.0, difftime(expires, date));
     }
     //last modified exist
-    else if(getLastModified().first){
-        time_t date = convertToTime(getDate());
-        time_t lastModified = convertToTime(getLastModified().second);
-        fresh_lifetime = difftime(date,lastModified)/10;
+    if (last_modified != -1) {
+        return std::max(0.0, difftime(date, last_modified) / 10);
     }
     //none of it exist
-    else{
-        return false;
-    }
-    if(fresh_lifetime > age){
-        return true;
-    }
-    else{
-        // TODO
-        log_info("in cache, but expired at ");
-        return false;
-    }
-
-
+    return -1;
 }
 
+double ResponseMeta::initialAge(time_t request_time, time_t response_time) const {
+    double apparent_age = std::max(0.0, difftime(response_time, date));
+    double response_delay = std::max(0.0, difftime(response_time, request_time));
+    return std::max(apparent_age, age + response_delay);
+}
 
+int ResponseMeta::staleWindow(int default_window) const {
+    // s-maxage implies proxy-revalidate for a shared cache
+    if (isNoCache() || isMustRevalidate() || cache_control.has(CacheControl::PROXY_REVALIDATE) ||
+        cache_control.s_maxage != CacheControl::UNSPECIFIED) {
+        return -1;
+    }
+    return cache_control.stale_while_revalidate != CacheControl::UNSPECIFIED ?
+           cache_control.stale_while_revalidate : default_window;
+}
 
+/* stored fields the 304 carries are replaced by its version, except those
+ * describing the stored body and the connection it came on. Age is dropped,
+ * the new Date restarts it */
+std::string ResponseMeta::updatedHead(const ResponseMeta& not_modified) const {
+    static const char * const kept_fields[] = {
+        "Content-Length", "Transfer-Encoding", "Content-Encoding", "Content-Range", "Connection",
+        "Keep-Alive", NULL
+    };
 
+    std::string head = FirstLine + "\r\n";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const char * name = res_head.data() + fields[i].name;
+        bool replaced = equalsIgnoreCase(name, fields[i].name_len, "Age");
+        for (size_t j = 0; j < not_modified.fields.size() && !replaced; ++j) {
+            const Entry & update = not_modified.fields[j];
+            replaced = fields[i].name_len == update.name_len &&
+                       equalsIgnoreCase(name, fields[i].name_len,
+                                        not_modified.res_head.substr(update.name, update.name_len).c_str());
+        }
+        for (size_t b = 0; kept_fields[b] != NULL && replaced; ++b) {
+            replaced = !equalsIgnoreCase(name, fields[i].name_len, kept_fields[b]);
+        }
+        if (!replaced) {
+            head.append(name, fields[i].name_len);
+            head += ": " + valueOf(fields[i]) + "\r\n";
+        }
+    }
 
+    for (size_t j = 0; j < not_modified.fields.size(); ++j) {
+        const Entry & update = not_modified.fields[j];
+        const char * name = not_modified.res_head.data() + update.name;
+        bool kept = false;
+        for (size_t b = 0; kept_fields[b] != NULL && !kept; ++b) {
+            kept = equalsIgnoreCase(name, update.name_len, kept_fields[b]);
+        }
+        if (!kept) {
+            head.append(name, update.name_len);
+            head += ": " + not_modified.valueOf(update) + "\r\n";
+        }
+    }
+    return head;
+}
 
+std::string ResponseMeta::withFields(const std::vector<std::pair<std::string, std::string> >& changes) const {
+    std::string head = FirstLine + "\r\n";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const char * name = res_head.data() + fields[i].name;
+        bool changed = false;
+        for (size_t j = 0; j < changes.size() && !changed; ++j) {
+            changed = equalsIgnoreCase(name, fields[i].name_len, changes[j].first.c_str());
+        }
+        if (!changed) {
+            head.append(name, fields[i].name_len);
+            head += ": " + valueOf(fields[i]) + "\r\n";
+        }
+    }
+    for (size_t j = 0; j < changes.size(); ++j) {
+        if (!changes[j].second.empty()) {
+            head += changes[j].first + ": " + changes[j].second + "\r\n";
+        }
+    }
+    return head;
+}
 
-
-
-
-
+size_t ResponseMeta::footprint() const {
+    return sizeof(*this) + res_head.capacity() + FirstLine.capacity() + fields.capacity() * sizeof(Entry);
+}
@@ -1,59 +1,122 @@
-
-
 #ifndef INC_568_RESPONSE_HPP
 #define INC_568_RESPONSE_HPP
 
+#include <stdint.h>
+#include <ctime>
+#include <memory>
 #include <string>
+#include <vector>
+#include "CacheControl.hpp"
 #include "Util.hpp"
 
-
+/**
+ * A response header parsed once into a table of fields. Every field is kept
+ * as offsets into the header text, the headers the proxy acts on are located
+ * while parsing, and Cache-Control, dates and lengths are converted to numbers
+ * right away. The parsed header is immutable and stored next to the cached
+ * body, so a cache hit answers its questions without scanning any text.
+ */
 class ResponseMeta
 {
+public:
+    typedef std::shared_ptr<const ResponseMeta> Ptr;
+
+    // fields looked up by index instead of by name
+    enum Field {
+        DATE,
+        AGE,
+        EXPIRES,
+        LAST_MODIFIED,
+        ETAG,
+        CACHE_CONTROL,
+        CONTENT_LENGTH,
+        TRANSFER_ENCODING,
+        CONTENT_TYPE,
+        CONTENT_ENCODING,
+        VARY,
+        CONNECTION,
+        KNOWN_FIELDS
+    };
+
 private:
+    struct Entry {
+        uint32_t name;
+        uint32_t name_len;
+        uint32_t value;
+        uint32_t value_len;
+    };
+
     std::string res_head;
     std::string FirstLine;
-    std::string Date;
-    std::pair<bool, std::string> Expires;
-    std::pair<bool, std::string> LastModified;
-    std::pair<bool, std::string> Etag;
-    std::pair<bool, std::string> Age;
-
-    std::pair<bool, std::string> CacheControl;
-    std::pair<bool, std::string> TransferEncoding;
-
-
+    int status;
+    std::vector<Entry> fields;
+    // index into fields of the first occurrence of each known field, -1 if absent
+    int16_t known[KNOWN_FIELDS];
+
+    CacheControl cache_control;
+    // -1 when absent or unparseable, a missing Date is the time of parsing
+    time_t date;
+    time_t expires;
+    time_t last_modified;
+    long age;
+    long content_length;
+    bool chunked;
+    bool persistent;
+
+    void parse();
+    void addField(size_t name, size_t name_len, size_t value, size_t value_len);
+    std::string valueOf(const Entry & entry) const;
 
 public:
-    ResponseMeta(std::string rh, std::string fl, std::string d, std::pair<bool, std::string> exp,
-                 std::pair<bool, std::string> lm, std::pair<bool, std::string> etag, std::pair<bool, std::string> age,
-                 std::pair<bool, std::string> cc, std::pair<bool, std::string> te);
-
-    const std::string& getFirstLine();
-    const std::string& getDate();
-    const std::pair<bool, std::string>& getExpires();
-    const std::pair<bool, std::string>& getLastModified();
-    const std::pair<bool, std::string>& getEtag();
-    const std::pair<bool, std::string>& getAge();
-    const std::pair<bool, std::string>& getTransferEncoding();
-    const std::pair<bool, std::string>& getCacheControl();
-
-    const bool checkCacheControl(std::string toCheck);
-    const bool isNoCache();
-    const bool isMustRevalidate();
-    const bool isPrivate();
-    const bool isNoStore();
-    const std::pair<bool, std::string> getMaxAge();
-    const std::pair<bool, std::string> get_sMaxAge();
-    const bool if_fresh();
-
-    
-
-
-
-
-
-    ~ResponseMeta();
-
+    // res_head runs from the status line up to the empty line, throws
+    //  std::invalid_argument if it does not start with a status line
+    explicit ResponseMeta(std::string res_head);
+
+    const std::string& getHead() const;
+    const std::string& getFirstLine() const;
+    int getStatus() const;
+
+    bool has(Field field) const;
+    // value of a known field, empty if absent
+    std::string getValue(Field field) const;
+    // case-insensitive lookup of any field
+    std::pair<bool, std::string> getField(const std::string& name) const;
+
+    std::pair<bool, std::string> getEtag() const;
+    std::pair<bool, std::string> getLastModified() const;
+
+    const CacheControl& getCacheControl() const;
+    bool isNoCache() const;
+    bool isMustRevalidate() const;
+    bool isPrivate() const;
+    bool isNoStore() const;
+
+    // -1 without a Content-Length field
+    long getContentLength() const;
+    bool isChunked() const;
+    // whether the origin keeps the connection open after this response
+    bool isPersistent() const;
+
+    // seconds the response stays fresh, -1 if it carries no hint at all
+    double freshnessLifetime() const;
+    // corrected initial age (RFC 9111 section 4.2.3) of the response to a
+    //  request sent at request_time, received at response_time
+    double initialAge(time_t request_time, time_t response_time) const;
+    // seconds past expiry the response may still be served while it is
+    //  revalidated in the background: its stale-while-revalidate window, or
+    //  default_window when it has none, -1 when the origin demands
+    //  revalidation
+    int staleWindow(int default_window) const;
+
+    // header text of this stored response updated by the fields of a 304
+    //  answer to its revalidation
+    std::string updatedHead(const ResponseMeta& not_modified) const;
+    // header text with every field named in changes replaced by the given
+    //  value, or dropped when the value is empty
+    std::string withFields(const std::vector<std::pair<std::string, std::string> >& changes) const;
+
+    // bytes of memory held by this header
+    size_t footprint() const;
 };
 
 #endif //INC_568_RESPONSE_HPP
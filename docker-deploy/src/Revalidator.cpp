@@ -0,0 +1,287 @@
+#include "Revalidator.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "Config.hpp"
+#include "HttpParser.hpp"
+#include "Resolver.hpp"
+#include "ResponseFramer.hpp"
+
+#define READ_CHUNK_SIZE 16384
+
+std::string RevalidatorStats::toString() const {
+    std::stringstream ss;
+    ss << "queued=" << queued << " dropped=" << dropped << " refreshed=" << refreshed
+       << " replaced=" << replaced << " failed=" << failed << " prefetched=" << prefetched;
+    return ss.str();
+}
+
+Revalidator::Revalidator(Cache * cache, Resolver * resolver, const ProxyConfig & config) :
+    cache(cache), resolver(resolver), connect_timeout(config.connect_timeout), stopping(false),
+    queued(0), dropped(0), refreshed(0), replaced(0), failed(0), prefetched(0) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work, NULL);
+}
+
+Revalidator::~Revalidator() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&work);
+    pthread_mutex_destroy(&lock);
+}
+
+void Revalidator::start() {
+    for (int i = 0; i < REVALIDATOR_THREADS; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadMain, this) != 0) {
+            throw std::runtime_error("failed to start revalidation thread: " + getErrorMsg());
+        }
+        threads.push_back(thread);
+    }
+}
+
+bool Revalidator::submit(const CacheKey & key, const CacheEntry::Ptr & stale, const RequestMeta & req,
+                         const std::string & request) {
+    Job job;
+    job.key = key;
+    job.stale = stale;
+    job.req = std::make_shared<const RequestMeta>(req);
+    job.request = request;
+    return enqueue(job);
+}
+
+bool Revalidator::prefetch(const CacheKey & key, const RequestMeta & req, const std::string & request) {
+    Job job;
+    job.key = key;
+    job.req = std::make_shared<const RequestMeta>(req);
+    job.request = request;
+    return enqueue(job);
+}
+
+bool Revalidator::enqueue(const Job & job) {
+    pthread_mutex_lock(&lock);
+    if (jobs.size() >= REVALIDATOR_QUEUE_SIZE) {
+        pthread_mutex_unlock(&lock);
+        dropped++;
+        cache->getFetches().end(job.key, CacheEntry::Ptr());
+        return false;
+    }
+    jobs.push_back(job);
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+    queued++;
+    return true;
+}
+
+void * Revalidator::threadMain(void * ptr) {
+    ((Revalidator *)ptr)->runJobs();
+    return NULL;
+}
+
+void Revalidator::runJobs() {
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (jobs.empty() && !stopping) {
+            pthread_cond_wait(&work, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        Job job = jobs.front();
+        jobs.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        CacheEntry::Ptr entry;
+        try {
+            entry = revalidate(job);
+        } catch (const std::exception & e) {
+            failed++;
+            log_message(LOG_LEVEL_WARNING, std::string("WARNING background ") +
+                        (job.stale ? "revalidation" : "prefetch") + " of " + job.req->getFirstLine() +
+                        " failed: " + std::string(e.what()));
+        }
+        cache->getFetches().end(job.key, entry);
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* blocking connect to the first address of the origin that answers */
+int Revalidator::connectOrigin(const Job & job) {
+    ResolveResult result = resolver->resolveNow(job.req->getHost());
+    if (result.error != 0) {
+        throw std::runtime_error("failed to resolve " + job.req->getHost() + ": " + result.errorMessage());
+    }
+
+    std::string error = "no address to connect to";
+    for (size_t i = 0; i < result.addresses.size(); ++i) {
+        struct sockaddr_storage addr = result.addresses[i];
+        socklen_t addr_len;
+        if (addr.ss_family == AF_INET6) {
+            ((struct sockaddr_in6 *)&addr)->sin6_port = htons(job.req->getPort());
+            addr_len = sizeof(struct sockaddr_in6);
+        } else {
+            ((struct sockaddr_in *)&addr)->sin_port = htons(job.req->getPort());
+            addr_len = sizeof(struct sockaddr_in);
+        }
+
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            error = "failed to create socket: " + getErrorMsg();
+            continue;
+        }
+        int status = connect(fd, (struct sockaddr *)&addr, addr_len);
+        if (status == -1 && errno == EINPROGRESS) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            if (poll(&pfd, 1, connect_timeout * 1000) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0) {
+                status = 0;
+            } else {
+                errno = err != 0 ? err : ETIMEDOUT;
+            }
+        }
+        if (status == -1) {
+            error = "failed to establish connection with remote server: " + getErrorMsg();
+            close(fd);
+            continue;
+        }
+
+        // the rest of the exchange blocks, bounded by socket timeouts
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        struct timeval timeout = {REVALIDATOR_IO_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        return fd;
+    }
+    throw std::runtime_error(error);
+}
+
+CacheEntry::Ptr Revalidator::revalidate(const Job & job) {
+    time_t request_time = time(NULL);
+    time_t response_time = request_time;
+    int fd = connectOrigin(job);
+    // bytes received until the header is complete, then the header and the
+    //  payload that is stored
+    std::vector<char> resp;
+    std::vector<char> stored;
+    ResponseMeta::Ptr header;
+    ResponseFramer framer;
+    try {
+        size_t sent = 0;
+        while (sent < job.request.size()) {
+            ssize_t n = send(fd, job.request.data() + sent, job.request.size() - sent, MSG_NOSIGNAL);
+            if (n == -1 && errno != EINTR) {
+                throw std::runtime_error("failed to send: " + getErrorMsg());
+            }
+            sent += n > 0 ? n : 0;
+        }
+
+        size_t header_len = 0;
+        bool eof = false;
+        char buffer[READ_CHUNK_SIZE];
+        while (!framer.done()) {
+            ssize_t rcvd = recv(fd, buffer, sizeof(buffer), 0);
+            if (rcvd == -1 && errno == EINTR) {
+                continue;
+            }
+            if (rcvd == -1) {
+                throw std::runtime_error("failed to receive: " + getErrorMsg());
+            }
+            eof = rcvd == 0;
+            if (eof && (!header || !framer.finish())) {
+                throw std::runtime_error("server closed before sending the full response");
+            }
+            if (eof) {
+                break;
+            }
+            if (header) {
+                framer.consume(buffer, rcvd, &stored);
+            } else {
+                resp.insert(resp.end(), buffer, buffer + rcvd);
+                std::pair<bool, size_t> ans = HttpParser::findEmptyLine(resp);
+                if (!ans.first) {
+                    continue;
+                }
+                header_len = ans.second + 4;
+                header = std::make_shared<const ResponseMeta>(HttpParser::parseRespHeader(resp));
+                response_time = time(NULL);
+                if (header->getStatus() == 304) {
+                    break;
+                }
+                if (!cache->store_response(*header)) {
+                    break;
+                }
+                framer.begin(*header);
+                stored.assign(resp.begin(), resp.begin() + header_len);
+                framer.consume(resp.data() + header_len, resp.size() - header_len, &stored);
+            }
+            if (stored.size() > cache->getMaxObjectBytes()) {
+                throw std::runtime_error("response too large to be cached");
+            }
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (!job.stale) {
+        if (header->getStatus() == 304 || !framer.done() || !cache->store_response(*header)) {
+            throw std::runtime_error("\"" + header->getFirstLine() + "\" cannot be stored");
+        }
+        prefetched++;
+        log_info("background prefetch of " + job.req->getFirstLine() + ": \"" + header->getFirstLine() + "\"");
+        return cache->put(cache->storeKey(*job.req, header), std::move(stored), header, request_time, response_time);
+    }
+    if (header->getStatus() == 304) {
+        refreshed++;
+        log_info("background revalidation of " + job.req->getFirstLine() + ": still valid");
+        return cache->refresh(job.key, job.stale, *header, request_time, response_time);
+    }
+    if (header->getStatus() >= 500) {
+        // keep serving the stale copy rather than an error
+        failed++;
+        log_message(LOG_LEVEL_WARNING, "WARNING background revalidation of " + job.req->getFirstLine() +
+                    " got \"" + header->getFirstLine() + "\", keeping the stale entry");
+        return CacheEntry::Ptr();
+    }
+    replaced++;
+    log_info("background revalidation of " + job.req->getFirstLine() + ": \"" + header->getFirstLine() + "\"");
+    if (!framer.done() || !cache->store_response(*header)) {
+        cache->remove(job.key);
+        return CacheEntry::Ptr();
+    }
+    // a response varying differently belongs under another key
+    CacheKey key = cache->storeKey(*job.req, header);
+    if (key != job.key) {
+        cache->remove(job.key);
+    }
+    return cache->put(key, std::move(stored), header, request_time, response_time);
+}
+
+RevalidatorStats Revalidator::getStats() const {
+    RevalidatorStats stats;
+    stats.queued = queued.load();
+    stats.dropped = dropped.load();
+    stats.refreshed = refreshed.load();
+    stats.replaced = replaced.load();
+    stats.failed = failed.load();
+    stats.prefetched = prefetched.load();
+    return stats;
+}
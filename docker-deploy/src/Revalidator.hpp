@@ -0,0 +1,114 @@
+#ifndef __REVALIDATOR_HPP_
+#define __REVALIDATOR_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cache.hpp"
+
+class Resolver;
+struct ProxyConfig;
+
+// threads revalidating stale entries in the background
+#define REVALIDATOR_THREADS 2
+// revalidations waiting for a thread, more are not started
+#define REVALIDATOR_QUEUE_SIZE 1024
+// seconds a background revalidation may wait on a send or receive
+#define REVALIDATOR_IO_TIMEOUT 30
+
+/**
+ * Counters of the background revalidations
+ */
+struct RevalidatorStats {
+    uint64_t queued;
+    // the queue was full, the entry stays stale until a later request
+    uint64_t dropped;
+    // answered 304, the entry is fresh again
+    uint64_t refreshed;
+    // answered with a new response, stored or removed
+    uint64_t replaced;
+    // unreachable origin or a response that is neither, the stale entry is kept
+    uint64_t failed;
+    // whole responses fetched for range requests that missed
+    uint64_t prefetched;
+
+    RevalidatorStats() : queued(0), dropped(0), refreshed(0), replaced(0), failed(0), prefetched(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * Background revalidation of stale entries served within their
+ * stale-while-revalidate window. Connections hand the conditional request
+ * over and answer their client from the stale entry right away, a few
+ * threads with blocking sockets then ask the origin and store the refreshed
+ * entry. Each revalidation leads the fetch of its key in the cache's
+ * FetchTable, so a key is never revalidated twice at once and requests that
+ * cannot be served stale wait for the result.
+ * Range requests that miss have the same threads fetch the whole response,
+ * so the ranges asked for next are cut from the cache.
+ */
+class Revalidator {
+private:
+    struct Job {
+        CacheKey key;
+        // empty when prefetching
+        CacheEntry::Ptr stale;
+        // the client request that found the stale entry
+        std::shared_ptr<const RequestMeta> req;
+        // conditional request sent to the origin
+        std::string request;
+    };
+
+    Cache * cache;
+    Resolver * resolver;
+    int connect_timeout;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    std::deque<Job> jobs;
+    std::vector<pthread_t> threads;
+    bool stopping;
+
+    std::atomic<uint64_t> queued;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> refreshed;
+    std::atomic<uint64_t> replaced;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> prefetched;
+
+    static void * threadMain(void * ptr);
+    void runJobs();
+    bool enqueue(const Job & job);
+    // the revalidated entry, empty if the stale one is kept or was removed
+    CacheEntry::Ptr revalidate(const Job & job);
+    int connectOrigin(const Job & job);
+
+    Revalidator(const Revalidator &);
+    Revalidator & operator=(const Revalidator &);
+
+public:
+    Revalidator(Cache * cache, Resolver * resolver, const ProxyConfig & config);
+    ~Revalidator();
+
+    void start();
+
+    // revalidate stale, stored under key and found for req, with req's origin
+    //  by sending request. The caller must lead the fetch of key, which is
+    //  ended here in any case. Returns false if the queue is full
+    bool submit(const CacheKey & key, const CacheEntry::Ptr & stale, const RequestMeta & req,
+                const std::string & request);
+    // fetch and store the whole response missed under key by the range
+    //  request req, by sending request. Leading the fetch is the same as for
+    //  submit()
+    bool prefetch(const CacheKey & key, const RequestMeta & req, const std::string & request);
+
+    RevalidatorStats getStats() const;
+};
+
+#endif
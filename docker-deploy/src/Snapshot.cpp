@@ -0,0 +1,184 @@
+#include "Snapshot.hpp"
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+std::string SnapshotStats::toString() const {
+    std::stringstream ss;
+    ss << "loaded=" << loaded << " expired=" << expired << " corrupt=" << corrupt << " skipped=" << skipped;
+    return ss.str();
+}
+
+static int64_t wallMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a deadline moved from one clock to another, both read at the same moment
+static int64_t convertDeadline(int64_t deadline, int64_t from_now, int64_t to_now) {
+    return deadline == INT64_MAX ? deadline : to_now + (deadline - from_now);
+}
+
+Snapshot::Snapshot(const std::string & path) : path(path), count(0) {}
+
+uint32_t Snapshot::headerCrc(const Header & header) {
+    uint32_t crc = crc32Of((const char *)&header.count, sizeof(header.count));
+    return crc32Of((const char *)&header.created, sizeof(header.created), crc);
+}
+
+uint32_t Snapshot::recordCrc(const Record & record, const char * resp) {
+    uint32_t crc = crc32Of((const char *)&record.key, sizeof(record.key));
+    crc = crc32Of((const char *)&record.flags, sizeof(record.flags), crc);
+    crc = crc32Of((const char *)&record.fresh_until, sizeof(record.fresh_until), crc);
+    crc = crc32Of((const char *)&record.stale_until, sizeof(record.stale_until), crc);
+    crc = crc32Of((const char *)&record.purge_at, sizeof(record.purge_at), crc);
+    return crc32Of(resp, record.length, crc);
+}
+
+bool Snapshot::open() {
+    if (access(path.c_str(), F_OK) != 0) {
+        log_info("no cache snapshot at " + path + ", starting cold");
+        return false;
+    }
+    try {
+        file = std::make_shared<DiskSegment>(path);
+    } catch (const std::exception & e) {
+        log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
+        return false;
+    }
+
+    Header header;
+    if (file->size() < sizeof(header)) {
+        log_message(LOG_LEVEL_WARNING, "WARNING cache snapshot " + path + " is truncated, ignored");
+        file.reset();
+        return false;
+    }
+    memcpy(&header, file->at(0), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.crc != headerCrc(header)) {
+        log_message(LOG_LEVEL_WARNING, "WARNING cache snapshot " + path + " has an unknown format, ignored");
+        file.reset();
+        return false;
+    }
+    count = header.count;
+    // records are read once front to back
+    madvise((void *)file->at(0), file->size(), MADV_SEQUENTIAL);
+    return true;
+}
+
+SnapshotStats Snapshot::load(Cache & cache) {
+    SnapshotStats stats;
+    int64_t now_ms = monotonicMillis();
+    int64_t wall_ms = wallMillis();
+    size_t offset = sizeof(Header);
+    for (uint64_t i = 0; i < count; ++i) {
+        Record record;
+        if (offset + sizeof(record) > file->size()) {
+            stats.corrupt += count - i;
+            break;
+        }
+        memcpy(&record, file->at(offset), sizeof(record));
+        offset += sizeof(record);
+        if (record.length > file->size() - offset) {
+            stats.corrupt += count - i;
+            break;
+        }
+        const char * resp = file->at(offset);
+        offset += record.length;
+        if (recordCrc(record, resp) != record.crc) {
+            stats.corrupt++;
+            continue;
+        }
+
+        try {
+            const char * terminator = "\r\n\r\n";
+            const char * head_end = std::search(resp, resp + record.length, terminator, terminator + 4);
+            size_t head_len = head_end == resp + record.length ? record.length : head_end - resp + 2;
+            ResponseMeta::Ptr header = std::make_shared<const ResponseMeta>(std::string(resp, head_len));
+            if (record.flags & VARY_MARKER) {
+                // markers carry no response to expire
+                if (cache.restore(record.key, std::make_shared<const CacheEntry>(header))) {
+                    stats.loaded++;
+                } else {
+                    stats.skipped++;
+                }
+                continue;
+            }
+            // the time spent in the file counts, whether or not the response has a Date
+            Freshness freshness;
+            freshness.fresh_until = convertDeadline(record.fresh_until, wall_ms, now_ms);
+            freshness.stale_until = convertDeadline(record.stale_until, wall_ms, now_ms);
+            freshness.purge_at = convertDeadline(record.purge_at, wall_ms, now_ms);
+            if (now_ms >= freshness.purge_at) {
+                stats.expired++;
+                continue;
+            }
+            CacheEntry::Ptr entry = std::make_shared<const CacheEntry>(file, resp - file->at(0), record.length,
+                                                                       header, freshness, false);
+            if (cache.restore(record.key, entry)) {
+                stats.loaded++;
+            } else {
+                stats.skipped++;
+            }
+        } catch (const std::exception &) {
+            stats.corrupt++;
+        }
+    }
+    // entries keep the mapping alive as long as they need it
+    file.reset();
+    return stats;
+}
+
+size_t Snapshot::save(Cache & cache) {
+    std::vector<std::pair<CacheKey, CacheEntry::Ptr> > entries = cache.listEntries();
+    std::string temp = path + ".tmp";
+    FILE * out = fopen(temp.c_str(), "wbe");
+    if (out == NULL) {
+        throw std::runtime_error("failed to create " + temp + ": " + getErrorMsg());
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.count = entries.size();
+    header.created = time(NULL);
+    header.crc = headerCrc(header);
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    int64_t now_ms = monotonicMillis();
+    int64_t wall_ms = wallMillis();
+    for (size_t i = 0; i < entries.size() && written; ++i) {
+        const CacheEntry & entry = *entries[i].second;
+        const Freshness & freshness = entry.getFreshness();
+        Record record;
+        record.key = entries[i].first;
+        record.length = entry.size();
+        record.flags = entry.isVaryMarker() ? VARY_MARKER : 0;
+        record.fresh_until = convertDeadline(freshness.fresh_until, now_ms, wall_ms);
+        record.stale_until = convertDeadline(freshness.stale_until, now_ms, wall_ms);
+        record.purge_at = convertDeadline(freshness.purge_at, now_ms, wall_ms);
+        record.crc = recordCrc(record, entry.data());
+        written = fwrite(&record, sizeof(record), 1, out) == 1 &&
+                  fwrite(entry.data(), 1, entry.size(), out) == entry.size();
+    }
+
+    // only a complete snapshot replaces the previous one
+    written = fflush(out) == 0 && written && fsync(fileno(out)) == 0;
+    std::string error = getErrorMsg();
+    written = fclose(out) == 0 && written;
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        error = written ? getErrorMsg() : error;
+        unlink(temp.c_str());
+        throw std::runtime_error("failed to write cache snapshot " + path + ": " + error);
+    }
+    return entries.size();
+}
@@ -0,0 +1,94 @@
+#ifndef __SNAPSHOT_HPP_
+#define __SNAPSHOT_HPP_
+
+#include <stdint.h>
+#include <string>
+
+#include "Cache.hpp"
+
+#define SNAPSHOT_MAGIC "HCPSNAP"
+// bumped whenever the layout below changes, other versions are ignored
+#define SNAPSHOT_VERSION 4
+
+/**
+ * Counters of the last snapshot load
+ */
+struct SnapshotStats {
+    uint64_t loaded;
+    // of no use anymore when they were read, not even to be revalidated
+    uint64_t expired;
+    // failed their checksum or did not fit the file
+    uint64_t corrupt;
+    // already cached by live traffic, or too large for this cache
+    uint64_t skipped;
+
+    SnapshotStats() : loaded(0), expired(0), corrupt(0), skipped(0) {}
+
+    std::string toString() const;
+};
+
+/**
+ * The in-memory cache saved to one file, so a restarted proxy does not start
+ * cold. The file is a versioned header followed by one record per entry: its
+ * 128-bit key, response length, whether it is a vary marker, its freshness
+ * deadlines on the wall clock and a crc-32 of all of these and the response,
+ * then the response bytes. Entries thus keep aging while the proxy is down.
+ * It is written to a temporary file that replaces the previous snapshot only
+ * once complete.
+ *
+ * Loading maps the file and hands its records to the cache as entries that
+ * point into the mapping. open() only checks the header, so the proxy can
+ * accept clients right away while load() verifies and inserts the records
+ * from a background thread; their pages come in as they are read. The disk
+ * tier is not part of the snapshot.
+ */
+class Snapshot {
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        // crc-32 of the fields below
+        uint32_t crc;
+        uint64_t count;
+        int64_t created;
+    };
+
+    struct Record {
+        CacheKey key;
+        uint64_t length;
+        // crc-32 of the other fields and the response bytes
+        uint32_t crc;
+        uint32_t flags;
+        // the entry's Freshness in unix milliseconds, INT64_MAX for never
+        int64_t fresh_until;
+        int64_t stale_until;
+        int64_t purge_at;
+    };
+
+    // the record holds the header of a vary marker
+    static const uint32_t VARY_MARKER = 1;
+
+    std::string path;
+    DiskSegment::Ptr file;
+    uint64_t count;
+
+    static uint32_t headerCrc(const Header & header);
+    static uint32_t recordCrc(const Record & record, const char * resp);
+
+    Snapshot(const Snapshot &);
+    Snapshot & operator=(const Snapshot &);
+
+public:
+    explicit Snapshot(const std::string & path);
+
+    // map the snapshot and check its header, false if there is no usable one
+    bool open();
+    // insert every intact and unexpired record into cache
+    SnapshotStats load(Cache & cache);
+    // replace the snapshot by the current contents of cache, returns the
+    //  number of entries written, throws on failure. Must not overlap a load,
+    //  the records not loaded yet would be lost
+    size_t save(Cache & cache);
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "UpstreamPool.hpp"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "Util.hpp"
+
+PoolStats & PoolStats::operator+=(const PoolStats & other) {
+    hits += other.hits;
+    misses += other.misses;
+    closed += other.closed;
+    expired += other.expired;
+    idle += other.idle;
+    return *this;
+}
+
+std::string PoolStats::toString() const {
+    std::stringstream ss;
+    ss << "hits=" << hits << " misses=" << misses << " closed=" << closed
+       << " expired=" << expired << " idle=" << idle;
+    return ss.str();
+}
+
+void UpstreamPool::Idle::onEvent(int fd, uint32_t events) {
+    // nothing is expected on an idle connection, the origin either closed it
+    //  or sent bytes that belong to no request
+    if (pool != NULL) {
+        pool->closed++;
+        pool->drop(this);
+    }
+}
+
+UpstreamPool::UpstreamPool(EventLoop * loop, size_t per_host, int idle_timeout) :
+    loop(loop), per_host(per_host), idle_timeout(idle_timeout), idle_count(0),
+    hits(0), misses(0), closed(0), expired(0) {}
+
+UpstreamPool::~UpstreamPool() {
+    for (std::unordered_map<std::string, std::vector<Idle *> >::iterator it = idle.begin();
+         it != idle.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            close(it->second[i]->watch.fd);
+            delete it->second[i];
+        }
+    }
+}
+
+bool UpstreamPool::stillOpen(int fd) {
+    char byte;
+    ssize_t rcvd = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return rcvd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* take conn out of the pool without closing its socket */
+void UpstreamPool::remove(Idle * conn) {
+    std::unordered_map<std::string, std::vector<Idle *> >::iterator it = idle.find(conn->key);
+    if (it != idle.end()) {
+        std::vector<Idle *> & conns = it->second;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (conns[i] == conn) {
+                conns.erase(conns.begin() + i);
+                break;
+            }
+        }
+        if (conns.empty()) {
+            idle.erase(it);
+        }
+    }
+    idle_count--;
+    loop->unwatch(&conn->watch);
+    // events of this batch may still refer to conn
+    conn->pool = NULL;
+    loop->retire(conn);
+}
+
+void UpstreamPool::drop(Idle * conn) {
+    int fd = conn->watch.fd;
+    remove(conn);
+    close(fd);
+}
+
+int UpstreamPool::acquire(const std::string & key) {
+    std::unordered_map<std::string, std::vector<Idle *> >::iterator it = idle.find(key);
+    while (it != idle.end()) {
+        Idle * conn = it->second.back();
+        int fd = conn->watch.fd;
+        // the vector and the map entry go away with the last connection
+        bool last = it->second.size() == 1;
+        remove(conn);
+        if (stillOpen(fd)) {
+            hits++;
+            return fd;
+        }
+        closed++;
+        close(fd);
+        if (last) {
+            break;
+        }
+    }
+    misses++;
+    return -1;
+}
+
+void UpstreamPool::release(const std::string & key, int fd) {
+    std::unordered_map<std::string, std::vector<Idle *> >::iterator it = idle.find(key);
+    if (it != idle.end() && it->second.size() >= per_host) {
+        // enough spare connections to this origin already, retire the oldest
+        drop(it->second.front());
+    }
+
+    Idle * conn = new Idle();
+    conn->pool = this;
+    conn->watch.fd = fd;
+    conn->watch.handler = conn;
+    conn->key = key;
+    conn->since = monotonicSeconds();
+    try {
+        loop->watch(&conn->watch, EPOLLIN | EPOLLRDHUP);
+    } catch (const std::exception & e) {
+        delete conn;
+        close(fd);
+        return;
+    }
+    idle[key].push_back(conn);
+    idle_count++;
+}
+
+PoolStats UpstreamPool::getStats() const {
+    PoolStats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.closed = closed.load(std::memory_order_relaxed);
+    stats.expired = expired.load(std::memory_order_relaxed);
+    stats.idle = idle_count.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void UpstreamPool::onEvent(int fd, uint32_t events) {}
+
+void UpstreamPool::onTimer(time_t now) {
+    std::vector<Idle *> stale;
+    for (std::unordered_map<std::string, std::vector<Idle *> >::iterator it = idle.begin();
+         it != idle.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            if (now - it->second[i]->since >= idle_timeout) {
+                stale.push_back(it->second[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < stale.size(); ++i) {
+        expired++;
+        drop(stale[i]);
+    }
+}
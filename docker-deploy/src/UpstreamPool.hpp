@@ -0,0 +1,91 @@
+#ifndef __UPSTREAM_POOL_HPP_
+#define __UPSTREAM_POOL_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.hpp"
+
+/**
+ * Counters of an UpstreamPool, summed over all loops
+ */
+struct PoolStats {
+    // requests sent on a pooled connection / on a new one
+    uint64_t hits;
+    uint64_t misses;
+    // idle connections the origin closed or sent unexpected bytes on
+    uint64_t closed;
+    // idle connections closed after the idle timeout
+    uint64_t expired;
+    uint64_t idle;
+
+    PoolStats() : hits(0), misses(0), closed(0), expired(0), idle(0) {}
+
+    PoolStats & operator+=(const PoolStats & other);
+    std::string toString() const;
+};
+
+/**
+ * Idle persistent connections to origin servers, keyed by "host:port".
+ * Every EventLoop owns one pool and only its thread touches it, so checking a
+ * connection out or in takes no lock. Idle sockets stay registered with the
+ * loop: any event on them means the origin closed the connection or broke
+ * the protocol, and they are dropped at once. Connections idle for longer
+ * than the idle timeout are closed, and at most a fixed number is kept per
+ * origin.
+ */
+class UpstreamPool : public EventHandler {
+private:
+    // one idle socket, a handler of its own so its deletion can be deferred
+    //  like any other handler's
+    struct Idle : public EventHandler {
+        UpstreamPool * pool;
+        Watch watch;
+        std::string key;
+        time_t since;
+
+        void onEvent(int fd, uint32_t events);
+    };
+
+    EventLoop * loop;
+    size_t per_host;
+    int idle_timeout;
+
+    // most recently released connection last
+    std::unordered_map<std::string, std::vector<Idle *> > idle;
+    std::atomic<size_t> idle_count;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> closed;
+    std::atomic<uint64_t> expired;
+
+    void drop(Idle * conn);
+    void remove(Idle * conn);
+    // peek at an idle socket, false if the origin closed it or sent bytes
+    static bool stillOpen(int fd);
+
+    UpstreamPool(const UpstreamPool &);
+    UpstreamPool & operator=(const UpstreamPool &);
+
+public:
+    UpstreamPool(EventLoop * loop, size_t per_host, int idle_timeout);
+    ~UpstreamPool();
+
+    // take an idle connection to key out of the pool, -1 if there is none
+    int acquire(const std::string & key);
+    // hand back a connection whose last response was read completely, the
+    //  pool owns fd afterwards
+    void release(const std::string & key, int fd);
+
+    // readable from any thread
+    PoolStats getStats() const;
+
+    void onEvent(int fd, uint32_t events);
+    void onTimer(time_t now);
+};
+
+#endif
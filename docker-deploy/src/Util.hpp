@@ -2,6 +2,7 @@
 #define __UTIL_HPP_
 
 #include <pthread.h>
+#include <stdint.h>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -12,14 +13,13 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <ctime>
+#include "Logger.hpp"
 #include "RequestType.hpp"
 
 /**
  * This file contains signatures of utility/helper functions
  */
 
-// write std string payload into log file
-void log_info(const std::string & payload);
 
 // get string representation based on enum value
 std::string req_type_repr(RequestType r_type);
@@ -27,29 +27,25 @@ std::string req_type_repr(RequestType r_type);
 // get enum value based on string representation
 RequestType repr_to_req_type(const std::string& repr);
 
-// left-strip null characters ('\0')a string 
-std::string lstrip(const std::string& str);
+std::string currTime();
 
-// receives http messages from stream tied to fd and returns vector of char
-// this function will parse content length or chunks to make sure it receives
-//  full message
-std::vector<char> Recv(int fd, bool is_resp);
+// seconds on the monotonic clock, for timeouts that must not jump with wall time
+time_t monotonicSeconds();
+int64_t monotonicMillis();
 
-// sends http messages in payload to stream tied to fd
-// this function will check on return values from the send system call to make sure
-//  full message is sent
-void Send(int fd, const std::vector<char>& payload);
+// compare data[0, len) with a literal ignoring ascii case, for header names
+bool equalsIgnoreCase(const char * data, size_t len, const char * literal);
 
-std::string currTime();
-std::string allToLowercase(const std::string& str);
+// crc-32 (ieee) of data[0, len), continuing from the crc of preceding bytes
+uint32_t crc32Of(const char * data, size_t len, uint32_t crc = 0);
 
 // get std string representation of error message based on the value of errno
 std::string getErrorMsg();
-int assignValueOrUnspecified(const std::pair<bool, std::string>& data);
+// parse an http date, -1 if it is malformed
 time_t convertToTime(std::string ToConvert);
 
-// send error http message to fd
-void send_error_code(int fd, int error_code);
+// build the error http message for error_code
+std::string error_response(int error_code);
 
 // get the ip address of client/server connected to fd
 std::string getIpAddr(int fd);
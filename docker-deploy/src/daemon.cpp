@@ -1,5 +1,6 @@
 #define BOOST_LOG_DYN_LINK 1
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
@@ -19,20 +20,17 @@
 #include <vector>
 #include <exception>
 
-#include "HttpParser.hpp"
-#include "RequestMeta.hpp"
-#include "Util.hpp"
 #include "Cache.hpp"
+#include "Compressor.hpp"
+#include "Config.hpp"
+#include "EventLoop.hpp"
+#include "Resolver.hpp"
+#include "Revalidator.hpp"
+#include "Snapshot.hpp"
+#include "UpstreamPool.hpp"
+#include "Util.hpp"
 
-#define TCP_MAX_SIZE 65535
-const char * SUCCESS_MSG = "HTTP/1.1 200 OK\r\n\r\n";
-
-// used for passing arguments into threads
-typedef struct {
-  int fd;
-  std::string addr;
-  Cache *cache;
-} parameter_t;
+#define LOG_FILE "/var/log/erss/proxy.log"
 
 static void start_daemon() {
   pid_t pid;
@@ -69,268 +67,141 @@ static void start_daemon() {
   }
 }
 
-int connect_to_remote(const std::string & host, const std::string & url, uint16_t port) {
-  int status;
-  int socket_fd;
-  struct addrinfo host_info;
-  struct addrinfo * host_info_list;
-  char hostname[65535];
-  strcpy(hostname, host.c_str());
-
-  char port_num[65535];
-  strcpy(port_num, std::to_string(port).c_str());
-  memset(&host_info, 0, sizeof(host_info));
-
-  // auto choose from ipv4 and ipv6
-  host_info.ai_family = AF_UNSPEC;
-
-  // TCP
-  host_info.ai_socktype = SOCK_STREAM;
-
-  status = getaddrinfo(hostname, port_num, &host_info, &host_info_list);
-  if (status != 0) {
-    return -1;
+// used for passing arguments into the statistics thread
+typedef struct {
+  Cache * cache;
+  DiskCache * disk;
+  Compressor * compressor;
+  Resolver * resolver;
+  Revalidator * revalidator;
+  std::vector<EventLoop *> * loops;
+  int interval;
+} stats_param_t;
+
+// periodically write cache statistics to the log
+static void * report_stats(void * ptr) {
+  stats_param_t * param = (stats_param_t *)ptr;
+  while (true) {
+    sleep(param->interval);
+    log_info("cache stats: " + param->cache->getStats().toString() +
+             " log_dropped=" + std::to_string(log_dropped()));
+    if (param->disk) {
+      log_info("disk cache stats: " + param->disk->getStats().toString());
+    }
+    if (param->compressor) {
+      log_info("compression stats: " + param->compressor->getStats().toString());
+    }
+    PoolStats pool;
+    for (size_t i = 0; i < param->loops->size(); ++i) {
+      pool += (*param->loops)[i]->getPool().getStats();
+    }
+    log_info("upstream pool stats: " + pool.toString());
+    log_info("collapsed forwarding stats: " + param->cache->getFetches().getStats().toString());
+    log_info("resolver stats: " + param->resolver->getStats().toString());
+    log_info("background revalidation stats: " + param->revalidator->getStats().toString());
   }
+  return NULL;
+}
 
-  socket_fd = socket(host_info_list->ai_family,
-                     host_info_list->ai_socktype,
-                     host_info_list->ai_protocol);
+// used for passing arguments into the snapshot thread
+typedef struct {
+  Cache * cache;
+  Snapshot * snapshot;
+  int interval;
+} snapshot_param_t;
 
-  status = connect(socket_fd, host_info_list->ai_addr, host_info_list->ai_addrlen);
-  if (status == -1) {
-    return -1;
+static void save_snapshot(snapshot_param_t * param) {
+  try {
+    int64_t start = monotonicMillis();
+    size_t saved = param->snapshot->save(*param->cache);
+    log_info("saved cache snapshot of " + std::to_string(saved) + " entries in " +
+             std::to_string(monotonicMillis() - start) + "ms");
+  } catch (const std::exception & e) {
+    log_message(LOG_LEVEL_WARNING, "WARNING " + std::string(e.what()));
   }
-
-  freeaddrinfo(host_info_list);
-
-  return socket_fd;
 }
 
-void * handler(void * ptr) {
-
-  // parse argument from struct
-  int client_connection_fd;
-  std::string ip_addr;
-  parameter_t * param = (parameter_t *)ptr;
-  client_connection_fd = param->fd;
-  ip_addr = param->addr;
-  Cache cache = *(param->cache);
-
-  // free memory
-  delete (parameter_t*)ptr;
-
-  // buffer is the payload of tcp packet
-  char buffer[TCP_MAX_SIZE + 1] = {'\0'};
-  ssize_t rcvd = recv(client_connection_fd, buffer, TCP_MAX_SIZE, 0);
+// restore the previous run's cache, then save it every interval and once more
+//  when the proxy is asked to terminate
+static void * keep_snapshots(void * ptr) {
+  snapshot_param_t * param = (snapshot_param_t *)ptr;
+  if (param->snapshot->open()) {
+    int64_t start = monotonicMillis();
+    SnapshotStats stats = param->snapshot->load(*param->cache);
+    log_info("restored cache snapshot in " + std::to_string(monotonicMillis() - start) + "ms: " +
+             stats.toString());
+  }
 
-  // check if successfully received client request
-  if (rcvd <= 0) {
-    log_info("ERROR failed to receive client request");
-    try {
-      send_error_code(client_connection_fd, 400);
-    } catch (std::exception& e) {
-      log_info("WARNING: " + std::string(e.what()));
+  // every thread blocks these, they are only ever taken here
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGINT);
+  while (true) {
+    struct timespec timeout = {param->interval, 0};
+    int sig = sigtimedwait(&signals, NULL, &timeout);
+    if (sig == -1 && errno == EINTR) {
+      continue;
+    }
+    save_snapshot(param);
+    if (sig != -1) {
+      log_info("terminating on signal " + std::to_string(sig));
+      flush_logger();
+      _exit(EXIT_SUCCESS);
     }
-    return NULL;
   }
+  return NULL;
+}
 
-  try {
-    std::vector<char> payload_vec;
-    for (ssize_t i = 0; i < rcvd; ++i) {
-      payload_vec.push_back(buffer[i]);
-    }
+// answer a client no loop has room for right away instead of letting it wait
+static void reject_client(int fd) {
+  std::string msg = error_response(503);
+  ssize_t sent = send(fd, msg.c_str(), msg.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+  (void)sent;
+  close(fd);
+  log_message(LOG_LEVEL_WARNING, "WARNING accept queues full, rejected client with 503");
+}
 
-    // parse client request
-    RequestMeta meta = HttpParser::parseHeader(payload_vec);
-
-    // try to connect to remote server specified in client request
-    int server_socket_fd =
-        connect_to_remote(meta.getHost(), meta.getUrl(), meta.getPort());
-    if (server_socket_fd == -1) {
-      send_error_code(client_connection_fd, 502);
-      close(client_connection_fd);
-      log_info("ERROR failed to establish connection with remote server");
-      return NULL;
-    }
+int main(int argc, char ** argv) {
+  ProxyConfig config = parseConfig(argc, argv);
+  if (!config.foreground) {
+    start_daemon();
+  }
 
-    log_info("\"" + meta.getFirstLine() + "\" from " + getIpAddr(client_connection_fd) + " @ " + getTimeAsString());
-    if (meta.getRequestType() == POST) {
-      // forward request to server
-      Send(server_socket_fd, payload_vec);
+  // with a snapshot, termination is handled by the snapshot thread, block it
+  //  before any thread is started so they all inherit the mask
+  if (!config.snapshot_path.empty()) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  }
 
-      std::vector<char> server_resp = Recv(server_socket_fd, true);
-      std::stringstream ss;
-      for (size_t i = 0; i < server_resp.size(); i++) {
-        ss << server_resp[i];
-      }
+  // every thread logs through the asynchronous writer from here on
+  set_log_level(config.log_level);
+  start_logger(LOG_FILE);
 
-      std::string server_resp_str = ss.str();
+  // peers closing mid-write must surface as EPIPE, not kill the proxy
+  signal(SIGPIPE, SIG_IGN);
 
-      // forward response to client
-      Send(client_connection_fd, server_resp);
-      close(server_socket_fd);
-    }
-    else if (meta.getRequestType() == CONNECT) {
-
-      // at this time we have already established connection with remote server
-      //  send msg back to client to indicate success
-
-      // send success message back to client
-      ssize_t sent;
-      sent = send(client_connection_fd, SUCCESS_MSG, strlen(SUCCESS_MSG), 0);
-      sent = 0;
-      ssize_t received;
-
-      // forward packet from client to server and from server to client
-      fd_set fds;
-
-      int max_fd = client_connection_fd > server_socket_fd ? client_connection_fd
-                                                           : server_socket_fd;
-      struct timeval tv;
-      tv.tv_sec = 10;
-      tv.tv_usec = 0;
-      while (true) {
-        FD_ZERO(&fds);
-        FD_SET(client_connection_fd, &fds);
-        FD_SET(server_socket_fd, &fds);
-
-        int res = select(max_fd + 1, &fds, NULL, NULL, &tv);
-        
-
-        if (res <= 0) {
-          throw std::runtime_error(getErrorMsg() + " select failed");
-        }
-        else {
-          try {
-            int descriptors[2] = {client_connection_fd, server_socket_fd};
-            for (int i = 0; i < 2; ++i) {
-              if (FD_ISSET(descriptors[i], &fds)) {
-                std::vector<char> buffer(TCP_MAX_SIZE + 1, '\0');
-                received = recv(descriptors[i], &(buffer.data()[0]), TCP_MAX_SIZE, 0);
-                if (received <= 0) {
-                  throw std::runtime_error(getErrorMsg() + " with " +
-                                           std::to_string(received) +
-                                           " from connect recv");
-                }
-
-                sent =
-                    send(descriptors[i == 0 ? 1 : 0], &(buffer.data()[0]), received, 0);
-                if (sent <= 0) {
-                  throw std::runtime_error(getErrorMsg() + " with " +
-                                           std::to_string(received) +
-                                           " from connect send");
-                }
-              }
-            }
-          }
-          catch (const std::runtime_error & e) {
-            ;
-          }
-        }
-      }
-      log_info("Tunnel closed");
-      close(server_socket_fd);
-    }
-      /* receive GET request from server, check if it is in the cache. If in the cache check its revalidation and freshness. If not, forward the request to the server directly */
-    
-    else if (meta.getRequestType() == GET) {
-      if(cache.find(meta.getFirstLine())){
-          std::vector<char> response = cache.get(meta.getFirstLine());
-          ResponseMeta resp = HttpParser::parseRespHeader(response);
-          if(resp.isNoCache()){
-              log_info("cached, but requires re-validation");
-              std::string new_req = cache.revalidate(resp,meta);
-              //send revalidate request to the server
-              send(server_socket_fd, new_req.c_str(), new_req.length(), 0);
-              std::vector<char> r1 = Recv(server_socket_fd, true);
-              try{
-                  ResponseMeta sec_response= HttpParser::parseRespHeader(r1);
-                  std::string firstLine = sec_response.getFirstLine();
-                  //if return 304, use the response in the cache, else store the response send by server.
-                  size_t f = firstLine.find("304");
-                  if(f == std::string::npos){
-                      cache.put(sec_response.getFirstLine(),r1);
-                      log_info("Responding \"HTTP/1.1 200 OK\"");
-                      Send(client_connection_fd, r1);
-                      close(server_socket_fd);
-                  }
-                  else{
-                      log_info("in cache, valid");
-                      Send(client_connection_fd,cache.get(meta.getFirstLine()));
-                      close(server_socket_fd);
-                  }
-              }
-              catch (std::invalid_argument &e) {
-                  send_error_code(client_connection_fd, 502);
-              }
-
-          }
-          else{
-	    //check freshness
-              if(!(resp.if_fresh())){
-                  std::string new_req = cache.revalidate(resp,meta);
-                  send(server_socket_fd, new_req.c_str(), new_req.length(), 0);
-                  std::vector<char> r1 = Recv(server_socket_fd, true);
-                  try {
-                      ResponseMeta sec_response = HttpParser::parseRespHeader(r1);
-                      std::string firstLine = sec_response.getFirstLine();
-                      size_t f = firstLine.find("304");
-                      if(f == std::string::npos){
-                          cache.put(sec_response.getFirstLine(), r1);
-                          Send(client_connection_fd, r1);
-                          close(server_socket_fd);
-                      }
-                      else{
-                          //send the response in the cache back to the client
-                          log_info("in cache, valid");
-                          Send(client_connection_fd,cache.get(meta.getFirstLine()));
-                          close(server_socket_fd);
-                      }
-                  }
-                  catch (std::invalid_argument &e) {
-                      send_error_code(client_connection_fd, 502);
-                  }
-              }
-          }
-      }
-      //not in the cache
-      else {
-          log_info("not in cache");
-          Send(server_socket_fd, payload_vec);
-          std::vector<char> resp = Recv(server_socket_fd, true);
-
-          try {
-              ResponseMeta response = HttpParser::parseRespHeader(resp);
-              // log_info("Responding" + response.getFirstLine());
-              log_info("Received \"" + stripNewLine(response.getFirstLine()) + "\" from " + meta.getHost());
-              if(cache.store_response(resp)){
-                  cache.put(response.getFirstLine(), resp);
-              }
-              Send(client_connection_fd, resp);
-              close(server_socket_fd);
-          }
-          catch (std::invalid_argument &e) {
-              send_error_code(client_connection_fd, 502);
-              log_info("ERROR " + std::string(e.what()));
-          }
-      }
-    }
-    else {
-      throw std::invalid_argument("Unsupported http request type");
+  // responses evicted from memory move on to the disk tier, if there is one
+  DiskCache * disk = NULL;
+  if (!config.disk_dir.empty()) {
+    try {
+      disk = new DiskCache(config.disk_dir, config.disk_bytes);
+    } catch (const std::exception & e) {
+      log_message(LOG_LEVEL_ERROR, "ERROR " + std::string(e.what()));
+      return EXIT_FAILURE;
     }
   }
-  catch (const std::exception & e) {
-    log_info("WARNING " + std::string(e.what()));
+  // compressible responses are stored gzipped if asked to
+  Compressor * compressor = NULL;
+  if (config.compress_level > 0) {
+    compressor = new Compressor(config.compress_level, config.compress_types);
   }
-
-  close(client_connection_fd);
-  return NULL;
-}
-
-int main(int argc, const char ** argv) {
-  start_daemon();
-
-  Cache cash;
+  Cache cash(config.cache_bytes, config.cache_object_ratio, disk, config.stale_grace,
+             config.ignored_query_params, compressor);
 
   // setup listening tcp server
   int status;
@@ -338,7 +209,7 @@ int main(int argc, const char ** argv) {
   struct addrinfo host_info;
   struct addrinfo * host_info_list;
   const char * hostname = NULL;
-  const char * port = "12345";
+  const char * port = config.port.c_str();
   memset(&host_info, 0, sizeof(host_info));
 
   host_info.ai_family = AF_UNSPEC;
@@ -352,7 +223,7 @@ int main(int argc, const char ** argv) {
   }
 
   socket_fd = socket(host_info_list->ai_family,
-                     host_info_list->ai_socktype,
+                     host_info_list->ai_socktype | SOCK_CLOEXEC,
                      host_info_list->ai_protocol);
 
   if (socket_fd == -1) {
@@ -373,7 +244,7 @@ int main(int argc, const char ** argv) {
     return EXIT_FAILURE;
   }
 
-  status = listen(socket_fd, 100);
+  status = listen(socket_fd, SOMAXCONN);
   if (status == -1) {
     log_info("failed to listen on port");
     return EXIT_FAILURE;
@@ -381,35 +252,67 @@ int main(int argc, const char ** argv) {
 
   freeaddrinfo(host_info_list);
 
-  while (true) {
-    try {
-      struct sockaddr_storage socket_addr;
-      socklen_t socket_addr_len = sizeof(socket_addr);
-      int client_connection_fd;
-      client_connection_fd =
-          accept(socket_fd, (struct sockaddr *)&socket_addr, &socket_addr_len);
-
-      if (client_connection_fd < 0) {
-        continue;
-      }
-
-      std::string ip_addr = inet_ntoa(((struct sockaddr_in *)&socket_addr)->sin_addr);
+  // a small fixed set of event loops serves every connection, origin names are
+  //  looked up for them by the resolver's threads and stale entries are
+  //  revalidated by the revalidator's
+  Resolver * resolver = NULL;
+  Revalidator * revalidator = NULL;
+  std::vector<EventLoop *> loops;
+  try {
+    resolver = new Resolver(config);
+    resolver->start();
+    revalidator = new Revalidator(&cash, resolver, config);
+    revalidator->start();
+    for (int i = 0; i < config.loop_threads; ++i) {
+      EventLoop * loop = new EventLoop(&cash, resolver, revalidator, config);
+      loop->start();
+      loops.push_back(loop);
+    }
+  } catch (const std::exception & e) {
+    log_message(LOG_LEVEL_ERROR, "ERROR " + std::string(e.what()));
+    return EXIT_FAILURE;
+  }
 
-      if (client_connection_fd == -1) {
-        continue;
-      }
+  stats_param_t stats_param;
+  stats_param.cache = &cash;
+  stats_param.disk = disk;
+  stats_param.compressor = compressor;
+  stats_param.resolver = resolver;
+  stats_param.revalidator = revalidator;
+  stats_param.loops = &loops;
+  stats_param.interval = config.stats_interval;
+  pthread_t stats_thread;
+  pthread_create(&stats_thread, NULL, report_stats, &stats_param);
+  pthread_detach(stats_thread);
+
+  // the cache of the previous run is restored while clients are already served
+  snapshot_param_t snapshot_param;
+  if (!config.snapshot_path.empty()) {
+    snapshot_param.cache = &cash;
+    snapshot_param.snapshot = new Snapshot(config.snapshot_path);
+    snapshot_param.interval = config.snapshot_interval;
+    pthread_t snapshot_thread;
+    pthread_create(&snapshot_thread, NULL, keep_snapshots, &snapshot_param);
+    pthread_detach(snapshot_thread);
+  }
 
-      // spawn a thread for handling the request
-      parameter_t * parameter = new parameter_t;
-      parameter->addr = ip_addr;
-      parameter->fd = client_connection_fd;
-      parameter->cache = &cash;
+  // this thread only accepts and hands clients to the loops round-robin
+  size_t next_loop = 0;
+  while (true) {
+    int client_connection_fd = accept4(socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_connection_fd < 0) {
+      continue;
+    }
 
+    // skip loops whose queue is full, shed the client when all of them are
+    bool queued = false;
+    for (size_t i = 0; i < loops.size() && !queued; ++i) {
+      queued = loops[(next_loop + i) % loops.size()]->post(client_connection_fd);
+    }
+    next_loop = (next_loop + 1) % loops.size();
 
-      pthread_t handler_thread;
-      pthread_create(&handler_thread, NULL, handler, (void*)parameter);
-    } catch (const std::exception& e) {
-      continue;
+    if (!queued) {
+      reject_client(client_connection_fd);
     }
   }
 
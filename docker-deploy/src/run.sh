@@ -1,7 +1,11 @@
 #!/bin/bash
 make clean
 make
-./proxy_daemon &
+# the cache snapshot is kept on the log volume, docker stop reaches the proxy
+#  as SIGTERM so it saves the cache before exiting
+./proxy_daemon -f -P /var/log/erss/cache.snapshot &
+proxy=$!
+trap 'kill -TERM $proxy; wait $proxy; exit 0' TERM INT
 while true
 do
     sleep 1